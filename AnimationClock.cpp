@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "AnimationClock.h"
+
+RealClock::RealClock()
+{
+	LARGE_INTEGER frequency;
+	if (!QueryPerformanceFrequency(&frequency))
+	{
+		throw ref new Platform::FailureException();
+	}
+	_frequency = frequency.QuadPart;
+}
+
+ClockTicks RealClock::Now() const
+{
+	LARGE_INTEGER counter;
+	if (!QueryPerformanceCounter(&counter))
+	{
+		throw ref new Platform::FailureException();
+	}
+	//split so the multiply can't overflow however long the machine has been up
+	auto seconds = counter.QuadPart / _frequency;
+	auto remainder = counter.QuadPart % _frequency;
+	return seconds * TicksPerSecond + (remainder * TicksPerSecond) / _frequency;
+}
+
+static std::once_flag s_realClockOnce;
+static std::shared_ptr<IAnimationClock>* s_realClock = nullptr;
+
+std::shared_ptr<IAnimationClock> RealClock::Instance()
+{
+	std::call_once(s_realClockOnce, []()
+	{
+		s_realClock = new std::shared_ptr<IAnimationClock>(std::make_shared<RealClock>());
+	});
+	return *s_realClock;
+}
+
+ScaledClock::ScaledClock(std::shared_ptr<IAnimationClock> source, double rate) : _source(source), _scaledAnchor(0), _rate(rate < 0 ? 0 : rate), _paused(false)
+{
+	_sourceAnchor = _source->Now();
+}
+
+ClockTicks ScaledClock::Now() const
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	if (_paused)
+		return _scaledAnchor;
+	return _scaledAnchor + static_cast<ClockTicks>((_source->Now() - _sourceAnchor) * _rate);
+}
+
+//called with _clockMutex held, folds the time so far into the anchor so the next change starts from here
+void ScaledClock::Reanchor()
+{
+	auto sourceNow = _source->Now();
+	if (!_paused)
+		_scaledAnchor += static_cast<ClockTicks>((sourceNow - _sourceAnchor) * _rate);
+	_sourceAnchor = sourceNow;
+}
+
+void ScaledClock::Source(std::shared_ptr<IAnimationClock> source)
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	Reanchor();
+	_source = source;
+	_sourceAnchor = _source->Now();
+}
+
+void ScaledClock::Rate(double rate)
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	Reanchor();
+	_rate = rate < 0 ? 0 : rate;
+}
+
+double ScaledClock::Rate() const
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	return _rate;
+}
+
+void ScaledClock::Pause()
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	Reanchor();
+	_paused = true;
+}
+
+void ScaledClock::Resume()
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	Reanchor();
+	_paused = false;
+}
+
+bool ScaledClock::IsPaused() const
+{
+	std::lock_guard<std::mutex> clockGuard(_clockMutex);
+	return _paused;
+}
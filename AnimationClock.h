@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+//time as whole microseconds, 64 bits so a clock can run for the life of the process without losing precision
+typedef int64_t ClockTicks;
+static const ClockTicks TicksPerMillisecond = 1000;
+static const ClockTicks TicksPerSecond = 1000 * TicksPerMillisecond;
+
+//where animations get their time from, Now() only has to be monotonic, what zero means is up to the clock
+class IAnimationClock
+{
+public:
+	virtual ClockTicks Now() const = 0;
+	virtual ~IAnimationClock() {}
+};
+
+//the performance counter, the default for anything on screen
+class RealClock : public IAnimationClock
+{
+private:
+	int64_t _frequency;
+public:
+	RealClock();
+	virtual ClockTicks Now() const;
+	//shared by every decoder that isn't handed a clock of its own
+	static std::shared_ptr<IAnimationClock> Instance();
+};
+
+//only moves when told to, for driving playback from a vsync callback or stepping it deterministically
+class ManualClock : public IAnimationClock
+{
+private:
+	std::atomic<ClockTicks> _now;
+public:
+	ManualClock(ClockTicks start = 0) : _now(start) {}
+	virtual ClockTicks Now() const { return _now.load(); }
+	void Set(ClockTicks now) { _now.store(now); }
+	void Advance(ClockTicks ticks) { _now.fetch_add(ticks); }
+};
+
+//another clock sped up, slowed down or stopped, rate and pause changes only affect time from that point on
+class ScaledClock : public IAnimationClock
+{
+private:
+	std::shared_ptr<IAnimationClock> _source;
+	mutable std::mutex _clockMutex;
+	ClockTicks _sourceAnchor;
+	ClockTicks _scaledAnchor;
+	double _rate;
+	bool _paused;
+	void Reanchor();
+public:
+	ScaledClock(std::shared_ptr<IAnimationClock> source, double rate = 1.0);
+	virtual ClockTicks Now() const;
+	//swaps the underlying clock without a jump in this one
+	void Source(std::shared_ptr<IAnimationClock> source);
+	void Rate(double rate);
+	double Rate() const;
+	void Pause();
+	void Resume();
+	bool IsPaused() const;
+};
@@ -0,0 +1,180 @@
+#include "pch.h"
+#include "AnimationScheduler.h"
+#include "DecodePool.h"
+
+using namespace concurrency;
+using namespace Windows::System::Threading;
+using namespace Windows::UI::Core;
+
+static std::once_flag s_schedulerOnce;
+static AnimationScheduler* s_scheduler = nullptr;
+
+AnimationScheduler& AnimationScheduler::Instance()
+{
+	std::call_once(s_schedulerOnce, []()
+	{
+		s_scheduler = new AnimationScheduler();
+	});
+	return *s_scheduler;
+}
+
+AnimationScheduler::AnimationScheduler() : _clock(RealClock::Instance()), _timer(nullptr), _armedDeadline(INT64_MAX)
+{
+}
+
+void AnimationScheduler::Register(std::shared_ptr<IAnimationTarget> target, CoreDispatcher^ dispatcher)
+{
+	std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+	for (auto& entry : _entries)
+	{
+		if (entry.key == target.get())
+			return;
+	}
+	Entry entry = { target.get(), target, dispatcher, _clock->Now(), false };
+	_entries.push_back(entry);
+	Arm();
+}
+
+void AnimationScheduler::Unregister(IAnimationTarget* target)
+{
+	std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+	_entries.erase(std::remove_if(_entries.begin(), _entries.end(), [target](const Entry& entry) { return entry.key == target; }), _entries.end());
+}
+
+size_t AnimationScheduler::RegisteredCount()
+{
+	std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+	return _entries.size();
+}
+
+//called with _scheduleMutex held
+void AnimationScheduler::Arm()
+{
+	auto soonest = INT64_MAX;
+	for (auto& entry : _entries)
+	{
+		if (!entry.advancing && entry.deadline < soonest)
+			soonest = entry.deadline;
+	}
+
+	if (soonest == INT64_MAX || (_timer != nullptr && _armedDeadline <= soonest))
+		return;
+
+	if (_timer != nullptr)
+		_timer->Cancel();
+
+	auto delay = soonest - _clock->Now();
+	Windows::Foundation::TimeSpan timerDelay;
+	timerDelay.Duration = delay > 0 ? delay * 10 : 0; //TimeSpan is in 100ns units
+	_armedDeadline = soonest;
+	_timer = ThreadPoolTimer::CreateTimer(ref new TimerElapsedHandler([this](ThreadPoolTimer^ timer)
+	{
+		{
+			std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+			if (_timer != timer)
+				return;
+			_timer = nullptr;
+			_armedDeadline = INT64_MAX;
+		}
+		Tick();
+	}), timerDelay);
+}
+
+void AnimationScheduler::Tick()
+{
+	auto due = std::make_shared<std::vector<DueTarget>>();
+	{
+		std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+		auto now = _clock->Now();
+		_entries.erase(std::remove_if(_entries.begin(), _entries.end(), [](const Entry& entry) { return entry.target.expired(); }), _entries.end());
+		for (auto& entry : _entries)
+		{
+			if (entry.advancing || entry.deadline > now + TickSlack)
+				continue;
+			auto target = entry.target.lock();
+			if (target == nullptr)
+				continue;
+			entry.advancing = true;
+			DueTarget dueTarget = { target, entry.dispatcher, -1, false };
+			due->push_back(dueTarget);
+		}
+		if (due->empty())
+		{
+			Arm();
+			return;
+		}
+	}
+
+	std::vector<task<void>> advances;
+	for (size_t i = 0; i < due->size(); i++)
+	{
+		advances.push_back(DecodePool::Instance().Run([due, i]()
+		{
+			auto& dueTarget = (*due)[i];
+			try
+			{
+				dueTarget.changed = dueTarget.target->Advance(dueTarget.nextDelay);
+			}
+			catch (...)
+			{
+				//drop it rather than spin on something that keeps failing
+				dueTarget.changed = false;
+				dueTarget.nextDelay = -1;
+			}
+		}, DecodePriority::NextFrame));
+	}
+
+	when_all(advances.begin(), advances.end()).then([this, due](task<void> advanced)
+	{
+		try
+		{
+			advanced.get();
+		}
+		catch (...) {}
+		FinishTick(due);
+	});
+}
+
+void AnimationScheduler::FinishTick(std::shared_ptr<std::vector<DueTarget>> due)
+{
+	std::vector<std::pair<CoreDispatcher^, std::vector<std::shared_ptr<IAnimationTarget>>>> invalidations;
+	{
+		std::lock_guard<std::mutex> scheduleGuard(_scheduleMutex);
+		auto now = _clock->Now();
+		for (auto& dueTarget : *due)
+		{
+			auto found = std::find_if(_entries.begin(), _entries.end(), [&](const Entry& entry) { return entry.key == dueTarget.target.get(); });
+			if (found != _entries.end())
+			{
+				if (dueTarget.nextDelay < 0)
+					_entries.erase(found);
+				else
+				{
+					found->advancing = false;
+					found->deadline = now + dueTarget.nextDelay;
+				}
+			}
+
+			if (!dueTarget.changed)
+				continue;
+			auto group = std::find_if(invalidations.begin(), invalidations.end(), [&](const std::pair<CoreDispatcher^, std::vector<std::shared_ptr<IAnimationTarget>>>& pair) { return pair.first == dueTarget.dispatcher; });
+			if (group == invalidations.end())
+			{
+				invalidations.push_back(std::make_pair(dueTarget.dispatcher, std::vector<std::shared_ptr<IAnimationTarget>>()));
+				group = invalidations.end() - 1;
+			}
+			group->second.push_back(dueTarget.target);
+		}
+		Arm();
+	}
+
+	for (auto& group : invalidations)
+	{
+		auto targets = group.second;
+		group.first->RunAsync(CoreDispatcherPriority::Normal, ref new DispatchedHandler([targets]()
+		{
+			for (auto& target : targets)
+				target->Invalidate();
+		}));
+	}
+}
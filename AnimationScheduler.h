@@ -0,0 +1,59 @@
+#pragma once
+
+#include "AnimationClock.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//something on screen that animates, Advance runs on the decode pool and Invalidate on the target's dispatcher
+class IAnimationTarget
+{
+public:
+	//moves playback up to now, returns true if there is something new to draw
+	//nextDelay is how long until it next needs to run, negative once there is nothing left to animate
+	virtual bool Advance(ClockTicks& nextDelay) = 0;
+	virtual void Invalidate() = 0;
+	virtual ~IAnimationTarget() {}
+};
+
+//one tick for every animation in the process instead of one per control
+//each tick advances everything that is due together on the decode pool, then invalidates the lot in a single
+//pass per dispatcher, and the timer is rearmed for whichever registered animation is due soonest
+class AnimationScheduler
+{
+private:
+	struct Entry
+	{
+		IAnimationTarget* key;
+		std::weak_ptr<IAnimationTarget> target;
+		Windows::UI::Core::CoreDispatcher^ dispatcher;
+		ClockTicks deadline;
+		bool advancing;
+	};
+	struct DueTarget
+	{
+		std::shared_ptr<IAnimationTarget> target;
+		Windows::UI::Core::CoreDispatcher^ dispatcher;
+		ClockTicks nextDelay;
+		bool changed;
+	};
+	//deadlines this close together are handled in the same tick
+	static const ClockTicks TickSlack = 2 * TicksPerMillisecond;
+	std::shared_ptr<IAnimationClock> _clock;
+	std::mutex _scheduleMutex;
+	std::vector<Entry> _entries;
+	Windows::System::Threading::ThreadPoolTimer^ _timer;
+	ClockTicks _armedDeadline;
+	AnimationScheduler();
+	AnimationScheduler(const AnimationScheduler&) = delete;
+	AnimationScheduler& operator=(const AnimationScheduler&) = delete;
+	void Arm();
+	void Tick();
+	void FinishTick(std::shared_ptr<std::vector<DueTarget>> due);
+public:
+	static AnimationScheduler& Instance();
+	//safe to call every frame, a target that is already registered keeps its current deadline
+	void Register(std::shared_ptr<IAnimationTarget> target, Windows::UI::Core::CoreDispatcher^ dispatcher);
+	void Unregister(IAnimationTarget* target);
+	size_t RegisteredCount();
+};
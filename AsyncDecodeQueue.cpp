@@ -0,0 +1,68 @@
+#include "pch.h"
+#include "AsyncDecodeQueue.h"
+
+using namespace concurrency;
+using namespace Windows::Foundation;
+
+AsyncDecodeQueue::AsyncDecodeQueue(cancellation_token cancelToken) : _running(false), _cancelToken(cancelToken)
+{
+}
+
+task<Rect> AsyncDecodeQueue::Schedule(DecodeJob job)
+{
+	std::unique_ptr<Request> replaced;
+	std::unique_ptr<Request> request(new Request());
+	request->job = std::move(job);
+	auto completed = request->completed;
+	bool startRunner = false;
+	{
+		std::lock_guard<std::mutex> queueGuard(_queueMutex);
+		replaced = std::move(_pending);
+		_pending = std::move(request);
+		startRunner = !_running;
+		_running = true;
+	}
+
+	//the caller is only ever waiting on its newest request, an empty rect tells it nothing new was decoded
+	if (replaced != nullptr)
+		replaced->completed.set(Rect());
+
+	if (startRunner)
+	{
+		auto queue = shared_from_this();
+		DecodePool::Instance().Submit([queue]() { queue->RunPending(); }, DecodePriority::Visible);
+	}
+	return task<Rect>(completed, _cancelToken);
+}
+
+void AsyncDecodeQueue::RunPending()
+{
+	for (;;)
+	{
+		std::unique_ptr<Request> request;
+		{
+			std::lock_guard<std::mutex> queueGuard(_queueMutex);
+			if (_pending == nullptr)
+			{
+				_running = false;
+				return;
+			}
+			request = std::move(_pending);
+		}
+
+		if (_cancelToken.is_canceled())
+		{
+			request->completed.set(Rect());
+			continue;
+		}
+
+		try
+		{
+			request->completed.set(request->job());
+		}
+		catch (...)
+		{
+			request->completed.set_exception(std::current_exception());
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "DecodePool.h"
+#include <ppltasks.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//result of an asynchronous decode, the pixel storage is handed back and forth between the decoder and
+//the job so repeated requests of a similar size don't reallocate
+struct DecodedPixels
+{
+	Windows::Foundation::Rect rect;
+	Windows::Foundation::Size renderSize;
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> pixels;
+	bool valid;
+	DecodedPixels() : width(0), height(0), valid(false) {}
+	bool Covers(Windows::Foundation::Rect requestedRect, Windows::Foundation::Size currentRenderSize) const
+	{
+		return valid && renderSize.Width == currentRenderSize.Width && renderSize.Height == currentRenderSize.Height &&
+			requestedRect.Left >= rect.Left && requestedRect.Top >= rect.Top &&
+			requestedRect.Right <= rect.Right && requestedRect.Bottom <= rect.Bottom;
+	}
+};
+
+//backs DecodeRectangleAsync, at most one decode runs per decoder on the decode pool
+//a request that arrives while one is running replaces whatever was waiting, the replaced one completes with an empty rect
+class AsyncDecodeQueue : public std::enable_shared_from_this<AsyncDecodeQueue>
+{
+public:
+	typedef std::function<Windows::Foundation::Rect()> DecodeJob;
+private:
+	struct Request
+	{
+		DecodeJob job;
+		concurrency::task_completion_event<Windows::Foundation::Rect> completed;
+	};
+	std::mutex _queueMutex;
+	std::unique_ptr<Request> _pending;
+	bool _running;
+	concurrency::cancellation_token _cancelToken;
+	void RunPending();
+public:
+	AsyncDecodeQueue(concurrency::cancellation_token cancelToken);
+	concurrency::task<Windows::Foundation::Rect> Schedule(DecodeJob job);
+};
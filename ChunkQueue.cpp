@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "ChunkQueue.h"
+
+using namespace concurrency;
+using namespace Windows::Storage::Streams;
+
+ChunkQueue::ChunkQueue(uint32_t maxBytes) : _maxBytes(maxBytes), _bytesInFlight(0), _draining(false)
+{
+}
+
+bool ChunkQueue::Fits(uint32_t byteCount) const
+{
+	//a single chunk larger than the cap still has to get through on its own
+	return _bytesInFlight == 0 || _bytesInFlight + byteCount <= _maxBytes;
+}
+
+task<void> ChunkQueue::Push(IBuffer^ buffer, bool finished, uint32_t expectedSize, bool& startWorker)
+{
+	Chunk chunk = { buffer, finished, expectedSize, buffer != nullptr ? buffer->Length : 0 };
+	std::lock_guard<std::mutex> queueGuard(_queueMutex);
+	startWorker = !_draining;
+	_draining = true;
+	if (_pending.empty() && Fits(chunk.byteCount))
+	{
+		_bytesInFlight += chunk.byteCount;
+		_queued.push_back(chunk);
+		return task_from_result();
+	}
+	else
+	{
+		PendingChunk pending = { chunk, task_completion_event<void>() };
+		_pending.push_back(pending);
+		return task<void>(pending.admitted);
+	}
+}
+
+bool ChunkQueue::Pop(Chunk& chunk)
+{
+	std::lock_guard<std::mutex> queueGuard(_queueMutex);
+	if (_queued.empty())
+	{
+		_draining = false;
+		return false;
+	}
+	chunk = _queued.front();
+	_queued.pop_front();
+	return true;
+}
+
+void ChunkQueue::Release(const Chunk& chunk)
+{
+	std::vector<task_completion_event<void>> admitted;
+	{
+		std::lock_guard<std::mutex> queueGuard(_queueMutex);
+		_bytesInFlight -= chunk.byteCount;
+		while (!_pending.empty() && Fits(_pending.front().chunk.byteCount))
+		{
+			_bytesInFlight += _pending.front().chunk.byteCount;
+			_queued.push_back(_pending.front().chunk);
+			admitted.push_back(_pending.front().admitted);
+			_pending.pop_front();
+		}
+	}
+	//continuations can run inline so don't hold the lock while waking the reader
+	for (auto& admittedEvent : admitted)
+		admittedEvent.set();
+}
+
+uint32_t ChunkQueue::BytesInFlight()
+{
+	std::lock_guard<std::mutex> queueGuard(_queueMutex);
+	return _bytesInFlight;
+}
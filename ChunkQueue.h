@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ppltasks.h>
+#include <deque>
+#include <mutex>
+
+//bounded hand-off between ResourceLoader's read loop and a decoder's worker
+//Push always returns straight away, the task it hands back only completes once the chunk fits under the byte cap
+//so the reader can overlap with decoding without ever getting more than the cap ahead of it
+class ChunkQueue
+{
+public:
+	struct Chunk
+	{
+		Windows::Storage::Streams::IBuffer^ buffer;
+		bool finished;
+		uint32_t expectedSize;
+		uint32_t byteCount;
+	};
+private:
+	struct PendingChunk
+	{
+		Chunk chunk;
+		concurrency::task_completion_event<void> admitted;
+	};
+	std::mutex _queueMutex;
+	std::deque<Chunk> _queued;
+	std::deque<PendingChunk> _pending;
+	uint32_t _maxBytes;
+	uint32_t _bytesInFlight;
+	bool _draining;
+	bool Fits(uint32_t byteCount) const;
+public:
+	ChunkQueue(uint32_t maxBytes);
+	//startWorker is set when the caller is responsible for starting a worker to drain the queue
+	concurrency::task<void> Push(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize, bool& startWorker);
+	//returns false and gives up the worker role once there is nothing left to do
+	bool Pop(Chunk& chunk);
+	//called by the worker once it is done with a popped chunk
+	void Release(const Chunk& chunk);
+	uint32_t BytesInFlight();
+};
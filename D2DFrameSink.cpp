@@ -0,0 +1,42 @@
+#include "pch.h"
+#include "D2DFrameSink.h"
+#include "GifTrace.h"
+
+static void ThrowIfFailed(HRESULT hr)
+{
+	if (FAILED(hr))
+	{
+		throw Platform::Exception::CreateException(hr);
+	}
+}
+
+D2DFrameSink::D2DFrameSink(Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext) : _d2dContext(d2dContext), _width(0), _height(0), _ignoreAlpha(false)
+{
+}
+
+void D2DFrameSink::Prepare(uint32_t width, uint32_t height, bool ignoreAlpha)
+{
+	if (_bitmap != nullptr && width == _width && height == _height && ignoreAlpha == _ignoreAlpha)
+		return;
+
+	GIF_TRACE_SCOPE("CreateBitmap");
+	Forget();
+	_bitmap = nullptr;
+	D2D1_BITMAP_PROPERTIES1 properties;
+	memset(&properties, 0, sizeof(D2D1_BITMAP_PROPERTIES1));
+	_d2dContext->GetDpi(&properties.dpiX, &properties.dpiY);
+	properties.pixelFormat = D2D1_PIXEL_FORMAT{ DXGI_FORMAT_B8G8R8A8_UNORM, ignoreAlpha ? D2D1_ALPHA_MODE_IGNORE : D2D1_ALPHA_MODE_PREMULTIPLIED };
+	D2D1_SIZE_U size = { width, height };
+	ThrowIfFailed(_d2dContext->CreateBitmap(size, nullptr, 0, properties, _bitmap.ReleaseAndGetAddressOf()));
+	_width = width;
+	_height = height;
+	_ignoreAlpha = ignoreAlpha;
+}
+
+void D2DFrameSink::Upload(const uint32_t* pixels, int pitch, int left, int top, int right, int bottom)
+{
+	if (right <= left || bottom <= top)
+		return;
+	D2D1_RECT_U rect = { static_cast<UINT32>(left), static_cast<UINT32>(top), static_cast<UINT32>(right), static_cast<UINT32>(bottom) };
+	ThrowIfFailed(_bitmap->CopyFromMemory(&rect, pixels, pitch * 4));
+}
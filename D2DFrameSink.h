@@ -0,0 +1,24 @@
+#pragma once
+
+#include "FrameSink.h"
+
+#include <wrl.h>
+#include <wrl\client.h>
+#include <d2d1_1.h>
+
+//the renderer's sink, one bitmap on its device context kept for as long as frames keep coming at the same size
+//it belongs to the context it was made with, so the renderer makes a new one along with the context
+class D2DFrameSink : public IFrameSink
+{
+private:
+	Microsoft::WRL::ComPtr<ID2D1DeviceContext> _d2dContext;
+	Microsoft::WRL::ComPtr<ID2D1Bitmap1> _bitmap;
+	uint32_t _width;
+	uint32_t _height;
+	bool _ignoreAlpha;
+public:
+	D2DFrameSink(Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext);
+	virtual void Prepare(uint32_t width, uint32_t height, bool ignoreAlpha);
+	virtual void Upload(const uint32_t* pixels, int pitch, int left, int top, int right, int bottom);
+	Microsoft::WRL::ComPtr<ID2D1Bitmap1> Bitmap() const { return _bitmap; }
+};
@@ -43,24 +43,31 @@ void D2DRenderer::Draw()
 				requestedBounds.bottom = updateRects[i].bottom;
 		}
 		
+		//the decoder is asked once for the bounds of every update rect, each rect then draws its part of the same bitmap
+		bool decoded = false;
 		for (DWORD i = 0; i < rectCount; i++)
 		{
 			POINT offset;
 			ComPtr<IDXGISurface> surface;
-			ComPtr<ID2D1Bitmap1> renderBitmap;
 			BeginDraw(offset, updateRects[i], surface);
 			_d2dContext->Clear();
-			DrawRequested(offset, updateRects[i], updateRects[i], renderBitmap);
+			DrawRequested(offset, updateRects[i], requestedBounds, decoded);
 			_d2dContext->SetTransform(D2D1::IdentityMatrix());
 			_d2dContext->PopAxisAlignedClip();
 			_d2dContext->Flush();
 			EndDraw();
 		}
 
+		//rather than invalidating straight away, let the shared tick decide when the next frame is due
 		if (_lastRequestedRequeue)
 		{
 			_lastRequestedRequeue = false;
-			_sisNative->Invalidate(RECT{ 0, 0, _currentWidth, _currentHeight });
+			AnimationScheduler::Instance().Register(shared_from_this(), _dispatcher);
+		}
+		else if (_decoder != nullptr && !_suspended)
+		{
+			//nothing will tick a still image or a finished animation, what was just drawn stays up until Suspend
+			DecodedMemoryBudget::Instance().Touch(_decoder.get(), DecodedMemoryBudget::UntilHidden);
 		}
 	}
 }
@@ -139,7 +146,7 @@ void D2DRenderer::BeginDraw(POINT& offset, RECT& updateNativeRect, ComPtr<IDXGIS
 		);
 }
 
-bool D2DRenderer::DrawRequested(POINT offset, RECT requested, RECT overallRequested, ComPtr<ID2D1Bitmap1>& renderBitmap)
+bool D2DRenderer::DrawRequested(POINT offset, RECT requested, RECT overallRequested, bool& decoded)
 {
 	bool requeue = false;
 	Windows::Foundation::Rect requestedFoundationRect(static_cast<float>(overallRequested.left), static_cast<float>(overallRequested.top),
@@ -147,19 +154,28 @@ bool D2DRenderer::DrawRequested(POINT offset, RECT requested, RECT overallReques
 	bool canDecode = _decoder != nullptr && _decoder->CanDecode(requestedFoundationRect);
 	if (_decoder)
 	{
+		//being drawn is what keeps a decoder's memory off the eviction list
+		DecodedMemoryBudget::Instance().Touch(_decoder.get());
 		try
 		{
-			if (renderBitmap == nullptr)
+			//anything the decoder can't serve straight away goes through DecodeRectangleAsync below
+			if (!decoded && canDecode)
 			{
-				auto decodedRect = _decoder->DecodeRectangle(requestedFoundationRect, _d2dContext, renderBitmap, _lastRequestedRequeue);
+				decoded = true;
+				_frameReady = false;
+				auto decodedRect = _decoder->DecodeRectangle(requestedFoundationRect, *_frameSink, _lastRequestedRequeue);
 				_lastRequested = RECT{ static_cast<long>(decodedRect.Left), static_cast<long>(decodedRect.Top), static_cast<long>(decodedRect.Right), static_cast<long>(decodedRect.Bottom) };
+				_lastDrawn = D2D1::RectF(decodedRect.Left, decodedRect.Top, decodedRect.Right, decodedRect.Bottom);
+				_frameReady = decodedRect.Width > 0 && decodedRect.Height > 0;
 			}
 
 			_d2dContext->SetTransform(
-				D2D1::Matrix3x2F::Translation(static_cast<float>(offset.x) - (requested.left - _lastRequested.left),
-					static_cast<float>(offset.y) - (requested.top - _lastRequested.top)));
+				D2D1::Matrix3x2F::Translation(static_cast<float>(offset.x - requested.left), static_cast<float>(offset.y - requested.top)));
 
-			_d2dContext->DrawBitmap(renderBitmap.Get());
+			//the decoder can have nothing to show yet while the first frame is still being composited
+			//drawn into the surface rect the decoder said it covers, a bitmap decoded at a lower scale is stretched over it
+			if (decoded && _frameReady)
+				_d2dContext->DrawBitmap(_frameSink->Bitmap().Get(), _lastDrawn);
 		}
 		catch (...) {}
 	}
@@ -178,9 +194,10 @@ bool D2DRenderer::DrawRequested(POINT offset, RECT requested, RECT overallReques
 			}
 			_filterState = D2DRenderer::WAIT;
 			return task_from_result();
-		}, [](Platform::Exception^ ex)
+		}, [=](Platform::Exception^ ex)
 		{
 			OutputDebugString(ex->ToString()->Data());
+			_filterState = D2DRenderer::WAIT;
 			return task_from_result();
 		}), [](Platform::Exception^ ex) { OutputDebugString(ex->ToString()->Data()); } );
 		requeue = true;
@@ -265,6 +282,8 @@ void D2DRenderer::CreateDeviceResources()
 				&_d2dContext
 				)
 			);
+		_frameSink = std::unique_ptr<D2DFrameSink>(new D2DFrameSink(_d2dContext));
+		_frameReady = false;
 
 		_displayInfo = Windows::Graphics::Display::DisplayInformation::GetForCurrentView();
 
@@ -318,11 +337,34 @@ Size D2DRenderer::MaxSize()
 	return _decoder->MaxSize();
 }
 
+bool D2DRenderer::Advance(ClockTicks& nextDelay)
+{
+	if (_decoder == nullptr)
+	{
+		nextDelay = -1;
+		return false;
+	}
+	bool changed = _decoder->Advance(nextDelay);
+	//on screen until the tick after this one, a long frame delay would otherwise outlast the grace a draw gets
+	if (!_suspended)
+		DecodedMemoryBudget::Instance().Touch(_decoder.get(), nextDelay >= 0 ? nextDelay + DecodedMemoryBudget::VisibleGrace : DecodedMemoryBudget::UntilHidden);
+	return changed;
+}
+
+void D2DRenderer::Invalidate()
+{
+	if (!_suspended && _sisNative != nullptr)
+		_sisNative->Invalidate(RECT{ 0, 0, _currentWidth, _currentHeight });
+}
+
 void D2DRenderer::Suspend()
 {
 	_suspended = true;
 	if(_decoder != nullptr)
+	{
+		DecodedMemoryBudget::Instance().Hide(_decoder.get());
 		_decoder->Suspend();
+	}
 	else
 		OutputDebugString(L"decoder was null in Suspend()");
 }
@@ -332,6 +374,7 @@ void D2DRenderer::Resume()
 	_suspended = false;
 	if (_decoder != nullptr)
 	{
+		DecodedMemoryBudget::Instance().Touch(_decoder.get());
 		_decoder->Resume();
 		if(_sisNative != nullptr)
 			_sisNative->Invalidate(RECT{ 0, 0, _currentWidth, _currentHeight });
@@ -347,7 +390,9 @@ D2DRenderer::D2DRenderer(shared_ptr<IImageDecoder> decoder, ComPtr<IVirtualSurfa
 	_sisBound = false;
 	_suspended = false;
 	_filterState = D2DRenderer::WAIT;
+	_frameReady = false;
 	_lastRequested = RECT{};
+	_lastDrawn = D2D1::RectF();
 	_decoder = decoder;
 	_sisNative = sisNative;
 	_currentWidth = static_cast<int>(initialSize.Width);
@@ -369,6 +414,7 @@ task<tuple<shared_ptr<IImageRenderer>, ImageSource^>> D2DRenderer::MakeRenderer(
 			auto renderer = make_shared<D2DRenderer>(decoder, sisNative, size, cancelToken);
 			auto castRenderer = dynamic_pointer_cast<IImageRenderer>(renderer);
 			renderer->_callback = Make<ImageRendererUpdatesCallbackNative>(castRenderer);
+			renderer->_dispatcher = dispatcher;
 			renderer->ThrowIfFailed(sisNative->RegisterForUpdatesNeeded(renderer->_callback.Get()));
 			completionSource.set(make_tuple(castRenderer, dynamic_cast<ImageSource^>(imageSource)));
 		});
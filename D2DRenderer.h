@@ -2,6 +2,8 @@
 
 #include "IImageRenderer.h"
 #include "IImageDecoder.h"
+#include "AnimationScheduler.h"
+#include "D2DFrameSink.h"
 
 #include <wrl.h>
 #include <wrl\client.h>
@@ -13,7 +15,7 @@
 #include <d3d11_1.h>
 #include "windows.ui.xaml.media.dxinterop.h"
 
-class D2DRenderer : public IImageRenderer
+class D2DRenderer : public IImageRenderer, public IAnimationTarget, public std::enable_shared_from_this<D2DRenderer>
 {
 private:
 	enum FilterState
@@ -26,7 +28,10 @@ private:
 	Microsoft::WRL::ComPtr<ImageRendererUpdatesCallbackNative> _callback;
 	Microsoft::WRL::ComPtr<IVirtualSurfaceImageSourceNative> _sisNative;
 	std::shared_ptr<IImageDecoder> _decoder;
+	Windows::UI::Core::CoreDispatcher^ _dispatcher;
 	RECT _lastRequested;
+	//surface rect the bitmap in _frameSink covers, fractional when the decoder's canvas doesn't divide the render size
+	D2D1_RECT_F _lastDrawn;
 	bool _lastRequestedRequeue;
 	int _currentWidth;
 	int _currentHeight;
@@ -37,6 +42,10 @@ private:
 	// Direct2D object
 	static Microsoft::WRL::ComPtr<ID2D1Device> _d2dDevice;
 	Microsoft::WRL::ComPtr<ID2D1DeviceContext> _d2dContext;
+	//one bitmap kept across draws on _d2dContext, the decoder only sends it what changed since the frame it last held
+	std::unique_ptr<D2DFrameSink> _frameSink;
+	//whether the last DecodeRectangle left anything in _frameSink worth drawing
+	bool _frameReady;
 	bool _sisBound;
 	Windows::Graphics::Display::DisplayInformation^ _displayInfo;
 	inline void ThrowIfFailed(HRESULT hr)
@@ -49,7 +58,7 @@ private:
 	void CreateDeviceResources();
 	void BeginDraw(POINT& offset, RECT& updateNativeRect, Microsoft::WRL::ComPtr<IDXGISurface>& surface);
 	void EndDraw();
-	bool DrawRequested(POINT offset, RECT requestedRegion, RECT overallRequested, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& renderBitmap);
+	bool DrawRequested(POINT offset, RECT requestedRegion, RECT overallRequested, bool& decoded);
 public:
 	D2DRenderer(std::shared_ptr<IImageDecoder> decoder, Microsoft::WRL::ComPtr<IVirtualSurfaceImageSourceNative> sisNative, 
 		Windows::Foundation::Size currentSize, concurrency::cancellation_token cancelToken);
@@ -61,8 +70,11 @@ public:
 	virtual void Suspend();
 	virtual void Resume();
 	virtual void ViewChanged(float zoomFactor);
+	virtual bool Advance(ClockTicks& nextDelay);
+	virtual void Invalidate();
 	virtual ~D2DRenderer() 
 	{
+		AnimationScheduler::Instance().Unregister(this);
 		if (_sisNative != nullptr)
 		{
 			_sisNative->Invalidate(RECT{ 0, 0, _currentWidth, _currentHeight });
@@ -0,0 +1,143 @@
+#include "pch.h"
+#include "DecodePool.h"
+
+using namespace concurrency;
+
+//index of the pool worker running on this thread, -1 everywhere else
+static __declspec(thread) int s_workerIndex = -1;
+
+static std::once_flag s_poolOnce;
+static DecodePool* s_pool = nullptr;
+
+DecodePool& DecodePool::Instance()
+{
+	std::call_once(s_poolOnce, []()
+	{
+		auto hardwareThreads = std::thread::hardware_concurrency();
+		//leave a core for the ui thread
+		s_pool = new DecodePool(hardwareThreads > 1 ? hardwareThreads - 1 : 1);
+	});
+	return *s_pool;
+}
+
+DecodePool::DecodePool(size_t workerCount) : _queuedJobs(0), _droppedJobs(0)
+{
+	for (size_t i = 0; i <= workerCount; i++)
+		_queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	for (size_t i = 0; i < workerCount; i++)
+		_workers.push_back(std::thread([this, i]() { WorkerLoop(i); }));
+}
+
+void DecodePool::Submit(Job work, DecodePriority priority, cancellation_token cancelToken)
+{
+	Push(s_workerIndex >= 0 ? static_cast<size_t>(s_workerIndex) : _queues.size() - 1, std::move(work), priority, cancelToken);
+}
+
+void DecodePool::Resubmit(Job work, DecodePriority priority, cancellation_token cancelToken)
+{
+	Push(_queues.size() - 1, std::move(work), priority, cancelToken);
+}
+
+void DecodePool::Push(size_t queueIndex, Job work, DecodePriority priority, cancellation_token cancelToken)
+{
+	auto& queue = *_queues[queueIndex];
+	{
+		std::lock_guard<std::mutex> queueGuard(queue.mutex);
+		QueuedJob job = { std::move(work), cancelToken };
+		queue.jobs[static_cast<size_t>(priority)].push_back(std::move(job));
+	}
+	{
+		std::lock_guard<std::mutex> sleepGuard(_sleepMutex);
+		_queuedJobs++;
+	}
+	_wake.notify_one();
+}
+
+task<void> DecodePool::Run(Job work, DecodePriority priority, cancellation_token cancelToken)
+{
+	task_completion_event<void> completed;
+	Submit([work, completed]()
+	{
+		try
+		{
+			work();
+			completed.set();
+		}
+		catch (...)
+		{
+			completed.set_exception(std::current_exception());
+		}
+	}, priority, cancelToken);
+	return task<void>(completed, cancelToken);
+}
+
+bool DecodePool::TakeFrom(WorkQueue& queue, size_t priority, bool owner, QueuedJob& job)
+{
+	std::lock_guard<std::mutex> queueGuard(queue.mutex);
+	auto& jobs = queue.jobs[priority];
+	if (jobs.empty())
+		return false;
+	//the owner takes its newest job, which is usually one it just spawned with the data still in cache, thieves take the oldest
+	if (owner)
+	{
+		job = std::move(jobs.back());
+		jobs.pop_back();
+	}
+	else
+	{
+		job = std::move(jobs.front());
+		jobs.pop_front();
+	}
+	return true;
+}
+
+bool DecodePool::TakeJob(size_t workerIndex, QueuedJob& job)
+{
+	auto injectionIndex = _queues.size() - 1;
+	for (size_t priority = 0; priority < static_cast<size_t>(DecodePriority::Count); priority++)
+	{
+		if (TakeFrom(*_queues[workerIndex], priority, true, job) ||
+			TakeFrom(*_queues[injectionIndex], priority, false, job))
+			return true;
+
+		for (size_t offset = 1; offset < injectionIndex; offset++)
+		{
+			if (TakeFrom(*_queues[(workerIndex + offset) % injectionIndex], priority, false, job))
+				return true;
+		}
+	}
+	return false;
+}
+
+void DecodePool::WorkerLoop(size_t workerIndex)
+{
+	s_workerIndex = static_cast<int>(workerIndex);
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> sleepLock(_sleepMutex);
+			_wake.wait(sleepLock, [this]() { return _queuedJobs > 0; });
+			//claiming under the lock means there is a job sitting in some queue for every claim
+			_queuedJobs--;
+		}
+
+		QueuedJob job;
+		while (!TakeJob(workerIndex, job))
+			std::this_thread::yield();
+
+		if (job.cancelToken.is_canceled())
+		{
+			_droppedJobs++;
+			continue;
+		}
+
+		try
+		{
+			job.work();
+		}
+		catch (...)
+		{
+			OutputDebugString(L"unhandled exception in decode pool job");
+		}
+	}
+}
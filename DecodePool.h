@@ -0,0 +1,65 @@
+#pragma once
+
+#include <ppltasks.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class DecodePriority
+{
+	NextFrame = 0, //a frame that is due on screen
+	Visible = 1,   //parsing or decoding for an image that is on screen
+	Background = 2,
+	Count = 3
+};
+
+//one set of worker threads shared by every decoder in the process, so a screen full of gifs
+//doesn't turn into a pile of PPL continuations all fighting for the same cores
+//each worker owns a queue per priority, jobs submitted from a worker go on its own queue and idle workers steal
+//from the others. a job whose cancellation token has fired by the time it is picked up is dropped without running
+class DecodePool
+{
+public:
+	typedef std::function<void()> Job;
+private:
+	struct QueuedJob
+	{
+		Job work;
+		concurrency::cancellation_token cancelToken;
+	};
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<QueuedJob> jobs[static_cast<size_t>(DecodePriority::Count)];
+	};
+	//the last entry is the injection queue for jobs submitted from outside the pool
+	std::vector<std::unique_ptr<WorkQueue>> _queues;
+	std::vector<std::thread> _workers;
+	std::mutex _sleepMutex;
+	std::condition_variable _wake;
+	size_t _queuedJobs;
+	std::atomic<uint64_t> _droppedJobs;
+	DecodePool(size_t workerCount);
+	DecodePool(const DecodePool&) = delete;
+	DecodePool& operator=(const DecodePool&) = delete;
+	void WorkerLoop(size_t workerIndex);
+	bool TakeJob(size_t workerIndex, QueuedJob& job);
+	bool TakeFrom(WorkQueue& queue, size_t priority, bool owner, QueuedJob& job);
+	void Push(size_t queueIndex, Job work, DecodePriority priority, concurrency::cancellation_token cancelToken);
+public:
+	//created on first use and never torn down, decoders can still be finishing jobs during shutdown
+	static DecodePool& Instance();
+	void Submit(Job work, DecodePriority priority, concurrency::cancellation_token cancelToken = concurrency::cancellation_token::none());
+	//for a job that queues the next slice of itself, it goes to the back of the injection queue rather than the
+	//worker's own, where the owner would pop it straight back and run one decoder to the end while the rest wait
+	void Resubmit(Job work, DecodePriority priority, concurrency::cancellation_token cancelToken = concurrency::cancellation_token::none());
+	//the returned task is canceled if cancelToken fires before the job gets to run
+	concurrency::task<void> Run(Job work, DecodePriority priority, concurrency::cancellation_token cancelToken = concurrency::cancellation_token::none());
+	size_t WorkerCount() const { return _workers.size(); }
+	uint64_t DroppedJobs() const { return _droppedJobs.load(); }
+};
@@ -0,0 +1,196 @@
+#include "pch.h"
+#include "DecodedMemoryBudget.h"
+#include "DecodePool.h"
+
+static std::once_flag s_budgetOnce;
+static DecodedMemoryBudget* s_budget = nullptr;
+
+DecodedMemoryBudget& DecodedMemoryBudget::Instance()
+{
+	std::call_once(s_budgetOnce, []()
+	{
+		s_budget = new DecodedMemoryBudget();
+	});
+	return *s_budget;
+}
+
+//a quarter of what the app is allowed, the rest is for d2d surfaces, the xaml tree and the app itself
+DecodedMemoryBudget::DecodedMemoryBudget() : _clock(RealClock::Instance()), _totalBytes(0), _evictions(0)
+{
+#if WINDOWS_PHONE_APP
+	_budget = static_cast<size_t>(Windows::System::MemoryManager::AppMemoryUsageLimit / 4);
+#elif UWP
+	_budget = static_cast<size_t>(Windows::System::MemoryManager::AppMemoryUsageLimit / 4);
+#else
+	_budget = 512 * 1024 * 1024;
+#endif
+}
+
+void DecodedMemoryBudget::Budget(size_t bytes)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	_budget = bytes;
+	Enforce();
+}
+
+size_t DecodedMemoryBudget::Budget()
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	return _budget;
+}
+
+//called with _budgetMutex held
+std::vector<DecodedMemoryBudget::Entry>::iterator DecodedMemoryBudget::Find(const IDecodedMemoryOwner* owner)
+{
+	return std::find_if(_entries.begin(), _entries.end(), [owner](const Entry& entry) { return entry.key == owner; });
+}
+
+void DecodedMemoryBudget::Report(std::shared_ptr<IDecodedMemoryOwner> owner, size_t bytes)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner.get());
+	if (found == _entries.end())
+	{
+		Entry entry = { owner.get(), owner, 0, 0, 0, 0, 0, false };
+		_entries.push_back(entry);
+		found = _entries.end() - 1;
+	}
+	_totalBytes = _totalBytes - found->bytes + bytes;
+	found->bytes = bytes;
+	if (bytes < found->evictedTo)
+		found->evictedTo = bytes;
+	Enforce();
+}
+
+void DecodedMemoryBudget::Touch(const IDecodedMemoryOwner* owner, ClockTicks holdFor)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner);
+	if (found == _entries.end())
+		return;
+	auto now = _clock->Now();
+	auto until = holdFor >= UntilHidden - now ? UntilHidden : now + holdFor;
+	found->lastVisible = now;
+	if (until > found->visibleUntil)
+		found->visibleUntil = until;
+}
+
+void DecodedMemoryBudget::Hide(const IDecodedMemoryOwner* owner)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner);
+	if (found == _entries.end())
+		return;
+	found->visibleUntil = 0;
+	Enforce();
+}
+
+void DecodedMemoryBudget::Clock(std::shared_ptr<IAnimationClock> clock)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	_clock = clock != nullptr ? clock : RealClock::Instance();
+}
+
+void DecodedMemoryBudget::Remove(const IDecodedMemoryOwner* owner)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner);
+	if (found != _entries.end())
+	{
+		_totalBytes -= found->bytes;
+		_entries.erase(found);
+	}
+}
+
+//called with _budgetMutex held, picks victims oldest drawn first and hands them to the pool
+void DecodedMemoryBudget::Enforce()
+{
+	if (_totalBytes <= _budget)
+		return;
+
+	auto now = _clock->Now();
+	std::vector<Entry*> candidates;
+	size_t pendingBytes = 0;
+	for (auto& entry : _entries)
+	{
+		if (entry.evicting)
+		{
+			//already on its way down, count it as gone so we don't pile more evictions on top
+			pendingBytes += entry.bytes > entry.evictedTo ? entry.bytes - entry.evictedTo : 0;
+			continue;
+		}
+		if (entry.bytes > entry.evictedTo && now > entry.visibleUntil && !entry.owner.expired())
+			candidates.push_back(&entry);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Entry* left, const Entry* right) { return left->lastVisible < right->lastVisible; });
+
+	auto projected = _totalBytes - (pendingBytes < _totalBytes ? pendingBytes : _totalBytes);
+	for (auto candidate : candidates)
+	{
+		if (projected <= _budget)
+			break;
+		auto owner = candidate->owner.lock();
+		if (owner == nullptr)
+			continue;
+		candidate->evicting = true;
+		candidate->evictions++;
+		projected -= candidate->bytes - candidate->evictedTo;
+		_evictions++;
+		DecodePool::Instance().Submit([this, owner]()
+		{
+			size_t remainingBytes = 0;
+			try
+			{
+				remainingBytes = owner->EvictDecodedMemory();
+			}
+			catch (...)
+			{
+				OutputDebugString(L"error evicting decoded memory");
+			}
+			FinishEviction(owner.get(), remainingBytes);
+		}, DecodePriority::Background);
+	}
+}
+
+void DecodedMemoryBudget::FinishEviction(IDecodedMemoryOwner* owner, size_t remainingBytes)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner);
+	if (found == _entries.end())
+		return;
+	_totalBytes = _totalBytes - found->bytes + remainingBytes;
+	found->bytes = remainingBytes;
+	found->evictedTo = remainingBytes;
+	found->evicting = false;
+}
+
+size_t DecodedMemoryBudget::UsageOf(const IDecodedMemoryOwner* owner)
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	auto found = Find(owner);
+	return found != _entries.end() ? found->bytes : 0;
+}
+
+size_t DecodedMemoryBudget::TotalUsage()
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	return _totalBytes;
+}
+
+std::vector<DecodedMemoryBudget::Usage> DecodedMemoryBudget::Usages()
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	std::vector<Usage> usages;
+	for (auto& entry : _entries)
+	{
+		Usage usage = { entry.key, entry.bytes, entry.lastVisible, entry.visibleUntil, entry.evictions };
+		usages.push_back(usage);
+	}
+	return usages;
+}
+
+uint64_t DecodedMemoryBudget::Evictions()
+{
+	std::lock_guard<std::mutex> budgetGuard(_budgetMutex);
+	return _evictions;
+}
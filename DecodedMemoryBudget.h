@@ -0,0 +1,80 @@
+#pragma once
+
+#include "AnimationClock.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+//anything holding decoded pixels it can rebuild on demand, canvases, composited frames, decoded rasters
+class IDecodedMemoryOwner
+{
+public:
+	//drops whatever can be rebuilt, returns the bytes still held afterwards
+	//called on the decode pool, the owner has to be safe to keep using (and drawing) straight after
+	virtual size_t EvictDecodedMemory() = 0;
+	virtual ~IDecodedMemoryOwner() {}
+};
+
+//one budget for decoded memory across every decoder in the process
+//owners report their usage whenever it changes and renderers touch them whenever they're drawn or ticked, once the total
+//goes over budget the owners that have gone longest without being drawn are evicted on the decode pool until it fits again
+//a touch holds an owner on screen for a while, VisibleGrace after a draw, until the next tick for an animation, and until
+//Hide for anything that has stopped changing, owners on screen are left alone so the budget can be overrun by what is showing
+class DecodedMemoryBudget
+{
+public:
+	struct Usage
+	{
+		const IDecodedMemoryOwner* owner;
+		size_t bytes;
+		ClockTicks lastVisible;  //at the last Touch, 0 if never drawn
+		ClockTicks visibleUntil; //UntilHidden if it stays on screen until Hide
+		uint64_t evictions;
+	};
+	static const ClockTicks VisibleGrace = 1000 * TicksPerMillisecond;
+	static const ClockTicks UntilHidden = INT64_MAX;
+private:
+	struct Entry
+	{
+		IDecodedMemoryOwner* key;
+		std::weak_ptr<IDecodedMemoryOwner> owner;
+		size_t bytes;
+		//what was left after the last eviction, evicting again before usage grows past this would free nothing
+		size_t evictedTo;
+		ClockTicks lastVisible;
+		ClockTicks visibleUntil;
+		uint64_t evictions;
+		bool evicting;
+	};
+	std::mutex _budgetMutex;
+	std::shared_ptr<IAnimationClock> _clock;
+	std::vector<Entry> _entries;
+	size_t _budget;
+	size_t _totalBytes;
+	uint64_t _evictions;
+	DecodedMemoryBudget();
+	DecodedMemoryBudget(const DecodedMemoryBudget&) = delete;
+	DecodedMemoryBudget& operator=(const DecodedMemoryBudget&) = delete;
+	std::vector<Entry>::iterator Find(const IDecodedMemoryOwner* owner);
+	void Enforce();
+	void FinishEviction(IDecodedMemoryOwner* owner, size_t remainingBytes);
+public:
+	static DecodedMemoryBudget& Instance();
+	void Budget(size_t bytes);
+	size_t Budget();
+	//registers the owner on first report, cheap enough to call after every allocation or release
+	void Report(std::shared_ptr<IDecodedMemoryOwner> owner, size_t bytes);
+	//holdFor past now the owner counts as on screen, a longer hold from an earlier touch isn't cut short
+	void Touch(const IDecodedMemoryOwner* owner, ClockTicks holdFor = VisibleGrace);
+	//off screen from now on, first in line for eviction
+	void Hide(const IDecodedMemoryOwner* owner);
+	//where visibility is timed from, nullptr for the real clock
+	void Clock(std::shared_ptr<IAnimationClock> clock);
+	//owners call this from their destructor
+	void Remove(const IDecodedMemoryOwner* owner);
+	size_t UsageOf(const IDecodedMemoryOwner* owner);
+	size_t TotalUsage();
+	std::vector<Usage> Usages();
+	uint64_t Evictions();
+};
@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "DecoderStats.h"
+
+//raises target to at least value, for peaks that several threads push up at once
+template<typename T>
+static void RaiseTo(std::atomic<T>& target, T value)
+{
+	auto current = target.load();
+	while (current < value && !target.compare_exchange_weak(current, value))
+	{
+	}
+}
+
+LatencyHistogram::LatencyHistogram() : _max(0)
+{
+	for (int i = 0; i < BucketCount; i++)
+		_buckets[i] = 0;
+}
+
+//below four ticks every value has a bucket of its own, above that each octave splits on the two bits under its top bit
+int LatencyHistogram::Bucket(ClockTicks ticks)
+{
+	if (ticks < BucketsPerOctave)
+		return ticks > 0 ? static_cast<int>(ticks) : 0;
+	int octave = 0;
+	for (auto rest = ticks; rest > 1; rest >>= 1)
+		octave++;
+	int sub = static_cast<int>((ticks >> (octave - 2)) & (BucketsPerOctave - 1));
+	int bucket = (octave - 1) * BucketsPerOctave + sub;
+	return bucket < BucketCount ? bucket : BucketCount - 1;
+}
+
+ClockTicks LatencyHistogram::BucketMiddle(int bucket)
+{
+	if (bucket < BucketsPerOctave)
+		return bucket;
+	int octave = bucket / BucketsPerOctave + 1;
+	ClockTicks width = static_cast<ClockTicks>(1) << (octave - 2);
+	return (BucketsPerOctave + bucket % BucketsPerOctave) * width + width / 2;
+}
+
+void LatencyHistogram::Record(ClockTicks ticks)
+{
+	_buckets[Bucket(ticks)]++;
+	RaiseTo(_max, ticks);
+}
+
+LatencySummary LatencyHistogram::Summary() const
+{
+	uint64_t counts[BucketCount];
+	uint64_t total = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		counts[i] = _buckets[i].load();
+		total += counts[i];
+	}
+	LatencySummary summary = { total, 0, 0, _max.load() };
+	if (total == 0)
+		return summary;
+
+	//the smallest bucket with at least that share of the samples at or below it
+	auto p50Rank = (total * 50 + 99) / 100;
+	auto p99Rank = (total * 99 + 99) / 100;
+	uint64_t seen = 0;
+	bool p50Found = false;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		seen += counts[i];
+		if (!p50Found && seen >= p50Rank)
+		{
+			summary.p50 = BucketMiddle(i);
+			p50Found = true;
+		}
+		if (seen >= p99Rank)
+		{
+			summary.p99 = BucketMiddle(i);
+			break;
+		}
+	}
+	if (summary.p50 > summary.max)
+		summary.p50 = summary.max;
+	if (summary.p99 > summary.max)
+		summary.p99 = summary.max;
+	return summary;
+}
+
+DecoderStatsCounters::DecoderStatsCounters() : DecoderStatsCounters(&Process())
+{
+}
+
+DecoderStatsCounters::DecoderStatsCounters(DecoderStatsCounters* aggregate) : _aggregate(aggregate), _clock(RealClock::Instance()), _firstFrameSeen(false),
+	_bytesReceived(0), _bytesParsed(0), _framesDecoded(0), _framesComposited(0), _framesSkipped(0), _currentBytes(0), _peakBytes(0), _lockWait(0)
+{
+	_created = _clock->Now();
+}
+
+//whatever this decoder still held is no longer held by the process either
+DecoderStatsCounters::~DecoderStatsCounters()
+{
+	if (_aggregate != nullptr)
+		_aggregate->AddCurrentBytes(_currentBytes.load(), 0);
+}
+
+static std::once_flag s_processStatsOnce;
+static DecoderStatsCounters* s_processStats = nullptr;
+
+DecoderStatsCounters& DecoderStatsCounters::Process()
+{
+	std::call_once(s_processStatsOnce, []()
+	{
+		s_processStats = new DecoderStatsCounters(nullptr);
+	});
+	return *s_processStats;
+}
+
+void DecoderStatsCounters::BytesReceived(uint64_t bytes)
+{
+	_bytesReceived += bytes;
+	if (_aggregate != nullptr)
+		_aggregate->_bytesReceived += bytes;
+}
+
+//only the decode worker parses, so there's never a second caller to race
+void DecoderStatsCounters::BytesParsed(uint64_t position)
+{
+	auto previous = _bytesParsed.load();
+	if (position <= previous)
+		return;
+	_bytesParsed = position;
+	if (_aggregate != nullptr)
+		_aggregate->_bytesParsed += position - previous;
+}
+
+void DecoderStatsCounters::FrameDecoded(ClockTicks elapsed)
+{
+	_framesDecoded++;
+	_decodePerFrame.Record(elapsed);
+	if (_aggregate != nullptr)
+		_aggregate->FrameDecoded(elapsed);
+}
+
+void DecoderStatsCounters::FrameComposited(ClockTicks elapsed)
+{
+	_framesComposited++;
+	_compositePerFrame.Record(elapsed);
+	if (_aggregate != nullptr)
+		_aggregate->FrameComposited(elapsed);
+}
+
+void DecoderStatsCounters::FramesSkipped(uint64_t count)
+{
+	_framesSkipped += count;
+	if (_aggregate != nullptr)
+		_aggregate->_framesSkipped += count;
+}
+
+void DecoderStatsCounters::DecodedBytes(size_t bytes)
+{
+	auto previous = _currentBytes.exchange(bytes);
+	RaiseTo(_peakBytes, bytes);
+	if (_aggregate != nullptr)
+		_aggregate->AddCurrentBytes(previous, bytes);
+}
+
+//unsigned wraparound makes adding the difference work whichever way it goes
+void DecoderStatsCounters::AddCurrentBytes(size_t previous, size_t bytes)
+{
+	auto current = _currentBytes.fetch_add(bytes - previous) + (bytes - previous);
+	RaiseTo(_peakBytes, current);
+}
+
+void DecoderStatsCounters::LockWait(ClockTicks waited)
+{
+	_lockWait += waited;
+	if (_aggregate != nullptr)
+		_aggregate->_lockWait += waited;
+}
+
+void DecoderStatsCounters::FirstFrame()
+{
+	if (_firstFrameSeen.load() || _firstFrameSeen.exchange(true))
+		return;
+	auto elapsed = Now() - _created;
+	_timeToFirstFrame.Record(elapsed);
+	if (_aggregate != nullptr)
+		_aggregate->_timeToFirstFrame.Record(elapsed);
+}
+
+DecoderStats DecoderStatsCounters::Snapshot() const
+{
+	DecoderStats stats;
+	stats.bytesReceived = _bytesReceived.load();
+	stats.bytesParsed = _bytesParsed.load();
+	stats.framesDecoded = _framesDecoded.load();
+	stats.framesComposited = _framesComposited.load();
+	stats.framesSkipped = _framesSkipped.load();
+	stats.currentBytes = _currentBytes.load();
+	stats.peakBytes = _peakBytes.load();
+	stats.lockWait = _lockWait.load();
+	stats.decodePerFrame = _decodePerFrame.Summary();
+	stats.compositePerFrame = _compositePerFrame.Summary();
+	stats.timeToFirstFrame = _timeToFirstFrame.Summary();
+	return stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "AnimationClock.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+//a latency distribution boiled down for a dashboard, zero until something has been recorded
+struct LatencySummary
+{
+	uint64_t count;
+	ClockTicks p50;
+	ClockTicks p99;
+	ClockTicks max;
+};
+
+//what DecoderStatsCounters held when Snapshot was called, counters only ever go up apart from currentBytes
+struct DecoderStats
+{
+	uint64_t bytesReceived;
+	uint64_t bytesParsed;
+	uint64_t framesDecoded;    //rasters decompressed, including ones decoded again after being shed
+	uint64_t framesComposited;
+	uint64_t framesSkipped;    //never shown because a later frame was already due
+	size_t currentBytes;       //decoded memory as last reported to DecodedMemoryBudget
+	size_t peakBytes;
+	ClockTicks lockWait;       //time spent blocked on locks someone else held
+	LatencySummary decodePerFrame;
+	LatencySummary compositePerFrame;
+	//from the decoder being made to its first frame being handed to a sink, one sample per decoder
+	LatencySummary timeToFirstFrame;
+};
+
+//counts per bucket with four buckets to an octave, so recording is a couple of atomic adds and a percentile is
+//within a fifth of the real value, which is plenty to tell a 4ms composite from a 40ms one
+class LatencyHistogram
+{
+private:
+	static const int BucketsPerOctave = 4;
+	static const int BucketCount = 40 * BucketsPerOctave;
+	std::atomic<uint64_t> _buckets[BucketCount];
+	std::atomic<ClockTicks> _max;
+	static int Bucket(ClockTicks ticks);
+	static ClockTicks BucketMiddle(int bucket);
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+public:
+	LatencyHistogram();
+	void Record(ClockTicks ticks);
+	LatencySummary Summary() const;
+};
+
+//live counters for one decoder, everything recorded here is added to Process() as well so the whole app can be
+//watched as one, safe to record from any thread
+class DecoderStatsCounters
+{
+private:
+	//nullptr for Process() itself
+	DecoderStatsCounters* _aggregate;
+	std::shared_ptr<IAnimationClock> _clock;
+	ClockTicks _created;
+	std::atomic<bool> _firstFrameSeen;
+	std::atomic<uint64_t> _bytesReceived;
+	std::atomic<uint64_t> _bytesParsed;
+	std::atomic<uint64_t> _framesDecoded;
+	std::atomic<uint64_t> _framesComposited;
+	std::atomic<uint64_t> _framesSkipped;
+	std::atomic<size_t> _currentBytes;
+	std::atomic<size_t> _peakBytes;
+	std::atomic<ClockTicks> _lockWait;
+	LatencyHistogram _decodePerFrame;
+	LatencyHistogram _compositePerFrame;
+	LatencyHistogram _timeToFirstFrame;
+	explicit DecoderStatsCounters(DecoderStatsCounters* aggregate);
+	DecoderStatsCounters(const DecoderStatsCounters&) = delete;
+	DecoderStatsCounters& operator=(const DecoderStatsCounters&) = delete;
+	void AddCurrentBytes(size_t previous, size_t bytes);
+public:
+	DecoderStatsCounters();
+	~DecoderStatsCounters();
+	//every decoder in the process added together, currentBytes is what they hold between them right now
+	static DecoderStatsCounters& Process();
+	ClockTicks Now() const { return _clock->Now(); }
+	void BytesReceived(uint64_t bytes);
+	//how far into the file the parser has got, it only moves forward
+	void BytesParsed(uint64_t position);
+	void FrameDecoded(ClockTicks elapsed);
+	void FrameComposited(ClockTicks elapsed);
+	void FramesSkipped(uint64_t count);
+	void DecodedBytes(size_t bytes);
+	void LockWait(ClockTicks waited);
+	//only the first call counts
+	void FirstFrame();
+	//locks mutex, timing the wait only if someone else has it so the uncontended case doesn't read the clock
+	template<typename MUTEX>
+	std::unique_lock<MUTEX> Lock(MUTEX& mutex)
+	{
+		if (mutex.try_lock())
+			return std::unique_lock<MUTEX>(mutex, std::adopt_lock);
+		auto start = Now();
+		std::unique_lock<MUTEX> lock(mutex);
+		LockWait(Now() - start);
+		return lock;
+	}
+	DecoderStats Snapshot() const;
+};
@@ -0,0 +1,35 @@
+#include "pch.h"
+#include "FrameSink.h"
+
+HeadlessFrameSink::HeadlessFrameSink() : _width(0), _height(0), _ignoreAlpha(false), _allocations(0), _uploads(0), _uploadedBytes(0)
+{
+}
+
+void HeadlessFrameSink::Prepare(uint32_t width, uint32_t height, bool ignoreAlpha)
+{
+	if (width == _width && height == _height && ignoreAlpha == _ignoreAlpha && !_pixels.empty())
+		return;
+	_pixels.assign(static_cast<size_t>(width) * height, 0);
+	_width = width;
+	_height = height;
+	_ignoreAlpha = ignoreAlpha;
+	_allocations++;
+	Forget();
+}
+
+void HeadlessFrameSink::Upload(const uint32_t* pixels, int pitch, int left, int top, int right, int bottom)
+{
+	if (right <= left || bottom <= top)
+		return;
+	for (int y = top; y < bottom; y++)
+		memcpy(_pixels.data() + static_cast<size_t>(y) * _width + left, pixels + static_cast<size_t>(y - top) * pitch, (right - left) * sizeof(uint32_t));
+	_uploads++;
+	_uploadedBytes += static_cast<uint64_t>(right - left) * (bottom - top) * sizeof(uint32_t);
+}
+
+void HeadlessFrameSink::ResetCounts()
+{
+	_allocations = 0;
+	_uploads = 0;
+	_uploadedBytes = 0;
+}
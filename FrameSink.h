@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+//what a sink's target currently holds, written by whichever decoder last fed it so the next frame only has to send
+//what changed, owner is nullptr when nothing in the target can be relied on
+struct FrameSinkContents
+{
+	const void* owner;
+	//the owner's own count of what it has produced, it only means something to the owner
+	uint64_t version;
+	//the part of the owner's canvas the target covers and the scale that canvas was composited at
+	int left;
+	int top;
+	int right;
+	int bottom;
+	int scale;
+};
+
+//where decoders hand composited BGRA, a sink keeps one target alive from frame to frame instead of a new one per frame
+//the renderer's D2DFrameSink keeps a bitmap and HeadlessFrameSink keeps plain memory, the decoder prepares the target
+//at the size it needs, checks Contents to see what is already there and uploads the rest
+class IFrameSink
+{
+private:
+	FrameSinkContents _contents;
+protected:
+	IFrameSink() { Forget(); }
+public:
+	//makes the target width x height, a target that has to be made again forgets its contents
+	//ignoreAlpha is for pixels whose alpha channel is meaningless rather than premultiplied
+	virtual void Prepare(uint32_t width, uint32_t height, bool ignoreAlpha) = 0;
+	//rows of pitch pixels, pixels[0] lands at (left, top) of the target
+	virtual void Upload(const uint32_t* pixels, int pitch, int left, int top, int right, int bottom) = 0;
+	const FrameSinkContents& Contents() const { return _contents; }
+	void Contents(const FrameSinkContents& contents) { _contents = contents; }
+	void Forget()
+	{
+		FrameSinkContents nothing = { nullptr, 0, 0, 0, 0, 0, 0 };
+		_contents = nothing;
+	}
+	virtual ~IFrameSink() {}
+};
+
+//keeps the target in memory and counts what it costs, so how much a frame hand-off allocates and copies can be
+//checked without a GPU or any Windows types
+class HeadlessFrameSink : public IFrameSink
+{
+private:
+	std::vector<uint32_t> _pixels;
+	uint32_t _width;
+	uint32_t _height;
+	bool _ignoreAlpha;
+	size_t _allocations;
+	size_t _uploads;
+	uint64_t _uploadedBytes;
+public:
+	HeadlessFrameSink();
+	virtual void Prepare(uint32_t width, uint32_t height, bool ignoreAlpha);
+	virtual void Upload(const uint32_t* pixels, int pitch, int left, int top, int right, int bottom);
+	uint32_t Width() const { return _width; }
+	uint32_t Height() const { return _height; }
+	const uint32_t* Pixels() const { return _pixels.data(); }
+	//times the target had to be made again
+	size_t Allocations() const { return _allocations; }
+	size_t Uploads() const { return _uploads; }
+	uint64_t UploadedBytes() const { return _uploadedBytes; }
+	void ResetCounts();
+};
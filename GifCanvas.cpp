@@ -0,0 +1,210 @@
+#include "pch.h"
+#include "GifCanvas.h"
+
+#include <algorithm>
+#include <ppl.h>
+
+GifCanvas::GifCanvas(uint32_t width, uint32_t height, uint32_t background) : _width(width), _height(height), _background(background), _pixelBytes(sizeof(uint32_t)), _tileCount(0),
+	_external(nullptr), _externalPitch(0), _externalLeft(0), _externalTop(0)
+{
+	Init();
+}
+
+GifCanvas::GifCanvas(uint32_t width, uint32_t height, std::shared_ptr<const GifCanvasPalette> palette) : _width(width), _height(height), _palette(palette), _background(palette->background), _pixelBytes(1), _tileCount(0),
+	_external(nullptr), _externalPitch(0), _externalLeft(0), _externalTop(0)
+{
+	Init();
+}
+
+GifCanvas::GifCanvas(uint32_t width, uint32_t height, uint32_t background, uint32_t* pixels, size_t stride, int left, int top) : _width(width), _height(height), _background(background), _pixelBytes(sizeof(uint32_t)), _tileCount(0),
+	_external(reinterpret_cast<uint8_t*>(pixels)), _externalPitch(stride / sizeof(uint32_t)), _externalLeft(left), _externalTop(top)
+{
+	_tilesAcross = static_cast<int>((_width + TileSize - 1) / TileSize);
+	_tilesDown = static_cast<int>((_height + TileSize - 1) / TileSize);
+}
+
+void GifCanvas::Init()
+{
+	_tilesAcross = static_cast<int>((_width + TileSize - 1) / TileSize);
+	_tilesDown = static_cast<int>((_height + TileSize - 1) / TileSize);
+	auto count = static_cast<size_t>(_tilesAcross) * _tilesDown;
+	_tiles = std::unique_ptr<std::atomic<uint8_t*>[]>(new std::atomic<uint8_t*>[count]);
+	for (size_t i = 0; i < count; i++)
+		_tiles[i] = nullptr;
+}
+
+GifCanvas::~GifCanvas()
+{
+	Clear();
+}
+
+std::unique_ptr<GifCanvas> GifCanvas::CreateCompatible() const
+{
+	if (_palette != nullptr)
+		return std::unique_ptr<GifCanvas>(new GifCanvas(_width, _height, _palette));
+	return std::unique_ptr<GifCanvas>(new GifCanvas(_width, _height, _background));
+}
+
+uint8_t* GifCanvas::RawTileForWrite(int tileX, int tileY)
+{
+	auto& slot = _tiles[static_cast<size_t>(tileY) * _tilesAcross + tileX];
+	auto tile = slot.load();
+	if (tile != nullptr)
+		return tile;
+
+	auto fresh = new uint8_t[TilePixels * _pixelBytes];
+	if (_palette != nullptr)
+		memset(fresh, static_cast<int>(_background), TilePixels);
+	else
+		std::fill(reinterpret_cast<uint32_t*>(fresh), reinterpret_cast<uint32_t*>(fresh) + TilePixels, _background);
+	uint8_t* expected = nullptr;
+	if (!slot.compare_exchange_strong(expected, fresh))
+	{
+		//another band got there first
+		delete[] fresh;
+		return expected;
+	}
+	_tileCount++;
+	return fresh;
+}
+
+const uint8_t* GifCanvas::PieceAddress(int tileX, int tileY, int x, int y) const
+{
+	if (_external != nullptr)
+		return ExternalAddress(x, y);
+	auto tile = RawTile(tileX, tileY);
+	return tile != nullptr ? tile + ((y % TileSize) * TileSize + x % TileSize) * _pixelBytes : nullptr;
+}
+
+uint8_t* GifCanvas::PieceAddressForWrite(int tileX, int tileY, int x, int y)
+{
+	if (_external != nullptr)
+		return ExternalAddress(x, y);
+	return RawTileForWrite(tileX, tileY) + ((y % TileSize) * TileSize + x % TileSize) * _pixelBytes;
+}
+
+void GifCanvas::ReleaseTile(size_t index)
+{
+	auto tile = _tiles[index].exchange(nullptr);
+	if (tile != nullptr)
+	{
+		delete[] tile;
+		_tileCount--;
+	}
+}
+
+void GifCanvas::ExpandRow(uint32_t* target, const uint8_t* indices, int count) const
+{
+	auto colors = _palette->colors;
+	for (int i = 0; i < count; i++)
+		target[i] = colors[indices[i]];
+}
+
+uint32_t GifCanvas::Pixel(int x, int y) const
+{
+	auto pixel = PieceAddress(x / TileSize, y / TileSize, x, y);
+	if (pixel == nullptr)
+		return Background();
+	return _palette != nullptr ? _palette->colors[*pixel] : *reinterpret_cast<const uint32_t*>(pixel);
+}
+
+template<typename TILEFUNC>
+void GifCanvas::ForEachTileRowInParallel(int left, int top, int right, int bottom, TILEFUNC tileFunc)
+{
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, static_cast<int>(_width));
+	bottom = std::min(bottom, static_cast<int>(_height));
+	if (right <= left || bottom <= top)
+		return;
+	//each row of tiles is separate memory, and tiles are allocated and freed with compare and swap, so rows can't collide
+	int firstRow = top / TileSize;
+	int rowCount = (bottom - 1) / TileSize - firstRow + 1;
+	if (rowCount < 2 || static_cast<int64_t>(right - left) * (bottom - top) < MinParallelPixels)
+	{
+		ForEachTile(left, top, right, bottom, tileFunc);
+		return;
+	}
+	concurrency::parallel_for(firstRow, firstRow + rowCount, [&](int tileY)
+	{
+		ForEachTile(left, std::max(top, tileY * TileSize), right, std::min(bottom, (tileY + 1) * TileSize), tileFunc);
+	});
+}
+
+void GifCanvas::Clear(int left, int top, int right, int bottom)
+{
+	ForEachTileRowInParallel(left, top, right, bottom, [&](int tileX, int tileY, int pieceLeft, int pieceTop, int pieceRight, int pieceBottom)
+	{
+		uint8_t* piece;
+		if (_external != nullptr)
+			piece = ExternalAddress(pieceLeft, pieceTop);
+		else
+		{
+			auto index = static_cast<size_t>(tileY) * _tilesAcross + tileX;
+			auto tile = _tiles[index].load();
+			if (tile == nullptr)
+				return;
+
+			//the part of an edge tile past the canvas is never read, so covering what's inside counts as the whole tile
+			bool wholeTile = pieceLeft == tileX * TileSize && pieceTop == tileY * TileSize &&
+				pieceRight == std::min<int>((tileX + 1) * TileSize, _width) && pieceBottom == std::min<int>((tileY + 1) * TileSize, _height);
+			if (wholeTile)
+			{
+				ReleaseTile(index);
+				return;
+			}
+			piece = tile + ((pieceTop % TileSize) * TileSize + pieceLeft % TileSize) * _pixelBytes;
+		}
+
+		auto pitch = RowPitch() * _pixelBytes;
+		for (int y = pieceTop; y < pieceBottom; y++, piece += pitch)
+		{
+			if (_palette != nullptr)
+				memset(piece, static_cast<int>(_background), pieceRight - pieceLeft);
+			else
+				std::fill(reinterpret_cast<uint32_t*>(piece), reinterpret_cast<uint32_t*>(piece) + (pieceRight - pieceLeft), _background);
+		}
+	});
+}
+
+void GifCanvas::Clear()
+{
+	if (_external != nullptr)
+		return;
+	auto count = static_cast<size_t>(_tilesAcross) * _tilesDown;
+	for (size_t i = 0; i < count; i++)
+		ReleaseTile(i);
+}
+
+void GifCanvas::CopyFrom(const GifCanvas& source, int left, int top, int right, int bottom)
+{
+	auto sourcePitch = source.RowPitch() * _pixelBytes;
+	auto targetPitch = RowPitch() * _pixelBytes;
+	ForEachTileRowInParallel(left, top, right, bottom, [&](int tileX, int tileY, int pieceLeft, int pieceTop, int pieceRight, int pieceBottom)
+	{
+		auto sourcePiece = source.PieceAddress(tileX, tileY, pieceLeft, pieceTop);
+		if (sourcePiece == nullptr)
+		{
+			Clear(pieceLeft, pieceTop, pieceRight, pieceBottom);
+			return;
+		}
+		auto piece = PieceAddressForWrite(tileX, tileY, pieceLeft, pieceTop);
+		for (int y = pieceTop; y < pieceBottom; y++, piece += targetPitch, sourcePiece += sourcePitch)
+			memcpy(piece, sourcePiece, (pieceRight - pieceLeft) * _pixelBytes);
+	});
+}
+
+void GifCanvas::CopyTo(uint32_t* target, int pitch, int left, int top, int right, int bottom) const
+{
+	ForEachPiece(left, top, right, bottom, [&](const uint32_t* piece, int piecePitch, int pieceLeft, int pieceTop, int pieceRight, int pieceBottom)
+	{
+		for (int y = pieceTop; y < pieceBottom; y++)
+		{
+			auto row = target + static_cast<size_t>(y - top) * pitch + (pieceLeft - left);
+			if (piece == nullptr)
+				std::fill(row, row + (pieceRight - pieceLeft), Background());
+			else
+				memcpy(row, piece + (y - pieceTop) * piecePitch, (pieceRight - pieceLeft) * sizeof(uint32_t));
+		}
+	});
+}
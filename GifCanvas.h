@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+//what an indexed canvas expands to, every index has an entry so a stray one can't read past the end
+struct GifCanvasPalette
+{
+	uint32_t colors[256];
+	uint8_t background;
+};
+
+//a canvas split into square tiles that are only allocated once something is drawn into them
+//tiles that were never drawn, or have since been cleared whole, read as the background color, so a canvas costs the
+//area actually painted rather than width x height, which is what makes the 65535x65535 canvases gifs allow workable
+//pixels are 32bpp BGRA, or 8bpp indices into a palette that are only expanded as they're copied out
+//a canvas can also wrap memory someone else owns, it is then BGRA rows rather than tiles and nothing is ever freed
+//everything is in canvas pixels and rectangles have exclusive right and bottom edges
+class GifCanvas
+{
+public:
+	static const int TileSize = 128;
+	static const size_t TilePixels = TileSize * TileSize;
+	//a tile of BGRA, indexed tiles are a quarter of this
+	static const size_t TileBytes = TilePixels * sizeof(uint32_t);
+	//clears and copies smaller than this stay on the calling thread, the same two bands ForEachBand waits for
+	static const int MinParallelPixels = 512 * 1024;
+private:
+	uint32_t _width;
+	uint32_t _height;
+	std::shared_ptr<const GifCanvasPalette> _palette;
+	//a BGRA color, or an index for indexed canvases
+	uint32_t _background;
+	size_t _pixelBytes;
+	int _tilesAcross;
+	int _tilesDown;
+	//swapped in with compare and swap so bands compositing in parallel can allocate tiles as they reach them
+	std::unique_ptr<std::atomic<uint8_t*>[]> _tiles;
+	std::atomic<size_t> _tileCount;
+	//wrapped memory, holding the canvas from (_externalLeft, _externalTop) on with _externalPitch pixels per row
+	uint8_t* _external;
+	size_t _externalPitch;
+	int _externalLeft;
+	int _externalTop;
+	GifCanvas(const GifCanvas&) = delete;
+	GifCanvas& operator=(const GifCanvas&) = delete;
+	void Init();
+	void ReleaseTile(size_t index);
+	const uint8_t* RawTile(int tileX, int tileY) const { return _tiles[static_cast<size_t>(tileY) * _tilesAcross + tileX].load(); }
+	uint8_t* RawTileForWrite(int tileX, int tileY);
+	uint8_t* ExternalAddress(int x, int y) const
+	{
+		return _external + ((static_cast<ptrdiff_t>(y) - _externalTop) * static_cast<ptrdiff_t>(_externalPitch) + (x - _externalLeft)) * static_cast<ptrdiff_t>(_pixelBytes);
+	}
+	//pixels between one row of a piece and the next
+	size_t RowPitch() const { return _external != nullptr ? _externalPitch : TileSize; }
+	//(x, y) inside tile (tileX, tileY), nullptr if the tile is all background
+	const uint8_t* PieceAddress(int tileX, int tileY, int x, int y) const;
+	uint8_t* PieceAddressForWrite(int tileX, int tileY, int x, int y);
+	void ExpandRow(uint32_t* target, const uint8_t* indices, int count) const;
+	//ForEachTile with each row of tiles on its own thread, for rectangles big enough to be worth splitting
+	template<typename TILEFUNC>
+	void ForEachTileRowInParallel(int left, int top, int right, int bottom, TILEFUNC tileFunc);
+	//calls tileFunc(tileX, tileY, left, top, right, bottom) with the part of each tile inside the clipped rectangle
+	template<typename TILEFUNC>
+	void ForEachTile(int left, int top, int right, int bottom, TILEFUNC tileFunc) const
+	{
+		if (left < 0)
+			left = 0;
+		if (top < 0)
+			top = 0;
+		if (right > static_cast<int>(_width))
+			right = static_cast<int>(_width);
+		if (bottom > static_cast<int>(_height))
+			bottom = static_cast<int>(_height);
+		if (right <= left || bottom <= top)
+			return;
+		for (int tileY = top / TileSize; tileY <= (bottom - 1) / TileSize; tileY++)
+		{
+			int tileTop = tileY * TileSize > top ? tileY * TileSize : top;
+			int tileBottom = (tileY + 1) * TileSize < bottom ? (tileY + 1) * TileSize : bottom;
+			for (int tileX = left / TileSize; tileX <= (right - 1) / TileSize; tileX++)
+			{
+				int tileLeft = tileX * TileSize > left ? tileX * TileSize : left;
+				int tileRight = (tileX + 1) * TileSize < right ? (tileX + 1) * TileSize : right;
+				tileFunc(tileX, tileY, tileLeft, tileTop, tileRight, tileBottom);
+			}
+		}
+	}
+public:
+	//BGRA
+	GifCanvas(uint32_t width, uint32_t height, uint32_t background);
+	//indices into palette, cleared to palette->background
+	GifCanvas(uint32_t width, uint32_t height, std::shared_ptr<const GifCanvasPalette> palette);
+	//BGRA drawn straight into pixels, which holds the canvas from (left, top) on with stride bytes per row
+	//only that part of the canvas may be touched and the memory has to outlive the canvas
+	GifCanvas(uint32_t width, uint32_t height, uint32_t background, uint32_t* pixels, size_t stride, int left, int top);
+	~GifCanvas();
+	//same size and format with nothing drawn, always tiled even if this one wraps memory
+	std::unique_ptr<GifCanvas> CreateCompatible() const;
+	uint32_t Width() const { return _width; }
+	uint32_t Height() const { return _height; }
+	bool Indexed() const { return _palette != nullptr; }
+	bool External() const { return _external != nullptr; }
+	const std::shared_ptr<const GifCanvasPalette>& Palette() const { return _palette; }
+	//as BGRA whatever the format
+	uint32_t Background() const { return _palette != nullptr ? _palette->colors[_background] : _background; }
+	uint32_t Pixel(int x, int y) const;
+	//(x, y) for writing, allocating its tile filled with the background the first time, the pixels up to the tile's
+	//right edge follow it in memory, safe to call from several threads at once
+	//PixelForWrite is for BGRA canvases and IndexForWrite for indexed ones
+	uint32_t* PixelForWrite(int x, int y) { return reinterpret_cast<uint32_t*>(PieceAddressForWrite(x / TileSize, y / TileSize, x, y)); }
+	uint8_t* IndexForWrite(int x, int y) { return PieceAddressForWrite(x / TileSize, y / TileSize, x, y); }
+	//back to the background, tiles cleared whole are freed
+	void Clear(int left, int top, int right, int bottom);
+	void Clear();
+	//source has to be the same size and format, tiles that are background there end up background here
+	void CopyFrom(const GifCanvas& source, int left, int top, int right, int bottom);
+	//flattens a rectangle into ordinary BGRA rows, pitch is in pixels
+	void CopyTo(uint32_t* target, int pitch, int left, int top, int right, int bottom) const;
+	//calls copyFunc(piece, piecePitch, left, top, right, bottom) for each piece of the rectangle, piece is BGRA starting
+	//at (left, top) with piecePitch pixels per row and nullptr where the canvas is background, so uploads can skip
+	//the flattening copy, indexed tiles are expanded a piece at a time so only what is copied out ever exists as BGRA
+	template<typename COPYFUNC>
+	void ForEachPiece(int left, int top, int right, int bottom, COPYFUNC copyFunc) const
+	{
+		std::unique_ptr<uint32_t[]> expanded;
+		int pitch = static_cast<int>(RowPitch());
+		ForEachTile(left, top, right, bottom, [&](int tileX, int tileY, int pieceLeft, int pieceTop, int pieceRight, int pieceBottom)
+		{
+			auto piece = PieceAddress(tileX, tileY, pieceLeft, pieceTop);
+			if (piece == nullptr)
+				copyFunc(static_cast<const uint32_t*>(nullptr), TileSize, pieceLeft, pieceTop, pieceRight, pieceBottom);
+			else if (_palette == nullptr)
+				copyFunc(reinterpret_cast<const uint32_t*>(piece), pitch, pieceLeft, pieceTop, pieceRight, pieceBottom);
+			else
+			{
+				if (expanded == nullptr)
+					expanded = std::unique_ptr<uint32_t[]>(new uint32_t[TilePixels]);
+				for (int y = pieceTop; y < pieceBottom; y++)
+					ExpandRow(expanded.get() + (y - pieceTop) * TileSize, piece + (y - pieceTop) * pitch, pieceRight - pieceLeft);
+				copyFunc(static_cast<const uint32_t*>(expanded.get()), TileSize, pieceLeft, pieceTop, pieceRight, pieceBottom);
+			}
+		});
+	}
+	//what the canvas has allocated, wrapped memory belongs to someone else and isn't counted
+	size_t Bytes() const { return _tileCount.load() * TilePixels * _pixelBytes; }
+};
@@ -3,6 +3,8 @@
 #include "task_helper.h"
 #include "ResourceLoader.h"
 
+#include <cmath>
+
 using namespace Windows::Foundation;
 using namespace Windows::Storage::Streams;
 using namespace std;
@@ -19,9 +21,70 @@ Size GiflibImageDecoder::DefaultSize()
 	return Size(static_cast<float>(_gifFile->SWidth), static_cast<float>(_gifFile->SHeight));
 }
 
+//the coarsest power of two whose canvas still covers the render size, so a zoomed out view composites and uploads
+//a fraction of the pixels, only a view more than half the image's size gets the exact full size canvas
+int GiflibImageDecoder::CanvasScaleFor(Size size) const
+{
+	int scale = 1;
+	while (scale < static_cast<int>(MaxCanvasScale) && size.Width > 0 && size.Height > 0 &&
+		static_cast<float>(_gifFile->SWidth) / (scale * 2) >= size.Width && static_cast<float>(_gifFile->SHeight) / (scale * 2) >= size.Height)
+		scale *= 2;
+	return scale < _minCanvasScale ? _minCanvasScale : scale;
+}
+
 void GiflibImageDecoder::RenderSize(Size size)
 {
 	_renderSize = size;
+	int scale = CanvasScaleFor(size);
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		if (scale == _canvasScale)
+			return;
+		//nothing queued is the right size any more, the producer notices the new scale and starts a fresh canvas
+		_canvasScale = scale;
+		_aheadFrames.clear();
+		_freeAheadBuffers.clear();
+		_aheadGeneration++;
+	}
+	_canvasInvalidated = true;
+}
+
+Size GiflibImageDecoder::SurfaceScale(Size renderSize) const
+{
+	if (renderSize.Width <= 0 || renderSize.Height <= 0)
+		return Size(1, 1);
+	return Size(renderSize.Width / _gifFile->SWidth, renderSize.Height / _gifFile->SHeight);
+}
+
+GifRegion GiflibImageDecoder::FullRegion() const
+{
+	GifRegion region = { 0, 0, static_cast<int>(_gifFile->SWidth), static_cast<int>(_gifFile->SHeight) };
+	return region;
+}
+
+//a surface rect scaled back to the image, rounded out to whole image pixels and clipped to the image
+GifRegion GiflibImageDecoder::ImageRegion(Rect rect, Size renderSize) const
+{
+	auto surfaceScale = SurfaceScale(renderSize);
+	GifRegion region = { static_cast<int>(std::floor(rect.Left / surfaceScale.Width)), static_cast<int>(std::floor(rect.Top / surfaceScale.Height)),
+		static_cast<int>(std::ceil(rect.Right / surfaceScale.Width)), static_cast<int>(std::ceil(rect.Bottom / surfaceScale.Height)) };
+	return region.Intersect(FullRegion());
+}
+
+//anything outside the region of interest throws away the ring straight away, waiting for it to shrink and grow
+//again on the next frame would leave part of the view blank for a frame's time
+void GiflibImageDecoder::RequestRegion(const GifRegion& region)
+{
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		_requestedRegion = _requestedRegion.Union(region);
+		if (_regionOfInterest.Contains(region))
+			return;
+		_regionOfInterest = _regionOfInterest.Union(region);
+		_aheadFrames.clear();
+		_aheadGeneration++;
+	}
+	_canvasInvalidated = true;
 }
 
 int gif_user_data::read(GifByteType * buf, unsigned int plength)
@@ -81,49 +144,280 @@ int gif_user_data::read(GifByteType * buf, unsigned int plength)
   return plength;
 }
 
-void gif_user_data::addData(IBuffer^ pBuffer)
+int gif_user_data::skip(unsigned int plength)
+{
+  if (position + plength > length)
+    return 0;
+
+  position += plength;
+  return plength;
+}
+
+bool gif_user_data::addData(IBuffer^ pBuffer)
 {
   for (auto buf : buffer)
   {
       if (pBuffer == buf)
-          return; //dirty way to ensure no duplicate buffers
+          return false; //dirty way to ensure no duplicate buffers
   }
   length += pBuffer->Length;
   buffer.push_back(pBuffer);
+  return true;
+}
+
+void gif_source::append(IBuffer^ chunk)
+{
+  std::lock_guard<std::mutex> sourceGuard(sourceMutex);
+  ResourceLoader::GetBytesFromBuffer(chunk, [&](uint8_t* bytes, uint32_t count)
+  {
+    chunks.push_back(chunk);
+    chunkBytes.push_back(bytes);
+    chunkStarts.push_back(length);
+    length += count;
+  });
+}
+
+bool gif_source::retain(uint32_t offset, uint32_t count)
+{
+  if (count == 0)
+    return true;
+  std::lock_guard<std::mutex> sourceGuard(sourceMutex);
+  auto next = std::upper_bound(retained.begin(), retained.end(), offset, [](uint32_t value, const retained_range& range) { return value < range.offset; });
+  if (next != retained.begin())
+  {
+    auto& previous = *(next - 1);
+    if (offset + count <= previous.offset + previous.bytes.size())
+      return true;
+  }
+  retained_range range = { offset, std::vector<uint8_t>(count) };
+  if (!read_chunks(offset, range.bytes.data(), count))
+    return false;
+  retained.insert(next, std::move(range));
+  return true;
+}
+
+void gif_source::release_before(uint32_t offset)
+{
+  std::lock_guard<std::mutex> sourceGuard(sourceMutex);
+  size_t released = 0;
+  while (released < chunks.size() && chunkStarts[released] + chunks[released]->Length <= offset)
+    released++;
+  chunks.erase(chunks.begin(), chunks.begin() + released);
+  chunkBytes.erase(chunkBytes.begin(), chunkBytes.begin() + released);
+  chunkStarts.erase(chunkStarts.begin(), chunkStarts.begin() + released);
+}
+
+bool gif_source::read_at(uint32_t offset, GifByteType* buf, uint32_t count) const
+{
+  std::lock_guard<std::mutex> sourceGuard(sourceMutex);
+  if (offset + count > length || offset + count < offset)
+    return false;
+
+  auto next = std::upper_bound(retained.begin(), retained.end(), offset, [](uint32_t value, const retained_range& range) { return value < range.offset; });
+  if (next != retained.begin())
+  {
+    auto& range = *(next - 1);
+    if (offset + count <= range.offset + range.bytes.size())
+    {
+      memcpy(buf, range.bytes.data() + (offset - range.offset), count);
+      return true;
+    }
+  }
+  return read_chunks(offset, buf, count);
+}
+
+//called with sourceMutex held
+bool gif_source::read_chunks(uint32_t offset, GifByteType* buf, uint32_t count) const
+{
+  if (chunks.empty() || offset < chunkStarts.front() || offset + count > length)
+    return false;
+
+  auto chunkIndex = static_cast<size_t>(std::upper_bound(chunkStarts.begin(), chunkStarts.end(), offset) - chunkStarts.begin()) - 1;
+  while (count > 0)
+  {
+    auto chunkOffset = offset - chunkStarts[chunkIndex];
+    auto available = chunks[chunkIndex]->Length - chunkOffset;
+    auto copyLength = count < available ? count : available;
+    memcpy(buf, chunkBytes[chunkIndex] + chunkOffset, copyLength);
+    buf += copyLength;
+    offset += copyLength;
+    count -= copyLength;
+    chunkIndex++;
+  }
+  return true;
 }
 
 
-//handler is passed the decoded bytes and a bool to indicate whether or not to put it back in the queue to render again
+//for a rect or scale CanDecode says the frame on screen doesn't cover, the frame playback is on now is composited on
+//the pool at the render size current now, and the ring is asked for the rect so the animation catches up behind it
 task<Windows::Foundation::Rect> GiflibImageDecoder::DecodeRectangleAsync(Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext)
 {
-	throw ref new Platform::NotImplementedException();
+	auto decoder = shared_from_this();
+	auto renderSize = _renderSize;
+	size_t frameIndex = static_cast<size_t>(_currentFrame.load());
+	auto region = ImageRegion(requestedRect, renderSize);
+	if (!region.Empty())
+		RequestRegion(region);
+	return _asyncQueue->Schedule([decoder, requestedRect, renderSize, frameIndex]()
+	{
+		auto decodedRect = decoder->DecodePixels(requestedRect, renderSize, frameIndex);
+		decoder->ReportDecodedBytes();
+		return decodedRect;
+	});
 }
 
-bool GiflibImageDecoder::CanDecode(Windows::Foundation::Rect rect)
+//runs on the decode pool, only one at a time per decoder, returns the surface rect the pixels cover
+Rect GiflibImageDecoder::DecodePixels(Rect requestedRect, Size renderSize, size_t frameIndex)
+{
+	auto asyncGuard = _stats.Lock(_asyncMutex);
+	auto frameTable = FrameTable();
+	if (frameTable->frames.size() == 0)
+		return Rect();
+	if (frameIndex >= frameTable->frames.size())
+		frameIndex = frameTable->frames.size() - 1;
+
+	//only the requested part is composited, a canvas that was composited for less than that starts again
+	auto region = ImageRegion(requestedRect, renderSize);
+	if (region.Empty())
+		return Rect();
+	int scale = CanvasScaleFor(renderSize);
+	if (scale != _asyncScale || !_asyncRegion.Contains(region))
+	{
+		_asyncCanvas = nullptr;
+		_asyncFrame = 0;
+		_asyncScale = scale;
+	}
+	_asyncRegion = region;
+	auto compositeStart = _stats.Now();
+	LoadGifFrame(_gifFile, *frameTable, _asyncCanvas, _asyncFrame, frameIndex, scale, region);
+	_stats.FrameComposited(_stats.Now() - compositeStart);
+	_asyncFrame = frameIndex;
+	_asyncBytes = _asyncCanvas->Bytes();
+
+	int left = region.left / scale;
+	int top = region.top / scale;
+	int right = min(static_cast<int>(CanvasWidth(scale)), (region.right + scale - 1) / scale);
+	int bottom = min(static_cast<int>(CanvasHeight(scale)), (region.bottom + scale - 1) / scale);
+	DecodedPixels target;
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		std::swap(target, _sparePixels);
+	}
+	//resize keeps the capacity from the last decode so same sized requests don't allocate
+	target.width = right - left;
+	target.height = bottom - top;
+	target.pixels.resize(static_cast<size_t>(target.width) * target.height);
+	_asyncCanvas->CopyTo(target.pixels.data(), target.width, left, top, right, bottom);
+	int imageRight = min(static_cast<int>(_gifFile->SWidth), right * scale);
+	int imageBottom = min(static_cast<int>(_gifFile->SHeight), bottom * scale);
+	auto surfaceScale = SurfaceScale(renderSize);
+	target.rect = Rect(left * scale * surfaceScale.Width, top * scale * surfaceScale.Height,
+		(imageRight - left * scale) * surfaceScale.Width, (imageBottom - top * scale) * surfaceScale.Height);
+	target.renderSize = renderSize;
+	target.valid = true;
+
+	std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+	std::swap(target, _decodedPixels);
+	_sparePixels = std::move(target);
+	_sparePixels.valid = false;
+	return _decodedPixels.rect;
+}
+
+//safe from any thread, it has no canvas of its own to share with the producer, the pixels are wrapped
+//rather than copied into so the only memory it holds is DM_PREVIOUS scratch for the length of a call
+bool GiflibImageDecoder::CompositeFrameInto(size_t frameIndex, uint32_t* pixels, size_t stride, const GifRegion& rect)
 {
+	auto frameTable = FrameTable();
+	if (pixels == nullptr || frameIndex >= frameTable->frames.size() || rect.Empty() || !FullRegion().Contains(rect))
+		return false;
+	if (stride % sizeof(uint32_t) != 0 || stride / sizeof(uint32_t) < static_cast<size_t>(rect.right - rect.left))
+		return false;
+
+	std::lock_guard<std::mutex> intoGuard(_intoMutex);
+	bool sameTarget = _intoCanvas != nullptr && _intoPixels == pixels && _intoStride == stride &&
+		_intoRegion.left == rect.left && _intoRegion.top == rect.top && _intoRegion.right == rect.right && _intoRegion.bottom == rect.bottom;
+	if (!sameTarget)
+	{
+		_intoCanvas = std::unique_ptr<GifCanvas>(new GifCanvas(CanvasWidth(1), CanvasHeight(1), CanvasBackground(_gifFile), pixels, stride, rect.left, rect.top));
+		_intoCanvas->Clear(rect.left, rect.top, rect.right, rect.bottom);
+		_intoPixels = pixels;
+		_intoStride = stride;
+		_intoRegion = rect;
+		_intoFrame = 0;
+	}
+
+	auto compositeStart = _stats.Now();
+	try
+	{
+		LoadGifFrame(_gifFile, *frameTable, _intoCanvas, _intoFrame, frameIndex, 1, rect);
+	}
+	catch (...)
+	{
+		//whatever is in the pixels now is half a frame, so the next call can't carry on from it
+		_intoCanvas = nullptr;
+		throw;
+	}
+	_intoFrame = frameIndex;
+	_stats.FrameComposited(_stats.Now() - compositeStart);
 	return true;
 }
 
-bool GiflibImageDecoder::Update(float total, float delta)
+//whether the frame on screen holds all of region at the current scale or finer
+bool GiflibImageDecoder::DisplayCovers(const GifRegion& region)
 {
-	double msDelta = ((double)total) * 1000;
-	double accountedFor = 0;
+	int scale = _canvasScale;
+	std::lock_guard<std::mutex> displayGuard(_displayMutex);
+	return _displayBuffer != nullptr && _displayScale <= scale && _displayRegion.Contains(region);
+}
+
+//false for a rect or scale nothing has been composited for yet, the renderer asks DecodeRectangleAsync for those
+//rather than drawing what little the frame on screen has of them
+bool GiflibImageDecoder::CanDecode(Windows::Foundation::Rect rect)
+{
+	auto region = ImageRegion(rect, _renderSize);
+	if (region.Empty() || DisplayCovers(region))
+		return true;
+	std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+	return _decodedPixels.Covers(rect, _renderSize);
+}
+
+bool GiflibImageDecoder::Update(const GifFrameTable& frameTable, ClockTicks elapsed)
+{
+	auto& frames = frameTable.frames;
+	uint64_t msDelta = elapsed > 0 ? static_cast<uint64_t>(elapsed / TicksPerMillisecond) : 0;
+	uint64_t loop = 0;
+	if (frameTable.isLoaded && frameTable.totalDelay > 0)
+	{
+		auto playCount = frameTable.PlayCount();
+		if (playCount != 0 && msDelta >= frameTable.totalDelay * playCount)
+		{
+			//out of loops, hold on the last frame
+			_currentFrame = static_cast<int>(frames.size() - 1);
+			_currentSequence = playCount * frames.size() - 1;
+			_playbackFinished = true;
+			_startedRendering = true;
+			return true;
+		}
+		loop = msDelta / frameTable.totalDelay;
+		msDelta %= frameTable.totalDelay;
+	}
+	uint64_t accountedFor = 0;
 	size_t i = 0;
 	for (; accountedFor < msDelta; i++)
 	{
-		if (i >= _frames.size())
+		if (i >= frames.size())
 		{
-			if (_isLoaded)
-				i = 0;
-			else
-			{
-				i = _frames.size() - 1;
-				break;
-			}
+			i = frames.size() - 1;
+			break;
 		}
-		accountedFor += GetFrameDelay(i);
+		accountedFor += frames[i].delay;
 	}
 	auto newFrame = std::max<int>((int)i - 1, 0);
+	//when this frame's delay runs out, if we ran off the end of a partial load just look again in a frame's time
+	if (accountedFor == 0)
+		accountedFor = frames[0].delay;
+	_msUntilNextFrame = accountedFor > msDelta ? accountedFor - msDelta : (frameTable.isLoaded ? 1 : 16);
+	_currentSequence = loop * frames.size() + newFrame;
 	if (newFrame != _currentFrame || _currentFrame == 0)
 	{
 		_currentFrame = newFrame;
@@ -142,91 +436,950 @@ bool GiflibImageDecoder::Update(float total, float delta)
 	}
 }
 
-uint32_t GiflibImageDecoder::GetFrameDelay(size_t index) const { return _frames[index].delay; }
-size_t GiflibImageDecoder::FrameCount() const
+std::shared_ptr<const GifFrameTable> GiflibImageDecoder::FrameTable() const
 {
-	if (_frames.size() != _decodedImages.size())
-		throw ref new Platform::InvalidArgumentException("image count didnt match frame size");
-	return _frames.size();
+	return std::atomic_load(&_frameTable);
 }
 
-static void ThrowIfFailed(HRESULT hr)
+Rect GiflibImageDecoder::DecodeRectangle(Rect requestedRect, IFrameSink& sink, bool& requeue)
 {
-	if (FAILED(hr))
+	GIF_TRACE_SCOPE("DecodeRectangle");
+	//timing and compositing all happen in Advance, this just uploads whatever frame it last settled on
+	//requeue keeps the renderer registered with the AnimationScheduler until we are out of loops
+	requeue = !_animationReleased;
+	auto requested = ImageRegion(requestedRect, _renderSize);
+	if (requested.Empty())
+		return Rect();
+	RequestRegion(requested);
+
+	//until the ring catches up with a rect or scale that's new, what DecodeRectangleAsync composited stands in for it
+	if (!DisplayCovers(requested))
 	{
-		throw Platform::Exception::CreateException(hr);
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		if (_decodedPixels.Covers(requestedRect, _renderSize))
+		{
+			sink.Prepare(_decodedPixels.width, _decodedPixels.height, true);
+			sink.Upload(_decodedPixels.pixels.data(), _decodedPixels.width, 0, 0, _decodedPixels.width, _decodedPixels.height);
+			//not a frame the display versions know about, so the next draw from the ring sends everything
+			sink.Forget();
+			_stats.FirstFrame();
+			return _decodedPixels.rect;
+		}
 	}
+
+	auto displayGuard = _stats.Lock(_displayMutex);
+	//only the requested part of the frame is uploaded, if the frame on screen was composited for less than that
+	//we upload what it has and the rest arrives with the frame Advance swaps in once the ring has caught up
+	auto region = _displayRegion.Intersect(requested);
+	if (_displayBuffer != nullptr && !region.Empty())
+	{
+		int scale = _displayScale;
+		int canvasWidth = CanvasWidth(scale);
+		int left = region.left / scale;
+		int top = region.top / scale;
+		int right = min(canvasWidth, (region.right + scale - 1) / scale);
+		int bottom = min(static_cast<int>(CanvasHeight(scale)), (region.bottom + scale - 1) / scale);
+		//a downscaled canvas is stretched back over the image by the renderer, it draws into the rect we return
+		sink.Prepare(static_cast<uint32_t>(right - left), static_cast<uint32_t>(bottom - top), true);
+
+		//a sink that already holds an earlier frame of ours over the same rect only needs what changed since
+		int dirtyLeft = left, dirtyTop = top, dirtyRight = right, dirtyBottom = bottom;
+		auto& held = sink.Contents();
+		if (held.owner == this && held.scale == scale && held.left == left && held.top == top && held.right == right && held.bottom == bottom &&
+			held.version <= _displayVersion && _displayVersion - held.version < DisplayDirtyHistory)
+		{
+			auto dirty = GifRegion();
+			for (auto version = held.version + 1; version <= _displayVersion; version++)
+				dirty = dirty.Union(_displayDirty[version % DisplayDirtyHistory]);
+			dirtyLeft = max(left, dirty.left / scale);
+			dirtyTop = max(top, dirty.top / scale);
+			dirtyRight = min(right, (dirty.right + scale - 1) / scale);
+			dirtyBottom = min(bottom, (dirty.bottom + scale - 1) / scale);
+		}
+
+		//straight from the tiles, anything never drawn comes from a single tile of background
+		_displayBuffer->ForEachPiece(dirtyLeft, dirtyTop, dirtyRight, dirtyBottom, [&](const uint32_t* piece, int piecePitch, int pieceLeft, int pieceTop, int pieceRight, int pieceBottom)
+		{
+			if (piece == nullptr)
+			{
+				if (_backgroundTile == nullptr || _backgroundTile[0] != _displayBuffer->Background())
+				{
+					_backgroundTile = std::unique_ptr<uint32_t[]>(new uint32_t[GifCanvas::TileSize * GifCanvas::TileSize]);
+					std::fill(_backgroundTile.get(), _backgroundTile.get() + GifCanvas::TileSize * GifCanvas::TileSize, _displayBuffer->Background());
+				}
+				piece = _backgroundTile.get();
+			}
+			sink.Upload(piece, piecePitch, pieceLeft - left, pieceTop - top, pieceRight - left, pieceBottom - top);
+		});
+		FrameSinkContents contents = { this, _displayVersion, left, top, right, bottom, scale };
+		sink.Contents(contents);
+		_stats.FirstFrame();
+
+		//the renderer draws into the surface, which is the image at the render size rather than at the canvas scale
+		int imageRight = min(static_cast<int>(_gifFile->SWidth), right * scale);
+		int imageBottom = min(static_cast<int>(_gifFile->SHeight), bottom * scale);
+		auto surfaceScale = SurfaceScale(_renderSize);
+		return Rect(left * scale * surfaceScale.Width, top * scale * surfaceScale.Height,
+			(imageRight - left * scale) * surfaceScale.Width, (imageBottom - top * scale) * surfaceScale.Height);
+	}
+	return Rect();
 }
 
-Rect GiflibImageDecoder::DecodeRectangle(Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& copyDestination, bool& requeue)
+bool GiflibImageDecoder::Advance(ClockTicks& nextDelay)
 {
-	std::lock_guard<std::mutex> readGuard(_frameMutex);
-	requeue = true;
-	if (_decodedImages.size() > 0)
+	//whatever the loader last published, it can carry on appending frames while we look at this one
+	auto frameTable = FrameTable();
+	if (_animationReleased)
 	{
-		if (!_startedRendering)
-			_timer->Reset();
+		nextDelay = -1;
+		return false;
+	}
+	if (_suspended)
+	{
+		//the frame on screen is ours to manage, ShedMemory takes care of everything else
+		//Resume invalidates and the draw that follows registers us with the scheduler again
+		DropDisplayedFrame();
+		nextDelay = -1;
+		return false;
+	}
+	//the ring was thrown away, whatever is due gets composited again and replaces the frame on screen
+	if (_canvasInvalidated.exchange(false))
+		_displayedSequence = -1;
+	if (frameTable->frames.size() == 0)
+	{
+		nextDelay = 16 * TicksPerMillisecond;
+		return false;
+	}
+
+	auto now = _playbackClock.Now();
+	if (!_startedRendering)
+		_playbackStart = now;
+
+	//compositing happens on the decode pool, all we do here is pick up a finished frame
+	//if the one we want isn't ready yet we keep showing the last one and look again shortly
+	auto policy = Policy();
+	auto rate = _playbackClock.Rate();
+	auto previousSequence = _displayedSequence;
+	bool ready = true;
+	ClockTicks capDelay = 0;
+	//the cap is in real time, so at double speed twice as much playback time has to pass between frames
+	auto capInterval = policy.maxFrameRate > 0 ? static_cast<ClockTicks>(TicksPerSecond * rate / policy.maxFrameRate) : 0;
+	Update(*frameTable, now - _playbackStart);
+	if (static_cast<int64_t>(_currentSequence) != _displayedSequence)
+	{
+		if (_displayedSequence >= 0 && now - _displayedAt < capInterval)
+		{
+			capDelay = static_cast<ClockTicks>((capInterval - (now - _displayedAt)) / (rate > 0 ? rate : 1));
+			_framesCapped++;
+		}
 		else
-			_timer->Update();
-
-		if (Update(_timer->Total, _timer->Delta))
-		{
-			LoadGifFrame(_gifFile, _frames, _renderBuffer, _lastFrame, _currentFrame);
-			_lastFrame = _currentFrame;
-			auto displayInfo = Windows::Graphics::Display::DisplayInformation::GetForCurrentView();
-			D2D1_SIZE_U size = { static_cast<uint32_t>(_gifFile->SWidth), static_cast<uint32_t>(_gifFile->SHeight) };
-			D2D1_BITMAP_PROPERTIES1 properties;
-			memset(&properties, 0, sizeof(D2D1_BITMAP_PROPERTIES1));
-			properties.dpiX = displayInfo->RawDpiX;
-			properties.dpiY = displayInfo->RawDpiY;
-			properties.pixelFormat = D2D1_PIXEL_FORMAT{ DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE };
-			ThrowIfFailed(d2dContext->CreateBitmap(size, reinterpret_cast<const void*>(_renderBuffer.get()), _gifFile->SWidth * 4, properties, copyDestination.ReleaseAndGetAddressOf()));
-			return Rect(0, 0, static_cast<float>(_gifFile->SWidth), static_cast<float>(_gifFile->SHeight));
+			ready = TakeAheadFrame(_currentSequence, policy.skipLateFrames);
+	}
+	ScheduleDecodeAhead();
+	bool changed = _displayedSequence != previousSequence;
+	if (changed)
+		_displayedAt = now;
+
+	if (_playbackFinished && _displayedSequence == static_cast<int64_t>(_currentSequence) && ReleaseAnimation())
+	{
+		nextDelay = -1;
+		return true;
+	}
+
+	if (capDelay > 0)
+		nextDelay = capDelay;
+	else if (!ready || _playbackFinished)
+		nextDelay = 4 * TicksPerMillisecond;
+	else if (_playbackClock.IsPaused() || rate <= 0)
+		nextDelay = 250 * TicksPerMillisecond; //nothing moves until Play, just keep an eye out for it
+	else
+	{
+		//with a cap the producer only emits some of the frames, waking for the ones in between would show nothing new,
+		//and neither would waking before the cap lets the next one through
+		auto until = static_cast<ClockTicks>(_msUntilNextFrame) * TicksPerMillisecond;
+		auto queued = QueuedAheadSequence();
+		if (queued > static_cast<int64_t>(_currentSequence) + 1)
+		{
+			auto position = SequenceStart(*frameTable, _currentSequence + 1) - _msUntilNextFrame;
+			until = std::max(until, static_cast<ClockTicks>(SequenceStart(*frameTable, static_cast<uint64_t>(queued)) - position) * TicksPerMillisecond);
 		}
+		if (_displayedSequence >= 0)
+			until = std::max(until, capInterval - (now - _displayedAt));
+		nextDelay = static_cast<ClockTicks>(until / rate);
 	}
-	return Rect();
+	return changed;
 }
 
-void GiflibImageDecoder::Suspend()
+//drops the rasters and every canvas but the frame on screen, fails if the producer is still busy so the caller can retry on the next tick
+bool GiflibImageDecoder::ReleaseAnimation()
+{
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		if (_producingAhead)
+			return false;
+		//keeps ScheduleDecodeAhead from ever starting another producer
+		_producingAhead = true;
+		_aheadFrames.clear();
+		_freeAheadBuffers.clear();
+		_renderBuffer = nullptr;
+		_renderBytes = 0;
+	}
+	//the last frame was composited in full at the finest scale, so CanDecode never sends anything async again
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		_decodedPixels = DecodedPixels();
+		_sparePixels = DecodedPixels();
+	}
+	//the frame index and extension views are small and the loader may still be appending to them, so the table stays,
+	//the slots stay too so its indices keep lining up with them, Raster() stops filling them once _animationReleased is set
+	_animationReleased = true;
+	{
+		std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+		for (auto& slot : _rasters)
+			slot = GifRasterSlot();
+		_rasterBytes = 0;
+	}
+	ReportDecodedBytes();
+	return true;
+}
+
+//shows the newest finished frame that is due by sequence, returns false if that isn't the one asked for
+bool GiflibImageDecoder::TakeAheadFrame(uint64_t sequence, bool skipLateFrames)
+{
+	auto aheadGuard = _stats.Lock(_aheadMutex);
+	auto chosen = _aheadFrames.end();
+	for (auto candidate = _aheadFrames.begin(); candidate != _aheadFrames.end() && candidate->sequence <= sequence; candidate++)
+	{
+		chosen = candidate;
+		//without skipping every frame gets its turn, even if it is late
+		if (!skipLateFrames)
+			break;
+	}
+
+	if (chosen != _aheadFrames.end())
+	{
+		if (_displayedSequence >= 0 && chosen->sequence > static_cast<uint64_t>(_displayedSequence) + 1)
+		{
+			auto skipped = chosen->sequence - static_cast<uint64_t>(_displayedSequence) - 1;
+			_framesSkipped += skipped;
+			_stats.FramesSkipped(skipped);
+		}
+		_framesShown++;
+
+		//anything queued in front of the frame we show is late, recycle it, what it changed is still a change on screen
+		auto dirty = chosen->dirty;
+		for (auto stale = _aheadFrames.begin(); stale != chosen; stale++)
+		{
+			dirty = dirty.Union(stale->dirty);
+			RecycleAheadBuffer(std::move(stale->pixels), stale->scale);
+		}
+		{
+			std::lock_guard<std::mutex> displayGuard(_displayMutex);
+			_displayVersion++;
+			_displayDirty[_displayVersion % DisplayDirtyHistory] = dirty;
+			if (_displayBuffer != nullptr)
+				RecycleAheadBuffer(std::move(_displayBuffer), _displayScale);
+			_displayBuffer = std::move(chosen->pixels);
+			_displayScale = chosen->scale;
+			_displayRegion = chosen->region;
+			_displayedFrame = static_cast<int>(chosen->frameIndex);
+			_displayedSequence = static_cast<int64_t>(chosen->sequence);
+		}
+		_aheadFrames.erase(_aheadFrames.begin(), chosen + 1);
+
+		//shrinking never needs a flush, everything already in the ring covers more than is asked for
+		if (!_requestedRegion.Empty())
+		{
+			_regionOfInterest = _requestedRegion;
+			_requestedRegion = GifRegion();
+		}
+	}
+
+	//the producer has fallen behind the clock, rather than work through every frame in between
+	//send it straight to the one that's due, keyframes let it skip most of the compositing
+	//with nothing on screen (just resumed) it goes wherever we are, even if that's behind where it stopped
+	if (_aheadFrames.empty() && ((skipLateFrames && _aheadNextSequence < sequence) || (_displayedSequence < 0 && _aheadNextSequence != sequence)))
+	{
+		_aheadNextSequence = sequence;
+		_aheadGeneration++;
+	}
+	if (_displayedSequence == static_cast<int64_t>(sequence))
+		return true;
+	//the producer went past sequence without emitting it, so what's on screen is the newest there will be
+	return _displayedSequence >= 0 && _displayedSequence < static_cast<int64_t>(sequence) && _aheadNextSequence > sequence &&
+		(_aheadFrames.empty() || _aheadFrames.front().sequence > sequence);
+}
+
+//the next frame waiting in the ring, -1 if there isn't one
+int64_t GiflibImageDecoder::QueuedAheadSequence()
+{
+	std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+	return _aheadFrames.empty() ? -1 : static_cast<int64_t>(_aheadFrames.front().sequence);
+}
+
+//called with _aheadMutex held, a buffer composited before the scale last changed is the wrong size to reuse
+void GiflibImageDecoder::RecycleAheadBuffer(std::unique_ptr<GifCanvas> pixels, int scale)
+{
+	if (pixels != nullptr && scale == _canvasScale)
+		_freeAheadBuffers.push_back(std::move(pixels));
+}
+
+uint64_t GiflibImageDecoder::SequenceStart(const GifFrameTable& frameTable, uint64_t sequence) const
+{
+	auto frameCount = frameTable.frames.size();
+	return (sequence / frameCount) * frameTable.totalDelay + frameTable.frames[sequence % frameCount].start;
+}
+
+void GiflibImageDecoder::ScheduleDecodeAhead()
+{
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		if (_producingAhead || _suspended || _aheadFrames.size() >= _aheadDepth)
+			return;
+		_producingAhead = true;
+	}
+	auto decoder = shared_from_this();
+	DecodePool::Instance().Submit([decoder]()
+	{
+		decoder->DecodeAhead();
+		decoder->ReportDecodedBytes();
+	}, DecodePriority::NextFrame);
+}
+
+//runs as a single pool job at a time, fills the ring up to the current depth and then gives the producer role back
+void GiflibImageDecoder::DecodeAhead()
+{
+	auto frameTable = FrameTable();
+	auto& frames = frameTable->frames;
+	auto policy = Policy();
+	//frames closer together than this would only be skipped by TakeAheadFrame, so they're composited but never copied out,
+	//the cap is in real time like Advance's, so at double speed it's twice as many ms of the animation
+	auto rate = _playbackClock.Rate();
+	uint64_t emitInterval = policy.maxFrameRate > 0 ? static_cast<uint64_t>(1000 * (rate > 0 ? rate : 1) / policy.maxFrameRate) : 0;
+	for (;;)
+	{
+		uint64_t sequence;
+		uint32_t generation;
+		bool mustEmit;
+		int scale;
+		GifRegion region;
+		std::unique_ptr<GifCanvas> pixels;
+		{
+			std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+			if (_cancelToken.is_canceled() || _suspended || _aheadFrames.size() >= _aheadDepth || frames.size() == 0)
+			{
+				if (_suspended)
+				{
+					//ShedMemory leaves the canvas to us if we were busy when it ran
+					_renderBuffer = nullptr;
+					_renderBytes = 0;
+					_aheadFrame = 0;
+				}
+				_producingAhead = false;
+				return;
+			}
+			sequence = _aheadNextSequence;
+			auto playCount = frameTable->PlayCount();
+			if ((!frameTable->isLoaded && sequence >= frames.size()) ||
+				(frameTable->isLoaded && playCount != 0 && sequence >= playCount * frames.size()))
+			{
+				_producingAhead = false;
+				return;
+			}
+			generation = _aheadGeneration;
+			scale = _canvasScale;
+			region = _regionOfInterest;
+			//nothing on screen and nothing on the way, the renderer is waiting on this one whatever the cap says
+			mustEmit = _displayedSequence < 0 && _aheadFrames.empty();
+			//the last frame is all that's kept once playback finishes and nothing composites it again, so that one is always
+			//composited in full at the finest scale and shown, whatever the view zooms or scrolls to later it is still exact
+			if (frameTable->isLoaded && playCount != 0 && sequence + 1 == playCount * frames.size())
+			{
+				region = FullRegion();
+				scale = _minCanvasScale;
+				mustEmit = true;
+			}
+		}
+		//outside the region the canvas is stale, so a region that has grown means starting again
+		if (scale != _renderScale || !_renderRegion.Contains(region))
+		{
+			_renderBuffer = nullptr;
+			_aheadFrame = 0;
+			_renderScale = scale;
+		}
+		_renderRegion = region;
+		//the ring was flushed, so whatever is on screen may be from anywhere and the next frame out has to be sent whole,
+		//and sent at all, the renderer jumped to exactly this one
+		if (generation != _renderDirtyGeneration)
+		{
+			mustEmit = true;
+			_renderDirty = FullRegion();
+			_renderDirtyGeneration = generation;
+		}
+
+		size_t frameIndex = static_cast<size_t>(sequence % frames.size());
+		auto start = SequenceStart(*frameTable, sequence);
+		bool emit = !_hasEmitted || mustEmit || emitInterval == 0 || start < _lastEmittedStart || start - _lastEmittedStart >= emitInterval;
+
+		LARGE_INTEGER startTime, endTime;
+		QueryPerformanceCounter(&startTime);
+		//stepping on a frame or wrapping round to the start is normal playback, anything else is a jump to catch up
+		if (frameIndex != 0 && frameIndex != static_cast<size_t>(_aheadFrame) + 1 && frameIndex != static_cast<size_t>(_aheadFrame))
+			_producerJumps++;
+		_renderDirty = _renderDirty.Union(LoadGifFrame(_gifFile, *frameTable, _renderBuffer, _aheadFrame, frameIndex, scale, region));
+		_aheadFrame = static_cast<int>(frameIndex);
+		_renderBytes = _renderBuffer->Bytes();
+		if (emit)
+		{
+			{
+				std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+				if (!_freeAheadBuffers.empty())
+				{
+					pixels = std::move(_freeAheadBuffers.back());
+					_freeAheadBuffers.pop_back();
+				}
+			}
+			if (pixels == nullptr || pixels->Indexed() != _renderBuffer->Indexed())
+				pixels = _renderBuffer->CreateCompatible();
+			GIF_TRACE_SCOPE_VALUE("EmitAheadFrame", sequence);
+			//outside the region both canvases are stale, so there's nothing there worth copying
+			//and only tiles something was drawn into take any memory in the copy
+			pixels->CopyFrom(*_renderBuffer, region.left / scale, region.top / scale, (region.right + scale - 1) / scale, (region.bottom + scale - 1) / scale);
+		}
+		QueryPerformanceCounter(&endTime);
+		_stats.FrameComposited(static_cast<ClockTicks>((endTime.QuadPart - startTime.QuadPart) * TicksPerSecond / _counterFrequency.QuadPart));
+
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		UpdateAheadDepth(static_cast<double>(endTime.QuadPart - startTime.QuadPart) * 1000.0 / _counterFrequency.QuadPart, frames[frameIndex].delay);
+		if (generation != _aheadGeneration)
+		{
+			//the renderer jumped or rescaled while we were busy, _aheadNextSequence already points at where it wants us
+			RecycleAheadBuffer(std::move(pixels), scale);
+			continue;
+		}
+		_aheadNextSequence = sequence + 1;
+		if (!emit)
+			continue;
+		_hasEmitted = true;
+		_lastEmittedStart = start;
+		GifAheadFrame aheadFrame = { sequence, frameIndex, std::move(pixels), scale, region, _renderDirty };
+		_aheadFrames.push_back(std::move(aheadFrame));
+		_renderDirty = GifRegion();
+	}
+}
+
+//enough frames in hand to cover however many delays a composite takes, plus one spare
+void GiflibImageDecoder::UpdateAheadDepth(double compositeMs, uint32_t frameDelay)
+{
+	_compositeCostMs = _compositeCostMs == 0 ? compositeMs : _compositeCostMs * 0.8 + compositeMs * 0.2;
+	auto depth = static_cast<size_t>(std::ceil(_compositeCostMs / std::max<uint32_t>(frameDelay, 1))) + 1;
+	//frames cost whatever tiles have been painted, which the producer's canvas is the best guide to
+	size_t frameBytes = _renderBytes;
+	size_t maxDepth = frameBytes > 0 ? MaxAheadBytes / frameBytes : MaxAheadDepth;
+	if (maxDepth > MaxAheadDepth)
+		maxDepth = MaxAheadDepth;
+	if (depth < MinAheadDepth)
+		depth = MinAheadDepth;
+	_aheadDepth = depth < maxDepth ? depth : (maxDepth > 0 ? maxDepth : 1);
+}
+
+void GiflibImageDecoder::Clock(std::shared_ptr<IAnimationClock> clock)
+{
+	_playbackClock.Source(clock != nullptr ? clock : RealClock::Instance());
+}
+
+void GiflibImageDecoder::PlaybackRate(double rate)
+{
+	_playbackClock.Rate(rate);
+}
+
+double GiflibImageDecoder::PlaybackRate() const
+{
+	return _playbackClock.Rate();
+}
+
+void GiflibImageDecoder::Pause()
+{
+	_playbackClock.Pause();
+}
+
+void GiflibImageDecoder::Play()
 {
+	_playbackClock.Resume();
+}
 
+bool GiflibImageDecoder::IsPaused() const
+{
+	return _playbackClock.IsPaused();
 }
 
+void GiflibImageDecoder::Policy(const GifPlaybackPolicy& policy)
+{
+	std::lock_guard<std::mutex> policyGuard(_policyMutex);
+	_policy = policy;
+}
+
+GifPlaybackPolicy GiflibImageDecoder::Policy() const
+{
+	std::lock_guard<std::mutex> policyGuard(_policyMutex);
+	return _policy;
+}
+
+GifPlaybackMetrics GiflibImageDecoder::PlaybackMetrics() const
+{
+	GifPlaybackMetrics metrics;
+	metrics.framesShown = _framesShown;
+	metrics.framesSkipped = _framesSkipped;
+	metrics.framesCapped = _framesCapped;
+	metrics.producerJumps = _producerJumps;
+	return metrics;
+}
+
+void GiflibImageDecoder::Suspend()
+{
+	_suspended = true;
+	auto decoder = shared_from_this();
+	DecodePool::Instance().Submit([decoder]()
+	{
+		//nothing to do if we were resumed before the pool got to it
+		if (!decoder->_suspended)
+			return;
+		decoder->ShedMemory(SuspendRasterWindow);
+		//a finished animation isn't ticked any more, so the frame it is holding on has to go here rather than in Advance
+		if (decoder->_animationReleased)
+			decoder->DropDisplayedFrame();
+		decoder->ReportDecodedBytes();
+	}, DecodePriority::Background);
+}
+
+//nothing is composited again until Resume, after which frames are rebuilt on demand from the nearest keyframe
 void GiflibImageDecoder::Resume()
 {
+	_suspended = false;
+	//a finished animation put away while suspended plays its end again, that composites the last frame and releases it
+	if (_animationReleased)
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		_producingAhead = false;
+		_animationReleased = false;
+	}
+}
+
+void GiflibImageDecoder::DropDisplayedFrame()
+{
+	std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+	std::lock_guard<std::mutex> displayGuard(_displayMutex);
+	_displayBuffer = nullptr;
+	_displayedFrame = -1;
+	_displayedSequence = -1;
+}
+
+//runs on the decode pool after Suspend or when DecodedMemoryBudget evicts us, keeps the compressed source and
+//frame index and drops whatever can be rebuilt from them, the frame on screen is left to Advance
+//keepRasters from where playback is are cheap to keep and save decoding them again straight after Resume
+void GiflibImageDecoder::ShedMemory(size_t keepRasters)
+{
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		_aheadFrames.clear();
+		_freeAheadBuffers.clear();
+		_aheadGeneration++;
+		if (!_producingAhead)
+		{
+			_renderBuffer = nullptr;
+			_renderBytes = 0;
+			_aheadFrame = 0;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> asyncGuard(_asyncMutex);
+		_asyncCanvas = nullptr;
+		_asyncBytes = 0;
+		_asyncFrame = 0;
+	}
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		_decodedPixels = DecodedPixels();
+		_sparePixels = DecodedPixels();
+	}
+
+	size_t keepFrom = static_cast<size_t>(_currentFrame.load());
+	std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+	_rasterBytes = 0;
+	for (size_t i = 0; i < _rasters.size(); i++)
+	{
+		if (_rasters[i].bits == nullptr)
+			continue;
+		if (i >= keepFrom && i < keepFrom + keepRasters)
+			_rasterBytes += _rasters[i].bytes;
+		else
+			_rasters[i] = GifRasterSlot();
+	}
+}
+
+//only asked when over budget, so everything goes, including the frame of a suspended view, which Advance would
+//otherwise hold on to until its next tick, a whole frame delay away
+size_t GiflibImageDecoder::EvictDecodedMemory()
+{
+	ShedMemory(0);
+	if (_suspended)
+		DropDisplayedFrame();
+	return DecodedBytes();
+}
+
+void GiflibImageDecoder::ReportDecodedBytes()
+{
+	auto bytes = DecodedBytes();
+	_stats.DecodedBytes(bytes);
+	DecodedMemoryBudget::Instance().Report(shared_from_this(), bytes);
+}
+
+static std::shared_ptr<const GifByteType> UnpackRaster(const GifRasterSlot& slot, size_t pixels)
+{
+	std::shared_ptr<GifByteType> raster(new GifByteType[pixels], std::default_delete<GifByteType[]>());
+	auto packed = slot.bits.get();
+	auto target = raster.get();
+	int depth = slot.bitsPerPixel;
+	int perByte = 8 / depth;
+	GifByteType mask = static_cast<GifByteType>((1 << depth) - 1);
+	for (size_t i = 0; i < pixels; i++)
+		target[i] = (packed[i / perByte] >> ((i % perByte) * depth)) & mask;
+	return raster;
+}
+
+//what gets kept of a freshly decoded raster depends on the strategy admission control has settled on
+GifRasterSlot GiflibImageDecoder::StoreRaster(std::unique_ptr<GifByteType[]> raster, size_t pixels, int bitsPerPixel, GifStorageStrategy strategy)
+{
+	GifRasterSlot slot;
+	if (raster == nullptr || strategy == GifStorageStrategy::Lazy || strategy == GifStorageStrategy::Downscaled || strategy == GifStorageStrategy::Refused)
+		return slot;
+
+	int depth = strategy == GifStorageStrategy::Packed ? GifPackedDepth(bitsPerPixel == 0 ? 8 : bitsPerPixel) : 8;
+	if (depth == 8)
+	{
+		slot.bits = std::shared_ptr<const GifByteType>(raster.release(), std::default_delete<GifByteType[]>());
+		slot.bytes = pixels;
+		return slot;
+	}
 
+	int perByte = 8 / depth;
+	slot.bytes = (pixels + perByte - 1) / perByte;
+	std::shared_ptr<GifByteType> packed(new GifByteType[slot.bytes], std::default_delete<GifByteType[]>());
+	memset(packed.get(), 0, slot.bytes);
+	GifByteType mask = static_cast<GifByteType>((1 << depth) - 1);
+	for (size_t i = 0; i < pixels; i++)
+		packed.get()[i / perByte] |= (raster[i] & mask) << ((i % perByte) * depth);
+	slot.bits = packed;
+	slot.bitsPerPixel = static_cast<uint8_t>(depth);
+	return slot;
 }
 
-void GiflibImageDecoder::LoadHandler(IBuffer^ buffer, bool finished, uint32_t expectedSize)
+//compositing reads rasters through here, anything not held decoded is unpacked or decoded again from _source
+std::shared_ptr<const GifByteType> GiflibImageDecoder::Raster(const GifFrameTable& frameTable, size_t frameIndex)
 {
+	auto& image = *frameTable.images[frameIndex];
+	auto pixels = static_cast<size_t>(image.ImageDesc.Width) * image.ImageDesc.Height;
+	GifRasterSlot slot;
+	{
+		std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+		if (frameIndex < _rasters.size())
+			slot = _rasters[frameIndex];
+	}
+	if (slot.bits != nullptr)
+		return slot.bitsPerPixel == 8 ? slot.bits : UnpackRaster(slot, pixels);
+
+	//decoded outside the lock so the producer and CompositeFrameInto don't wait on each other
+	auto decodeStart = _stats.Now();
+	auto raster = ReloadRasterBits(_source, image);
+	_stats.FrameDecoded(_stats.Now() - decodeStart);
+	auto strategy = _rasterStrategy.load();
+	if (strategy != GifStorageStrategy::Eager && strategy != GifStorageStrategy::Packed)
+		return std::shared_ptr<const GifByteType>(raster.release(), std::default_delete<GifByteType[]>());
+
+	auto& colorMap = (image.ImageDesc.ColorMap.Colors.size() != 0 ? image.ImageDesc.ColorMap : _gifFile->SColorMap);
+	slot = StoreRaster(std::move(raster), pixels, colorMap.BitsPerPixel, strategy);
+	{
+		std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+		if (frameIndex < _rasters.size() && _rasters[frameIndex].bits == nullptr && !_animationReleased)
+		{
+			_rasters[frameIndex] = slot;
+			_rasterBytes += slot.bytes;
+		}
+	}
+	return slot.bitsPerPixel == 8 ? slot.bits : UnpackRaster(slot, pixels);
+}
+
+//the canvas has to fit at some scale whatever the file holds, so that much is settled from the screen descriptor alone
+void GiflibImageDecoder::AdmitInitial()
+{
+	uint64_t imagePixels = static_cast<uint64_t>(_gifFile->SWidth) * _gifFile->SHeight;
+	GifAdmission admission;
+	admission.budgetBytes = DecodedMemoryBudget::Instance().Budget();
+	admission.strategy = GifStorageStrategy::Refused;
+	for (uint32_t scale = 1; scale <= MaxCanvasScale; scale *= 2)
+	{
+		uint64_t canvasBytes = static_cast<uint64_t>((_gifFile->SWidth + scale - 1) / scale) * ((_gifFile->SHeight + scale - 1) / scale) * sizeof(uint32_t);
+		//rasters are always decoded at full size, and the producer and the async path or CompositeFrameInto can each be decoding one
+		auto lazyBytes = AdmissionCanvasCount * canvasBytes + 2 * imagePixels;
+		if (lazyBytes <= admission.budgetBytes)
+		{
+			admission.strategy = scale == 1 ? GifStorageStrategy::Eager : GifStorageStrategy::Downscaled;
+			admission.canvasScale = scale;
+			admission.estimatedBytes = scale == 1 ? AdmissionCanvasCount * canvasBytes : lazyBytes;
+			break;
+		}
+	}
+
+	_minCanvasScale = static_cast<int>(admission.canvasScale);
+	_canvasScale = _minCanvasScale;
+	_renderScale = _minCanvasScale;
+	_asyncScale = _minCanvasScale;
+	_displayScale = _minCanvasScale;
+	_regionOfInterest = FullRegion();
+	_requestedRegion = GifRegion();
+	_renderRegion = _regionOfInterest;
+	_asyncRegion = _regionOfInterest;
+	_displayRegion = _regionOfInterest;
+	_renderDirty = _regionOfInterest;
+	_renderDirtyGeneration = 0;
+	_rasterStrategy = admission.strategy;
+	_gifFile->DecodeRasters = admission.strategy == GifStorageStrategy::Eager;
+	{
+		std::lock_guard<std::mutex> admissionGuard(_admissionMutex);
+		_admission = admission;
+	}
+	if (admission.strategy == GifStorageStrategy::Refused)
+		_readySource.set_exception(ref new Platform::OutOfMemoryException(L"gif is too large to decode within the decoded memory budget"));
+}
+
+//called with _loadMutex held before each chunk is parsed, moves to cheaper raster storage as the scan finds more frames
+void GiflibImageDecoder::Admit(uint32_t expectedSize)
+{
+	auto current = _rasterStrategy.load();
+	if (current != GifStorageStrategy::Eager && current != GifStorageStrategy::Packed)
+		return;
+
+	ScanGifStructure(_source, _scan);
+	uint64_t frames = _scan.ImageCount;
+	uint64_t rasterBytes = _scan.RasterPixels;
+	uint64_t packedBytes = _scan.PackedRasterBytes;
+	//assume the rest of the file looks like what we've seen so far
+	if (!_scan.Finished && _scan.Position > 0 && expectedSize > _scan.Position)
+	{
+		frames = frames * expectedSize / _scan.Position;
+		rasterBytes = rasterBytes * expectedSize / _scan.Position;
+		packedBytes = packedBytes * expectedSize / _scan.Position;
+	}
+
+	auto budget = DecodedMemoryBudget::Instance().Budget();
+	//the finest the canvas can get, zooming out only makes it cheaper
+	uint64_t canvasSet = AdmissionCanvasCount * static_cast<uint64_t>(CanvasWidth(_minCanvasScale)) * CanvasHeight(_minCanvasScale) * sizeof(uint32_t);
+	GifStorageStrategy strategy;
+	uint64_t estimate;
+	if (current == GifStorageStrategy::Eager && canvasSet + rasterBytes <= budget)
+	{
+		strategy = GifStorageStrategy::Eager;
+		estimate = canvasSet + rasterBytes;
+	}
+	else if (canvasSet + packedBytes + _scan.LargestRaster <= budget)
+	{
+		//plus one raster unpacked for compositing
+		strategy = GifStorageStrategy::Packed;
+		estimate = canvasSet + packedBytes + _scan.LargestRaster;
+	}
+	else
+	{
+		strategy = GifStorageStrategy::Lazy;
+		estimate = canvasSet + 2 * static_cast<uint64_t>(_gifFile->SWidth) * _gifFile->SHeight;
+	}
+
+	{
+		std::lock_guard<std::mutex> admissionGuard(_admissionMutex);
+		_admission.strategy = strategy;
+		_admission.estimatedBytes = estimate;
+		_admission.budgetBytes = budget;
+		_admission.projectedFrames = static_cast<uint32_t>(frames);
+	}
+	if (strategy == current)
+		return;
+
+	//new rasters go straight into the new form, then whatever is already held is converted
+	_rasterStrategy = strategy;
+	_gifFile->DecodeRasters = strategy != GifStorageStrategy::Lazy;
+	if (strategy == GifStorageStrategy::Lazy)
+	{
+		std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+		for (auto& slot : _rasters)
+			slot = GifRasterSlot();
+		_rasterBytes = 0;
+		return;
+	}
+
+	auto frameTable = FrameTable();
+	for (size_t i = 0; i < frameTable->images.size(); i++)
+	{
+		GifRasterSlot slot;
+		{
+			std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+			if (i < _rasters.size())
+				slot = _rasters[i];
+		}
+		if (slot.bits == nullptr || slot.bitsPerPixel != 8)
+			continue;
+
+		auto& image = *frameTable->images[i];
+		auto pixels = static_cast<size_t>(image.ImageDesc.Width) * image.ImageDesc.Height;
+		std::unique_ptr<GifByteType[]> copy(new GifByteType[pixels]);
+		memcpy(copy.get(), slot.bits.get(), pixels);
+		auto& colorMap = (image.ImageDesc.ColorMap.Colors.size() != 0 ? image.ImageDesc.ColorMap : _gifFile->SColorMap);
+		auto packed = StoreRaster(std::move(copy), pixels, colorMap.BitsPerPixel, strategy);
+		std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+		if (_rasters[i].bits == slot.bits)
+		{
+			_rasterBytes = _rasterBytes - slot.bytes + packed.bytes;
+			_rasters[i] = packed;
+		}
+	}
+}
+
+GifAdmission GiflibImageDecoder::Admission() const
+{
+	std::lock_guard<std::mutex> admissionGuard(_admissionMutex);
+	return _admission;
+}
+
+bool GiflibImageDecoder::DisplayIndexed()
+{
+	std::lock_guard<std::mutex> displayGuard(_displayMutex);
+	return _displayBuffer != nullptr && _displayBuffer->Indexed();
+}
+
+size_t GiflibImageDecoder::DecodedBytes()
+{
+	//the producer and async canvases are counted from what their owners last published rather than racing them for the pointer
+	size_t bytes = _renderBytes + _asyncBytes;
+	{
+		std::lock_guard<std::mutex> aheadGuard(_aheadMutex);
+		for (auto& aheadFrame : _aheadFrames)
+			bytes += aheadFrame.pixels->Bytes();
+		for (auto& freeBuffer : _freeAheadBuffers)
+			bytes += freeBuffer->Bytes();
+	}
+	{
+		std::lock_guard<std::mutex> displayGuard(_displayMutex);
+		if (_displayBuffer != nullptr)
+			bytes += _displayBuffer->Bytes();
+		if (_backgroundTile != nullptr)
+			bytes += GifCanvas::TileBytes;
+	}
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		bytes += (_decodedPixels.pixels.capacity() + _sparePixels.pixels.capacity()) * sizeof(uint32_t);
+	}
+	std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+	return bytes + _rasterBytes;
+}
+
+task<void> GiflibImageDecoder::LoadHandler(IBuffer^ buffer, bool finished, uint32_t expectedSize)
+{
+	if (buffer != nullptr)
+		_stats.BytesReceived(buffer->Length);
+	bool startWorker = false;
+	auto admitted = _chunkQueue.Push(buffer, finished, expectedSize, startWorker);
+	if (startWorker)
+		SubmitDecodeWorker();
+	return admitted;
+}
+
+//no cancellation token on the pool job, the worker has to keep releasing chunks or the loader would wait forever
+//once canceled it just drops them without parsing
+void GiflibImageDecoder::SubmitDecodeWorker()
+{
+	auto decoder = shared_from_this();
+	DecodePool::Instance().Submit([decoder]() { decoder->RunDecodeWorker(); }, _suspended ? DecodePriority::Background : DecodePriority::Visible);
+}
+
+//the next chunk queues behind every other decoder's, so a long download takes turns instead of keeping the worker
+void GiflibImageDecoder::ResubmitDecodeWorker()
+{
+	auto decoder = shared_from_this();
+	DecodePool::Instance().Resubmit([decoder]() { decoder->RunDecodeWorker(); }, _suspended ? DecodePriority::Background : DecodePriority::Visible);
+}
+
+//only one of these runs per decoder at a time, ChunkQueue hands the worker role over
+//a chunk per pool job so a big download can't hog a worker while other images are waiting
+void GiflibImageDecoder::RunDecodeWorker()
+{
+	ChunkQueue::Chunk chunk;
+	if (_chunkQueue.Pop(chunk))
+	{
+		if (!_cancelToken.is_canceled())
+			ProcessChunk(chunk.buffer, chunk.finished, chunk.expectedSize);
+		_chunkQueue.Release(chunk);
+		ResubmitDecodeWorker();
+	}
+}
+
+void GiflibImageDecoder::ProcessChunk(IBuffer^ buffer, bool finished, uint32_t expectedSize)
+{
+	GIF_TRACE_SCOPE_VALUE("ProcessChunk", buffer != nullptr ? buffer->Length : 0);
 	try
 	{
-		std::lock_guard<std::mutex> readGuard(_loadMutex);
+		auto readGuard = _stats.Lock(_loadMutex);
+		bool isLoaded = FrameTable()->isLoaded;
+		//refused in the constructor, Ready() has already failed and nothing gets parsed
+		if (_rasterStrategy == GifStorageStrategy::Refused)
+			return;
 
-    _loaderData.addData(buffer);
+		if (buffer != nullptr && _loaderData.addData(buffer))
+			_source.append(buffer);
+		Admit(expectedSize);
 
 		if (_loaderData.buffer.size() == 0)
 			return;
 
+		auto slurpStart = _stats.Now();
+		auto imagesBefore = _gifFile->SavedImages.size();
+		auto tableBefore = FrameTable();
+		auto tableImagesBefore = tableBefore->images.size();
+		auto mergedBefore = tableBefore->mergedExtensions.size();
 		try
 		{
 			_gifFile->Slurp(_loaderData);
-			_isLoaded = true;
+			isLoaded = true;
 			_loaderData.buffer.clear();
 		}
+		catch (GifCanceledException&)
+		{
+			//nobody is waiting on this image any more, whatever is queued gets dropped by the worker
+			_loaderData.buffer.clear();
+			return;
+		}
 		catch (...)
 		{
 			if (finished)
 			{
-				_isLoaded = true;
+				isLoaded = true;
 				_loaderData.finishedLoad = true;
 				_loaderData.buffer.clear();
 			}
 		}
+		//rasters decoded during parsing can't be timed one by one, so the parse is shared out between them
+		auto imagesParsed = _gifFile->SavedImages.size() - imagesBefore;
+		if (_gifFile->DecodeRasters && imagesParsed > 0)
+		{
+			auto perImage = (_stats.Now() - slurpStart) / static_cast<ClockTicks>(imagesParsed);
+			for (size_t i = 0; i < imagesParsed; i++)
+				_stats.FrameDecoded(perImage);
+		}
 
-		LoadGifFrames(_gifFile, _frames);
+		LoadGifFrames(_gifFile, isLoaded);
+		TrimSource(tableImagesBefore, mergedBefore, isLoaded);
+		//only once the frames are published, so whoever sees the whole file parsed can composite every frame in it
+		_stats.BytesParsed(_loaderData.tell());
+		ReportDecodedBytes();
 
-		if (_frames.size() > 0)
+		if (FrameTable()->frames.size() > 0)
 			_readySource.set();
 	}
 	catch (Platform::Exception^ ex)
@@ -240,38 +1393,328 @@ void GiflibImageDecoder::LoadHandler(IBuffer^ buffer, bool finished, uint32_t ex
 }
 
 
-void GiflibImageDecoder::MapRasterBits(uint8_t* rasterBits, std::unique_ptr<uint32_t[]>& targetFrame, ColorMapObject& colorMap, int top, int left, int bottom, int right, int width, int32_t transparencyColor)
+//called with _loadMutex held after each parse, copies out what will be read again and lets go of the chunks behind it
+//merged frames are never composited so only the rasters that made it into the table are kept
+void GiflibImageDecoder::TrimSource(size_t imagesBefore, size_t mergedBefore, bool isLoaded)
 {
-	int i = 0;
-	for (int y = top; y < bottom; y++)
+	auto frameTable = FrameTable();
+	auto retainExtensions = _retainExtensions.load();
+	for (auto i = imagesBefore; i < frameTable->images.size(); i++)
+	{
+		auto& image = *frameTable->images[i];
+		if (retainExtensions)
+		{
+			for (auto& extension : image.ExtensionBlocks)
+				_source.retain(extension.Offset, extension.Length);
+		}
+		_source.retain(image.RasterOffset, image.RasterLength);
+	}
+	if (retainExtensions)
 	{
-		for (int x = left; x < right; x++)
+		for (auto i = mergedBefore; i < frameTable->mergedExtensions.size(); i++)
+			_source.retain(frameTable->mergedExtensions[i].Offset, frameTable->mergedExtensions[i].Length);
+		if (isLoaded)
 		{
-			int offset = y * width + x;
-			uint8_t index = rasterBits[i];
+			for (auto& extension : _gifFile->ExtensionBlocks)
+				_source.retain(extension.Offset, extension.Length);
+		}
+	}
+
+	//the scan stops once admission has settled on lazy or downscaled storage, until then it may still need what the parser has passed
+	auto released = _loaderData.tell();
+	auto strategy = _rasterStrategy.load();
+	if ((strategy == GifStorageStrategy::Eager || strategy == GifStorageStrategy::Packed) && !_scan.Finished && _scan.Position < released)
+		released = _scan.Position;
+	_source.release_before(released);
+}
+
+void GiflibImageDecoder::RetainExtensionBytes(bool retain)
+{
+	_retainExtensions = retain;
+}
+
+std::vector<ExtensionBlock> GiflibImageDecoder::Extensions()
+{
+	std::lock_guard<std::mutex> loadGuard(_loadMutex);
+	auto frameTable = FrameTable();
+	std::vector<ExtensionBlock> extensions;
+	for (auto& image : frameTable->images)
+		extensions.insert(extensions.end(), image->ExtensionBlocks.begin(), image->ExtensionBlocks.end());
+	for (auto& extension : frameTable->mergedExtensions)
+		extensions.push_back(extension);
+	extensions.insert(extensions.end(), _gifFile->ExtensionBlocks.begin(), _gifFile->ExtensionBlocks.end());
+	return extensions;
+}
 
-			if (transparencyColor == -1 ||
-				transparencyColor != index)
+std::vector<GifByteType> GiflibImageDecoder::ExtensionBytes(const ExtensionBlock& extension)
+{
+	std::lock_guard<std::mutex> readGuard(_loadMutex);
+	std::vector<GifByteType> bytes;
+	MaterializeExtension(_source, extension, bytes);
+	return bytes;
+}
+
+//the expansion table for an indexed canvas, the background needs an entry that expands to exactly what LoadGifFrame
+//clears a BGRA canvas to, either a spare slot past the end of the color map or a color that already matches it
+//nullptr when neither exists and canvases stay BGRA
+std::shared_ptr<const GifCanvasPalette> GiflibImageDecoder::IndexedPalette(const ColorMapObject& colorMap, int backgroundColor)
+{
+	auto colorCount = colorMap.Colors.size();
+	if (colorCount == 0)
+		return nullptr;
+
+	auto palette = std::make_shared<GifCanvasPalette>();
+	memset(palette->colors, 0, sizeof(palette->colors));
+	for (size_t i = 0; i < colorCount && i < 256; i++)
+		memcpy(&palette->colors[i], &colorMap.Colors[i], sizeof(uint32_t));
+
+	bgraColor bgColor = { 0, 0, 0, 0 };
+	if (backgroundColor > 0 && static_cast<size_t>(backgroundColor) < colorCount)
+	{
+		auto& color = colorMap.Colors[backgroundColor];
+		bgColor.red = color.Red;
+		bgColor.green = color.Green;
+		bgColor.blue = color.Blue;
+		bgColor.alpha = 255;
+	}
+	uint32_t background;
+	memcpy(&background, &bgColor, sizeof(uint32_t));
+
+	if (colorCount < 256)
+	{
+		palette->background = static_cast<uint8_t>(colorCount);
+		palette->colors[colorCount] = background;
+		return palette;
+	}
+	for (int i = 0; i < 256; i++)
+	{
+		if (palette->colors[i] == background)
+		{
+			palette->background = static_cast<uint8_t>(i);
+			return palette;
+		}
+	}
+	return nullptr;
+}
+
+//FNV-1a, only used to turn most non matching frames away before IsNoOpFrame compares rasters
+uint64_t GiflibImageDecoder::FingerprintFrame(const SavedImage& image, const ColorMapObject& colorMap, int32_t transparentColor)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](const void* data, size_t length)
+	{
+		auto bytes = reinterpret_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+	auto& desc = image.ImageDesc;
+	int32_t rect[4] = { desc.Left, desc.Top, desc.Width, desc.Height };
+	mix(rect, sizeof(rect));
+	mix(&transparentColor, sizeof(transparentColor));
+	if (colorMap.Colors.size() != 0)
+		mix(colorMap.Colors.data(), colorMap.Colors.size() * sizeof(GifColorType));
+	if (image.RasterBits != nullptr)
+		mix(image.RasterBits.get(), static_cast<size_t>(desc.Width) * desc.Height);
+	return hash;
+}
+
+//a frame has no visible effect if every pixel is transparent, or if it redraws exactly what the previous entry drew
+//anything that clears to the background first changes the canvas, whatever it draws
+bool GiflibImageDecoder::IsNoOpFrame(const SavedImage& image, const ColorMapObject& colorMap, const GifFrame& frame,
+	const SavedImage& previousImage, const GifByteType* previousRaster, const ColorMapObject& previousColorMap, const GifFrame& previousFrame)
+{
+	if (frame.disposal == DISPOSAL_METHODS::DM_BACKGROUND || image.RasterBits == nullptr)
+		return false;
+
+	auto pixelCount = static_cast<size_t>(image.ImageDesc.Width) * image.ImageDesc.Height;
+	if (frame.transparentColor != -1)
+	{
+		auto raster = image.RasterBits.get();
+		auto transparentIndex = static_cast<GifByteType>(frame.transparentColor);
+		size_t i = 0;
+		for (; i < pixelCount && raster[i] == transparentIndex; i++);
+		if (i == pixelCount)
+			return true;
+	}
+
+	return frame.fingerprint == previousFrame.fingerprint &&
+		frame.transparentColor == previousFrame.transparentColor &&
+		frame.left == previousFrame.left && frame.top == previousFrame.top &&
+		frame.right == previousFrame.right && frame.bottom == previousFrame.bottom &&
+		previousRaster != nullptr &&
+		colorMap.Colors.size() == previousColorMap.Colors.size() &&
+		(colorMap.Colors.size() == 0 || memcmp(colorMap.Colors.data(), previousColorMap.Colors.data(), colorMap.Colors.size() * sizeof(GifColorType)) == 0) &&
+		memcmp(image.RasterBits.get(), previousRaster, pixelCount) == 0;
+}
+
+void GiflibImageDecoder::MapRasterBits(const uint8_t* rasterBits, int rasterWidth, int rasterLeft, int rasterTop, GifCanvas& target, const ColorMapObject& colorMap,
+	int top, int left, int bottom, int right, int imageWidth, int imageHeight, int scale, int32_t transparencyColor)
+{
+	if (target.Indexed())
+	{
+		//only ever at full scale with the global color map, the palette lookup waits until the pixels are copied out
+		ForEachBand(top, bottom, right - left, [&](int bandTop, int bandBottom)
+		{
+			for (int y = bandTop; y < bandBottom; y++)
 			{
-				auto colorTarget = reinterpret_cast<GifColorType*>(targetFrame.get() + offset);
-				*colorTarget = colorMap.Colors[index];
+				int rowStart = (y - rasterTop) * rasterWidth - rasterLeft;
+				uint8_t* span = nullptr;
+				int spanLeft = 0;
+				int spanRight = 0;
+				for (int x = left; x < right; x++)
+				{
+					uint8_t index = rasterBits[rowStart + x];
+					if (transparencyColor != -1 && transparencyColor == index)
+						continue;
+					if (span == nullptr || x >= spanRight)
+					{
+						span = target.IndexForWrite(x, y);
+						spanLeft = x;
+						spanRight = (x / GifCanvas::TileSize + 1) * GifCanvas::TileSize;
+					}
+					span[x - spanLeft] = index;
+				}
 			}
-			i++;
-		}
+		});
+		return;
+	}
+
+	if (scale == 1)
+	{
+		ForEachBand(top, bottom, right - left, [&](int bandTop, int bandBottom)
+		{
+			for (int y = bandTop; y < bandBottom; y++)
+			{
+				int rowStart = (y - rasterTop) * rasterWidth - rasterLeft;
+				//a tile is only looked up, and so only allocated, once something opaque lands in it
+				uint32_t* span = nullptr;
+				int spanLeft = 0;
+				int spanRight = 0;
+				for (int x = left; x < right; x++)
+				{
+					uint8_t index = rasterBits[rowStart + x];
+
+					if (transparencyColor == -1 ||
+						transparencyColor != index)
+					{
+						if (span == nullptr || x >= spanRight)
+						{
+							span = target.PixelForWrite(x, y);
+							spanLeft = x;
+							spanRight = (x / GifCanvas::TileSize + 1) * GifCanvas::TileSize;
+						}
+						auto colorTarget = reinterpret_cast<GifColorType*>(span + (x - spanLeft));
+						*colorTarget = colorMap.Colors[index];
+					}
+				}
+			}
+		});
+		return;
 	}
+
+	//a box filter fused with the palette lookup, each canvas pixel averages the block of image pixels it covers
+	//transparent pixels and the part of the block outside the frame let what was already there show through in proportion
+	int canvasLeft = left / scale;
+	int canvasRight = (right + scale - 1) / scale;
+	ForEachBand(top / scale, (bottom + scale - 1) / scale, (canvasRight - canvasLeft) * scale * scale, [&](int bandTop, int bandBottom)
+	{
+		for (int canvasY = bandTop; canvasY < bandBottom; canvasY++)
+		{
+			int blockTop = canvasY * scale;
+			int blockBottom = min(blockTop + scale, imageHeight);
+			int drawTop = max(blockTop, top);
+			int drawBottom = min(blockBottom, bottom);
+			for (int canvasX = canvasLeft; canvasX < canvasRight; canvasX++)
+			{
+				int blockLeft = canvasX * scale;
+				int blockRight = min(blockLeft + scale, imageWidth);
+				int drawLeft = max(blockLeft, left);
+				int drawRight = min(blockRight, right);
+				uint32_t blue = 0, green = 0, red = 0, alpha = 0, covered = 0;
+				for (int y = drawTop; y < drawBottom; y++)
+				{
+					int rowStart = (y - rasterTop) * rasterWidth - rasterLeft;
+					for (int x = drawLeft; x < drawRight; x++)
+					{
+						uint8_t index = rasterBits[rowStart + x];
+						if (transparencyColor != -1 && transparencyColor == index)
+							continue;
+						auto& color = colorMap.Colors[index];
+						blue += color.Blue;
+						green += color.Green;
+						red += color.Red;
+						alpha += color.Alpha;
+						covered++;
+					}
+				}
+				if (covered == 0)
+					continue;
+
+				uint32_t blockPixels = (blockBottom - blockTop) * (blockRight - blockLeft);
+				uint32_t uncovered = blockPixels - covered;
+				auto colorTarget = reinterpret_cast<GifColorType*>(target.PixelForWrite(canvasX, canvasY));
+				colorTarget->Blue = static_cast<GifByteType>((blue + uncovered * colorTarget->Blue + blockPixels / 2) / blockPixels);
+				colorTarget->Green = static_cast<GifByteType>((green + uncovered * colorTarget->Green + blockPixels / 2) / blockPixels);
+				colorTarget->Red = static_cast<GifByteType>((red + uncovered * colorTarget->Red + blockPixels / 2) / blockPixels);
+				colorTarget->Alpha = static_cast<GifByteType>((alpha + uncovered * colorTarget->Alpha + blockPixels / 2) / blockPixels);
+			}
+		}
+	});
 }
 
-GiflibImageDecoder::GiflibImageDecoder(IBuffer^ initialBuffer, cancellation_token canceledToken) : _loaderData(canceledToken), _cancelToken(canceledToken)
+GiflibImageDecoder::GiflibImageDecoder(IBuffer^ initialBuffer, cancellation_token canceledToken) : _chunkQueue(MaxQueuedBytes), _loaderData(canceledToken), _cancelToken(canceledToken), _playbackClock(RealClock::Instance())
 {
 	_currentFrame = 0;
-	_lastFrame = 0;
+	_msUntilNextFrame = 0;
+	_aheadFrame = 0;
+	_compositeCostMs = 0;
+	QueryPerformanceFrequency(&_counterFrequency);
+	_aheadDepth = MinAheadDepth;
+	_aheadNextSequence = 0;
+	_lastEmittedStart = 0;
+	_hasEmitted = false;
+	_currentSequence = 0;
+	_displayedSequence = -1;
+	_displayedAt = 0;
+	_canvasInvalidated = false;
+	_framesShown = 0;
+	_framesSkipped = 0;
+	_framesCapped = 0;
+	_producerJumps = 0;
+	_aheadGeneration = 0;
+	_producingAhead = false;
+	_displayVersion = 0;
+	_displayedFrame = -1;
+	_playbackFinished = false;
+	_animationReleased = false;
+	_playbackStart = 0;
+	_intoPixels = nullptr;
+	_intoStride = 0;
+	_intoRegion = GifRegion();
+	_intoFrame = 0;
+	_asyncQueue = make_shared<AsyncDecodeQueue>(canceledToken);
+	_asyncFrame = 0;
+	_renderBytes = 0;
+	_asyncBytes = 0;
+	_rasterBytes = 0;
+	_retainExtensions = false;
 	_loaderData.init(0, initialBuffer);
-	_gifFile = make_unique<GifFileType<gif_user_data>>(_loaderData);
+	_source.append(initialBuffer);
+	_gifFile = make_unique<GifFileType<gif_user_data>>(_loaderData, &_parseArena);
+	AdmitInitial();
 	_renderBuffer = nullptr;
+	_frameTable = make_shared<GifFrameTable>();
 	_loaderData;
-	_isLoaded = false;
 	_startedRendering = false;
-	_timer = ref new BasicTimer();
+	_suspended = false;
+}
+
+GiflibImageDecoder::~GiflibImageDecoder()
+{
+	DecodedMemoryBudget::Instance().Remove(this);
 }
 
 std::shared_ptr<IImageDecoder> GiflibImageDecoder::MakeImageDecoder(IBuffer^ initialBuffer, cancellation_token canceledToken)
@@ -0,0 +1,139 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "DecodePool.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	typedef std::chrono::steady_clock SteadyClock;
+
+	static double Milliseconds(SteadyClock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	//stands in for parsing a chunk, sleeping would let the pool run everything at once and hide the ordering
+	static void Spin(std::chrono::microseconds duration)
+	{
+		auto until = SteadyClock::now() + duration;
+		while (SteadyClock::now() < until)
+		{
+		}
+	}
+
+	//a job that runs slices one at a time and resubmits itself after each, the way a decoder's worker takes chunks
+	struct SlicedStream
+	{
+		int slicesLeft;
+		SteadyClock::time_point finished;
+	};
+
+	TEST_CLASS(DecodePoolTests)
+	{
+	public:
+		TEST_METHOD(ResubmittedStreamsTakeTurns)
+		{
+			const int streamCount = 100;
+			const int slices = 20;
+			auto& pool = DecodePool::Instance();
+			std::vector<SlicedStream> streams(streamCount, SlicedStream{ slices, SteadyClock::time_point() });
+			std::mutex doneMutex;
+			std::condition_variable doneChanged;
+			int running = streamCount;
+			//held until every stream is queued, otherwise the first ones get a head start while the rest are submitted
+			std::atomic<bool> released(false);
+
+			std::function<void(int)> runSlice = [&](int stream)
+			{
+				while (!released)
+					std::this_thread::yield();
+				Spin(std::chrono::microseconds(200));
+				if (--streams[stream].slicesLeft > 0)
+				{
+					pool.Resubmit([&runSlice, stream]() { runSlice(stream); }, DecodePriority::Background);
+					return;
+				}
+				streams[stream].finished = SteadyClock::now();
+				std::lock_guard<std::mutex> doneGuard(doneMutex);
+				if (--running == 0)
+					doneChanged.notify_all();
+			};
+
+			auto start = SteadyClock::now();
+			for (int stream = 0; stream < streamCount; stream++)
+				pool.Submit([&runSlice, stream]() { runSlice(stream); }, DecodePriority::Background);
+			released = true;
+			{
+				std::unique_lock<std::mutex> doneLock(doneMutex);
+				doneChanged.wait(doneLock, [&]() { return running == 0; });
+			}
+			auto elapsed = Milliseconds(SteadyClock::now() - start);
+
+			double firstFinish = elapsed;
+			for (auto& stream : streams)
+				firstFinish = std::min(firstFinish, Milliseconds(stream.finished - start));
+
+			wchar_t message[160];
+			swprintf_s(message, L"%d streams of %d slices on %d workers in %.1fms, first stream done at %.1fms",
+				streamCount, slices, static_cast<int>(pool.WorkerCount()), elapsed, firstFinish);
+			Logger::WriteMessage(message);
+			//taking turns means every stream is on its last slices at the end, a worker that kept its own stream
+			//would finish one after slices * 0.2ms
+			Assert::IsTrue(firstFinish > elapsed * 0.6, message);
+		}
+
+		TEST_METHOD(HundredGifStreamsShareThePool)
+		{
+			//every chunk is queued up front, so how the streams finish is down to the pool rather than the download
+			const int streamCount = 100;
+			const size_t chunkSize = 4096;
+			auto bytes = TestGifs::Animation(160, 120, 40, 4);
+
+			auto start = SteadyClock::now();
+			std::vector<std::shared_ptr<GiflibImageDecoder>> decoders;
+			for (int stream = 0; stream < streamCount; stream++)
+				decoders.push_back(TestGifs::MakeDecoder(bytes, chunkSize));
+			for (size_t offset = chunkSize; offset < bytes.size(); offset += chunkSize)
+			{
+				auto count = std::min(chunkSize, bytes.size() - offset);
+				for (auto& decoder : decoders)
+					decoder->LoadHandler(TestGifs::MakeBuffer(bytes.data() + offset, count), offset + count == bytes.size(), static_cast<uint32_t>(bytes.size()));
+			}
+
+			std::vector<double> finished(streamCount, -1.0);
+			for (int done = 0; done < streamCount;)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				for (int stream = 0; stream < streamCount; stream++)
+				{
+					if (finished[stream] < 0 && decoders[stream]->Stats().bytesParsed >= bytes.size())
+					{
+						finished[stream] = Milliseconds(SteadyClock::now() - start);
+						done++;
+					}
+				}
+			}
+			auto elapsed = *std::max_element(finished.begin(), finished.end());
+			auto firstFinish = *std::min_element(finished.begin(), finished.end());
+
+			uint64_t frames = 0;
+			for (auto& decoder : decoders)
+				frames += decoder->Stats().framesDecoded;
+			wchar_t message[192];
+			swprintf_s(message, L"%d streams, %.1fMB and %llu frames in %.1fms (%.1fMB/s), first stream done at %.1fms",
+				streamCount, bytes.size() * streamCount / 1048576.0, static_cast<unsigned long long>(frames), elapsed,
+				bytes.size() * streamCount / 1048576.0 / (elapsed / 1000), firstFinish);
+			Logger::WriteMessage(message);
+
+			Assert::AreEqual(static_cast<uint64_t>(40 * streamCount), frames);
+			Assert::IsTrue(firstFinish > elapsed * 0.5, message);
+		}
+	};
+}
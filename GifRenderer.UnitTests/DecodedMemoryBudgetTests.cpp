@@ -0,0 +1,181 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "DecodedMemoryBudget.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	//makes the calls D2DRenderer makes on its decoder and the budget when it draws, ticks, suspends and resumes,
+	//with a HeadlessFrameSink where the bitmap would be and the scheduler's bookkeeping done by hand
+	struct SimulatedView
+	{
+		std::shared_ptr<GiflibImageDecoder> decoder;
+		HeadlessFrameSink sink;
+		bool suspended;
+		bool ticking;
+		bool shown;
+		ClockTicks due;
+
+		void Draw(ClockTicks now)
+		{
+			auto& budget = DecodedMemoryBudget::Instance();
+			budget.Touch(decoder.get());
+			bool requeue = false;
+			auto size = decoder->MaxSize();
+			auto drawn = decoder->DecodeRectangle(Windows::Foundation::Rect(0, 0, size.Width, size.Height), sink, requeue);
+			shown = shown || drawn.Width > 0;
+			if (requeue && !ticking)
+			{
+				ticking = true;
+				due = now;
+			}
+			else if (!requeue && !suspended)
+			{
+				budget.Touch(decoder.get(), DecodedMemoryBudget::UntilHidden);
+			}
+		}
+
+		void Tick(ClockTicks now)
+		{
+			ClockTicks nextDelay = 0;
+			bool changed = decoder->Advance(nextDelay);
+			if (!suspended)
+				DecodedMemoryBudget::Instance().Touch(decoder.get(), nextDelay >= 0 ? nextDelay + DecodedMemoryBudget::VisibleGrace : DecodedMemoryBudget::UntilHidden);
+			ticking = nextDelay >= 0;
+			due = now + nextDelay;
+			if (changed && !suspended)
+				Draw(now);
+		}
+
+		void Suspend()
+		{
+			suspended = true;
+			DecodedMemoryBudget::Instance().Hide(decoder.get());
+			decoder->Suspend();
+		}
+
+		void Resume(ClockTicks now)
+		{
+			suspended = false;
+			shown = false;
+			DecodedMemoryBudget::Instance().Touch(decoder.get());
+			decoder->Resume();
+			Draw(now);
+		}
+	};
+
+	static uint64_t EvictionsOf(const std::vector<DecodedMemoryBudget::Usage>& usages, const IDecodedMemoryOwner* owner)
+	{
+		for (auto& usage : usages)
+		{
+			if (usage.owner == owner)
+				return usage.evictions;
+		}
+		return 0;
+	}
+
+	TEST_CLASS(DecodedMemoryBudgetTests)
+	{
+	public:
+		TEST_METHOD(ScrollingTwoHundredGifsStaysInBudget)
+		{
+			//a feed of gifs scrolled past a window a dozen high, a third with frames seconds apart, a third that play
+			//twice and stop, the rest looping quickly, nothing on screen should be evicted whatever it's doing
+			const int gifCount = 200;
+			const int window = 12;
+			//a little over what the dozen on screen hold between them, so everything off screen has to go
+			const size_t cap = 3328 * 1024;
+			const ClockTicks step = 20 * TicksPerMillisecond;
+			const ClockTicks scrollEvery = 500 * TicksPerMillisecond;
+			std::vector<std::vector<uint8_t>> kinds;
+			kinds.push_back(TestGifs::Animation(96, 64, 12, 300));
+			kinds.push_back(TestGifs::Animation(96, 64, 12, 10));
+			std::vector<TestGifs::Frame> onceFrames;
+			for (int i = 0; i < 12; i++)
+				onceFrames.push_back(TestGifs::PatternFrame(i == 0 ? 0 : i * 5, i == 0 ? 0 : i * 3, i == 0 ? 96 : 32, i == 0 ? 64 : 21, i, 10));
+			kinds.push_back(TestGifs::Write(96, 64, TestGifs::Palette(), onceFrames, 1));
+
+			auto& budget = DecodedMemoryBudget::Instance();
+			auto previousBudget = budget.Budget();
+			auto previousEvictions = budget.Evictions();
+			auto clock = std::make_shared<ManualClock>(TicksPerSecond);
+			budget.Clock(clock);
+			budget.Budget(cap);
+
+			std::vector<SimulatedView> views(gifCount);
+			for (int i = 0; i < gifCount; i++)
+			{
+				views[i].decoder = TestGifs::Load(kinds[i % kinds.size()], kinds[i % kinds.size()].size());
+				views[i].decoder->Clock(clock);
+				views[i].suspended = true;
+				views[i].ticking = false;
+				views[i].shown = false;
+				views[i].due = 0;
+			}
+			for (int i = 0; i < window; i++)
+				views[i].Resume(clock->Now());
+
+			int top = 0;
+			int evictedOnScreen = 0;
+			int neverShown = 0;
+			size_t worstSettled = 0;
+			auto nextScroll = clock->Now() + scrollEvery;
+			while (top + window < gifCount)
+			{
+				auto now = clock->Now();
+				auto before = budget.Usages();
+				for (auto& view : views)
+				{
+					if (view.ticking && view.due <= now)
+						view.Tick(now);
+				}
+
+				if (now >= nextScroll)
+				{
+					//evictions are pool jobs, give them a moment to land before holding the total to the cap
+					auto total = budget.TotalUsage();
+					for (int waited = 0; waited < 200 && total > cap; waited++)
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+						total = budget.TotalUsage();
+					}
+					worstSettled = std::max(worstSettled, total);
+					if (!views[top].shown)
+						neverShown++;
+					views[top].Suspend();
+					views[top + window].Resume(now);
+					top++;
+					nextScroll += scrollEvery;
+				}
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				auto after = budget.Usages();
+				for (int i = top; i < top + window; i++)
+				{
+					if (EvictionsOf(after, views[i].decoder.get()) != EvictionsOf(before, views[i].decoder.get()))
+						evictedOnScreen++;
+				}
+				clock->Advance(step);
+			}
+
+			wchar_t message[192];
+			swprintf_s(message, L"%d gifs, worst settled total %.2fMB against %.2fMB, %llu evictions, %d of them on screen, %d never shown",
+				gifCount, worstSettled / 1048576.0, cap / 1048576.0, static_cast<unsigned long long>(budget.Evictions() - previousEvictions), evictedOnScreen, neverShown);
+			Logger::WriteMessage(message);
+
+			views.clear();
+			budget.Budget(previousBudget);
+			budget.Clock(nullptr);
+
+			Assert::IsTrue(worstSettled <= cap, message);
+			Assert::AreEqual(0, evictedOnScreen, message);
+			Assert::AreEqual(0, neverShown, message);
+		}
+	};
+}
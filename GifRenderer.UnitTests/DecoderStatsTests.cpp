@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "DecoderStats.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	//LatencyHistogram promises a percentile within a fifth of the real value
+	static void AssertClose(ClockTicks expected, ClockTicks actual, const wchar_t* what)
+	{
+		wchar_t message[128];
+		swprintf_s(message, L"%s was %lld, expected %lld", what, static_cast<long long>(actual), static_cast<long long>(expected));
+		Assert::IsTrue(actual >= expected - expected / 5 && actual <= expected + expected / 5, message);
+	}
+
+	TEST_CLASS(DecoderStatsTests)
+	{
+	public:
+		TEST_METHOD(EmptyHistogramSummarisesToZero)
+		{
+			LatencyHistogram histogram;
+			auto summary = histogram.Summary();
+			Assert::AreEqual(static_cast<uint64_t>(0), summary.count);
+			Assert::AreEqual(static_cast<ClockTicks>(0), summary.p50);
+			Assert::AreEqual(static_cast<ClockTicks>(0), summary.p99);
+			Assert::AreEqual(static_cast<ClockTicks>(0), summary.max);
+		}
+
+		TEST_METHOD(SingleValueLandsInItsOwnBucket)
+		{
+			//a lone sample is every percentile, so what comes back is the middle of the bucket it went in, capped at the max,
+			//from the exact buckets at the bottom to well past an hour, and never smaller for a larger value
+			ClockTicks previous = 0;
+			for (ClockTicks ticks = 0; ticks < 10000 * TicksPerSecond; ticks = ticks < 8 ? ticks + 1 : ticks + ticks / 7)
+			{
+				LatencyHistogram histogram;
+				histogram.Record(ticks);
+				auto summary = histogram.Summary();
+				Assert::AreEqual(static_cast<uint64_t>(1), summary.count);
+				Assert::AreEqual(ticks, summary.max);
+				Assert::AreEqual(summary.p50, summary.p99);
+				if (ticks < 8)
+					Assert::AreEqual(ticks, summary.p50);
+				else
+					AssertClose(ticks, summary.p50, L"p50");
+				Assert::IsTrue(summary.p50 >= previous, L"a larger value went in a lower bucket");
+				previous = summary.p50;
+			}
+		}
+
+		TEST_METHOD(PercentilesOfUniformDistribution)
+		{
+			LatencyHistogram histogram;
+			for (int ms = 1; ms <= 1000; ms++)
+				histogram.Record(ms * TicksPerMillisecond);
+			auto summary = histogram.Summary();
+			Assert::AreEqual(static_cast<uint64_t>(1000), summary.count);
+			Assert::AreEqual(1000 * TicksPerMillisecond, summary.max);
+			AssertClose(500 * TicksPerMillisecond, summary.p50, L"p50");
+			AssertClose(990 * TicksPerMillisecond, summary.p99, L"p99");
+		}
+
+		TEST_METHOD(PercentilesOfSkewedDistribution)
+		{
+			//the 990th of 1000 samples is the p99, one slow sample more or less moves it from the fast group to the slow one
+			LatencyHistogram fastTail;
+			LatencyHistogram slowTail;
+			for (int i = 0; i < 1000; i++)
+			{
+				fastTail.Record((i < 990 ? 2 : 500) * TicksPerMillisecond);
+				slowTail.Record((i < 989 ? 2 : 500) * TicksPerMillisecond);
+			}
+			auto fast = fastTail.Summary();
+			auto slow = slowTail.Summary();
+			AssertClose(2 * TicksPerMillisecond, fast.p50, L"p50");
+			AssertClose(2 * TicksPerMillisecond, fast.p99, L"p99 with 10 slow samples");
+			AssertClose(2 * TicksPerMillisecond, slow.p50, L"p50");
+			AssertClose(500 * TicksPerMillisecond, slow.p99, L"p99 with 11 slow samples");
+			Assert::AreEqual(500 * TicksPerMillisecond, slow.max);
+		}
+
+		TEST_METHOD(ProcessCurrentBytesFollowsDecodersDownAsWellAsUp)
+		{
+			//the process total moves by the difference each time, which is a wrapped around unsigned add when a decoder
+			//sheds memory, other tests' decoders can still be reporting from the pool, so try again if the total moved under us
+			auto& process = DecoderStatsCounters::Process();
+			bool settled = false;
+			for (int attempt = 0; attempt < 100 && !settled; attempt++)
+			{
+				auto before = process.Snapshot().currentBytes;
+				size_t grown, shrunk, leftByFirst;
+				DecoderStats firstStats;
+				{
+					DecoderStatsCounters first;
+					{
+						DecoderStatsCounters second;
+						first.DecodedBytes(5000);
+						second.DecodedBytes(3000);
+						grown = process.Snapshot().currentBytes;
+						first.DecodedBytes(1000);
+						second.DecodedBytes(0);
+						shrunk = process.Snapshot().currentBytes;
+						second.DecodedBytes(2000);
+					}
+					leftByFirst = process.Snapshot().currentBytes;
+					firstStats = first.Snapshot();
+				}
+				if (process.Snapshot().currentBytes != before)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+				settled = true;
+				Assert::AreEqual(before + 8000, grown);
+				Assert::AreEqual(before + 1000, shrunk);
+				//destroying a decoder takes what it still held out of the total
+				Assert::AreEqual(before + 1000, leftByFirst);
+				Assert::AreEqual(static_cast<size_t>(1000), firstStats.currentBytes);
+				Assert::AreEqual(static_cast<size_t>(5000), firstStats.peakBytes);
+			}
+			Assert::IsTrue(settled, L"the process total never stayed still long enough to measure");
+		}
+	};
+}
@@ -0,0 +1,150 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "GifCanvas.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	static const uint32_t Background = 0xff204060;
+
+	//256 grays with index 3 as the background
+	static std::shared_ptr<const GifCanvasPalette> GrayPalette()
+	{
+		auto palette = std::make_shared<GifCanvasPalette>();
+		for (uint32_t i = 0; i < 256; i++)
+			palette->colors[i] = 0xff000000 | i << 16 | i << 8 | i;
+		palette->background = 3;
+		return palette;
+	}
+
+	TEST_CLASS(GifCanvasTests)
+	{
+	public:
+		TEST_METHOD(UnwrittenTilesReadAsBackground)
+		{
+			//one pixel written in the middle tile of a 3x3, everything else is never allocated and still has a color
+			const int size = GifCanvas::TileSize * 3;
+			GifCanvas canvas(size, size, Background);
+			GifCanvas indexed(size, size, GrayPalette());
+			*canvas.PixelForWrite(200, 150) = 0xff00ff00;
+			*indexed.IndexForWrite(200, 150) = 9;
+
+			std::vector<uint32_t> pixels(size * size);
+			std::vector<uint32_t> indexedPixels(size * size);
+			canvas.CopyTo(pixels.data(), size, 0, 0, size, size);
+			indexed.CopyTo(indexedPixels.data(), size, 0, 0, size, size);
+			for (int y = 0; y < size; y++)
+			{
+				for (int x = 0; x < size; x++)
+				{
+					bool written = x == 200 && y == 150;
+					if (pixels[y * size + x] != (written ? 0xff00ff00 : Background) || canvas.Pixel(x, y) != pixels[y * size + x] ||
+						indexedPixels[y * size + x] != (written ? 0xff090909 : 0xff030303) || indexed.Pixel(x, y) != indexedPixels[y * size + x])
+					{
+						wchar_t message[128];
+						swprintf_s(message, L"%d, %d reads back wrong", x, y);
+						Assert::Fail(message);
+					}
+				}
+			}
+			Assert::AreEqual(static_cast<size_t>(GifCanvas::TileBytes), canvas.Bytes());
+			Assert::AreEqual(static_cast<size_t>(GifCanvas::TilePixels), indexed.Bytes());
+		}
+
+		TEST_METHOD(BytesFollowThePaintedArea)
+		{
+			//the largest canvas a gif can ask for costs nothing until it's drawn on, then a tile per tile touched
+			GifCanvas canvas(65535, 65535, Background);
+			Assert::AreEqual(static_cast<size_t>(0), canvas.Bytes());
+			*canvas.PixelForWrite(0, 0) = 1;
+			*canvas.PixelForWrite(GifCanvas::TileSize - 1, GifCanvas::TileSize - 1) = 1;
+			Assert::AreEqual(static_cast<size_t>(GifCanvas::TileBytes), canvas.Bytes());
+			*canvas.PixelForWrite(65534, 65534) = 1;
+			Assert::AreEqual(2 * GifCanvas::TileBytes, canvas.Bytes());
+
+			//a 300x200 rectangle straddles 4x3 tiles
+			for (int y = 1000; y < 1200; y++)
+			{
+				for (int x = 1000; x < 1300; x++)
+					*canvas.PixelForWrite(x, y) = 2;
+			}
+			Assert::AreEqual(14 * GifCanvas::TileBytes, canvas.Bytes());
+		}
+
+		TEST_METHOD(ClearingWholeTilesFreesThem)
+		{
+			const int size = GifCanvas::TileSize * 3;
+			GifCanvas canvas(size, size, Background);
+			for (int y = 0; y < size; y += 8)
+			{
+				for (int x = 0; x < size; x += 8)
+					*canvas.PixelForWrite(x, y) = 0xffffffff;
+			}
+			Assert::AreEqual(9 * GifCanvas::TileBytes, canvas.Bytes());
+
+			//short of a whole tile only clears pixels
+			canvas.Clear(0, 0, GifCanvas::TileSize - 1, GifCanvas::TileSize);
+			Assert::AreEqual(9 * GifCanvas::TileBytes, canvas.Bytes());
+			Assert::AreEqual(Background, canvas.Pixel(0, 0));
+			Assert::AreEqual(0xffffffff, canvas.Pixel(GifCanvas::TileSize - 8, GifCanvas::TileSize + 8));
+
+			//the middle tile exactly, then the right hand column running off the canvas
+			canvas.Clear(GifCanvas::TileSize, GifCanvas::TileSize, 2 * GifCanvas::TileSize, 2 * GifCanvas::TileSize);
+			Assert::AreEqual(8 * GifCanvas::TileBytes, canvas.Bytes());
+			canvas.Clear(2 * GifCanvas::TileSize, -50, size + 50, size + 50);
+			Assert::AreEqual(5 * GifCanvas::TileBytes, canvas.Bytes());
+			Assert::AreEqual(Background, canvas.Pixel(size - 8, 0));
+
+			//an edge tile only has to be covered as far as the canvas goes
+			GifCanvas ragged(GifCanvas::TileSize + 10, GifCanvas::TileSize + 10, Background);
+			*ragged.PixelForWrite(GifCanvas::TileSize + 5, GifCanvas::TileSize + 5) = 0xffffffff;
+			ragged.Clear(GifCanvas::TileSize, GifCanvas::TileSize, GifCanvas::TileSize + 10, GifCanvas::TileSize + 10);
+			Assert::AreEqual(static_cast<size_t>(0), ragged.Bytes());
+
+			//big enough for the rows of tiles to be cleared in parallel, every whole tile goes and the ragged edges stay
+			const int bigSize = 1000;
+			GifCanvas big(bigSize, bigSize, Background);
+			for (int y = 0; y < bigSize; y += GifCanvas::TileSize / 2)
+			{
+				for (int x = 0; x < bigSize; x += GifCanvas::TileSize / 2)
+					*big.PixelForWrite(x, y) = 0xffffffff;
+			}
+			Assert::AreEqual(64 * GifCanvas::TileBytes, big.Bytes());
+			big.Clear(0, 0, bigSize, bigSize - 1);
+			Assert::AreEqual(8 * GifCanvas::TileBytes, big.Bytes());
+			Assert::AreEqual(Background, big.Pixel(bigSize - 8, bigSize - 8));
+		}
+
+		TEST_METHOD(ConcurrentWritesAllocateATileOnce)
+		{
+			//every thread starts on the same untouched tile at once, the losers have to end up writing into the winner's
+			const int threadCount = 16;
+			for (int attempt = 0; attempt < 50; attempt++)
+			{
+				GifCanvas canvas(GifCanvas::TileSize, GifCanvas::TileSize, Background);
+				std::atomic<int> waiting(threadCount);
+				std::vector<std::thread> threads;
+				for (int t = 0; t < threadCount; t++)
+				{
+					threads.emplace_back([&canvas, &waiting, t]()
+					{
+						waiting--;
+						while (waiting > 0)
+							std::this_thread::yield();
+						*canvas.PixelForWrite(t, t) = 0xff000000 | t;
+					});
+				}
+				for (auto& thread : threads)
+					thread.join();
+
+				Assert::AreEqual(static_cast<size_t>(GifCanvas::TileBytes), canvas.Bytes());
+				for (int t = 0; t < threadCount; t++)
+					Assert::AreEqual(static_cast<uint32_t>(0xff000000 | t), canvas.Pixel(t, t), L"a write went into a tile that lost the race");
+			}
+		}
+	};
+}
@@ -0,0 +1,320 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <concrt.h>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	//a full frame followed by smaller ones that are left, restored to background, restored to previous and drawn with
+	//holes in them, so whatever a region composite gets wrong about the pixels around it shows up
+	static std::vector<uint8_t> DisposalAnimation(int width, int height, int frameCount)
+	{
+		std::vector<TestGifs::Frame> frames;
+		frames.push_back(TestGifs::PatternFrame(0, 0, width, height, 0, 4));
+		for (int i = 1; i < frameCount; i++)
+		{
+			auto frame = TestGifs::PatternFrame((i * 13) % (width - 40), (i * 7) % (height - 30), 40, 30, i, 4);
+			frame.disposal = i % 4;
+			if (i % 3 == 0)
+				frame.transparentIndex = frame.indices[0];
+			frames.push_back(frame);
+		}
+		return TestGifs::Write(width, height, TestGifs::Palette(), frames);
+	}
+
+	TEST_CLASS(GifCompositingTests)
+	{
+	public:
+		TEST_METHOD(RegionCompositeMatchesCropOfFullComposite)
+		{
+			const int width = 96;
+			const int height = 64;
+			const int frameCount = 12;
+			auto bytes = DisposalAnimation(width, height, frameCount);
+			//one decoder per target, so each keeps drawing frame after frame into its own pixels
+			auto full = TestGifs::Load(bytes, bytes.size());
+			auto cropped = TestGifs::Load(bytes, bytes.size());
+			GifRegion all = { 0, 0, width, height };
+			GifRegion region = { 17, 9, 71, 50 };
+			int regionWidth = region.right - region.left;
+			int regionHeight = region.bottom - region.top;
+			std::vector<uint32_t> fullPixels(width * height);
+			std::vector<uint32_t> regionPixels(regionWidth * regionHeight);
+
+			for (int frame = 0; frame < frameCount; frame++)
+			{
+				Assert::IsTrue(full->CompositeFrameInto(frame, fullPixels.data(), width * 4, all));
+				Assert::IsTrue(cropped->CompositeFrameInto(frame, regionPixels.data(), regionWidth * 4, region));
+				for (int y = 0; y < regionHeight; y++)
+				{
+					for (int x = 0; x < regionWidth; x++)
+					{
+						if (regionPixels[y * regionWidth + x] != fullPixels[(region.top + y) * width + region.left + x])
+						{
+							wchar_t message[128];
+							swprintf_s(message, L"frame %d differs from the full composite at %d, %d", frame, region.left + x, region.top + y);
+							Assert::Fail(message);
+						}
+					}
+				}
+			}
+		}
+
+		TEST_METHOD(RegionIsRequestedInSurfacePixels)
+		{
+			//at half size the surface rect covers twice as much of the image, and comes back in surface pixels
+			const int width = 96;
+			const int height = 64;
+			auto bytes = TestGifs::Animation(width, height, 4, 4);
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			decoder->RenderSize(Windows::Foundation::Size(width / 2, height / 2));
+
+			HeadlessFrameSink sink;
+			bool requeue;
+			Windows::Foundation::Rect requestedRect(8, 4, 28, 16);
+			Windows::Foundation::Rect drawnRect;
+			for (int waited = 0; waited < 2000 && drawnRect.Width == 0; waited++)
+			{
+				ClockTicks nextDelay = 0;
+				decoder->Advance(nextDelay);
+				drawnRect = decoder->DecodeRectangle(requestedRect, sink, requeue);
+				if (drawnRect.Width == 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			Assert::AreEqual(requestedRect.Left, drawnRect.Left);
+			Assert::AreEqual(requestedRect.Top, drawnRect.Top);
+			Assert::AreEqual(requestedRect.Right, drawnRect.Right);
+			Assert::AreEqual(requestedRect.Bottom, drawnRect.Bottom);
+			//the half size canvas holds the image rect 16, 8 to 72, 40 in 28x16 pixels
+			Assert::AreEqual(28u, sink.Width());
+			Assert::AreEqual(16u, sink.Height());
+		}
+
+		TEST_METHOD(NewerAsyncRequestReplacesOlderPending)
+		{
+			//scrolled twice while the pool is busy, only the newest rect is worth compositing by the time a worker is free
+			const int width = 256;
+			const int height = 192;
+			auto bytes = TestGifs::Animation(width, height, 8, 4);
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			decoder->RenderSize(Windows::Foundation::Size(width / 2, height / 2));
+			Windows::Foundation::Rect newestRect(16, 16, 64, 48);
+			Assert::IsFalse(decoder->CanDecode(newestRect), L"nothing has been composited yet");
+
+			//every worker held so nothing the decoder schedules can start until all three requests are in
+			auto& pool = DecodePool::Instance();
+			std::atomic<size_t> blocked(0);
+			std::atomic<bool> released(false);
+			for (size_t i = 0; i < pool.WorkerCount(); i++)
+			{
+				pool.Submit([&]()
+				{
+					blocked++;
+					while (!released)
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}, DecodePriority::Background);
+			}
+			while (blocked < pool.WorkerCount())
+				std::this_thread::yield();
+			auto composited = decoder->Stats().framesComposited;
+			Microsoft::WRL::ComPtr<ID2D1DeviceContext> noContext;
+			auto oldest = decoder->DecodeRectangleAsync(Windows::Foundation::Rect(0, 0, 32, 32), noContext);
+			auto older = decoder->DecodeRectangleAsync(Windows::Foundation::Rect(32, 0, 32, 32), noContext);
+			auto newest = decoder->DecodeRectangleAsync(newestRect, noContext);
+			released = true;
+
+			auto oldestRect = oldest.get();
+			auto olderRect = older.get();
+			auto decodedRect = newest.get();
+			Assert::AreEqual(0.0f, oldestRect.Width, L"the oldest request was composited");
+			Assert::AreEqual(0.0f, olderRect.Width, L"the older request was composited");
+			Assert::AreEqual(composited + 1, decoder->Stats().framesComposited);
+			Assert::AreEqual(newestRect.Left, decodedRect.Left);
+			Assert::AreEqual(newestRect.Top, decodedRect.Top);
+			Assert::AreEqual(newestRect.Right, decodedRect.Right);
+			Assert::AreEqual(newestRect.Bottom, decodedRect.Bottom);
+
+			//and the renderer's next draw is served from it
+			Assert::IsTrue(decoder->CanDecode(newestRect));
+			HeadlessFrameSink sink;
+			bool requeue;
+			auto drawnRect = decoder->DecodeRectangle(newestRect, sink, requeue);
+			Assert::AreEqual(newestRect.Right, drawnRect.Right);
+			Assert::AreEqual(64u, sink.Width());
+			Assert::AreEqual(48u, sink.Height());
+		}
+
+		TEST_METHOD(LaterFramesUploadOnlyWhatChanged)
+		{
+			//frames a ninth of the image moving a few pixels at a time, a frame's dirty rect takes in the one before it,
+			//which is drawn again on the way, so the draw after the full size first frame sends it all again and every
+			//draw after that a little more than a ninth, and the sink has to match one that was sent the whole frame
+			const int width = 256;
+			const int height = 192;
+			const uint64_t frameBytes = static_cast<uint64_t>(width) * height * sizeof(uint32_t);
+			auto bytes = TestGifs::Animation(width, height, 20, 4);
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			auto clock = std::make_shared<ManualClock>();
+			decoder->Clock(clock);
+
+			HeadlessFrameSink sink;
+			bool requeue;
+			Windows::Foundation::Rect all(0, 0, width, height);
+			int draws = 0;
+			uint64_t laterBytes = 0;
+			for (int ticks = 0; ticks < 2000 && draws < 12; ticks++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				ClockTicks nextDelay = 0;
+				if (decoder->Advance(nextDelay))
+				{
+					sink.ResetCounts();
+					decoder->DecodeRectangle(all, sink, requeue);
+					HeadlessFrameSink whole;
+					decoder->DecodeRectangle(all, whole, requeue);
+					Assert::AreEqual(frameBytes, whole.UploadedBytes());
+					Assert::IsTrue(std::equal(sink.Pixels(), sink.Pixels() + width * height, whole.Pixels()), L"the sink fell out of step with the frame on screen");
+					if (draws > 0)
+						Assert::AreEqual(static_cast<size_t>(0), sink.Allocations());
+					if (draws > 1)
+					{
+						Assert::IsTrue(sink.UploadedBytes() < frameBytes / 4, L"a later frame sent most of the image");
+						laterBytes += sink.UploadedBytes();
+					}
+					draws++;
+				}
+				clock->Advance(nextDelay > 0 ? nextDelay : TicksPerMillisecond);
+			}
+
+			wchar_t message[128];
+			swprintf_s(message, L"%d draws, %.1f%% of the frame sent on average after the second", draws, 100.0 * laterBytes / (draws - 2) / frameBytes);
+			Logger::WriteMessage(message);
+			Assert::AreEqual(12, draws, message);
+		}
+
+		TEST_METHOD(LocalColorMapSwitchesCanvasToBgra)
+		{
+			//the first two frames arrive before anything says a frame has its own colors, so they are composited as
+			//indices into the global palette, the third frame's local map means BGRA from then on, and every frame
+			//drawn on either side of the switch has to match what CompositeFrameInto makes of it
+			//a full 256 color palette leaves no index for the background, so the global one is half that
+			const int width = 128;
+			const int height = 96;
+			const size_t frameCount = 5;
+			auto palette = TestGifs::Palette();
+			palette.resize(128);
+			std::vector<TestGifs::Frame> frames;
+			for (int i = 0; i < static_cast<int>(frameCount); i++)
+			{
+				frames.push_back(i == 0 ? TestGifs::PatternFrame(0, 0, width, height, 0, 4) : TestGifs::PatternFrame(i * 16, i * 12, 48, 36, i, 4));
+				for (auto& index : frames.back().indices)
+					index &= 127;
+				if (i == 2)
+				{
+					frames.back().localPalette = palette;
+					std::reverse(frames.back().localPalette.begin(), frames.back().localPalette.end());
+				}
+			}
+			auto bytes = TestGifs::Write(width, height, palette, frames);
+			//the file is written front to back, so the first two frames on their own are the same bytes up to the trailer
+			auto firstTwo = TestGifs::Write(width, height, palette, std::vector<TestGifs::Frame>(frames.begin(), frames.begin() + 2));
+			auto firstChunk = firstTwo.size() - 1;
+
+			GifRegion all = { 0, 0, width, height };
+			auto reference = TestGifs::Load(bytes, bytes.size());
+			std::vector<std::vector<uint32_t>> expected(frameCount, std::vector<uint32_t>(width * height));
+			for (size_t frame = 0; frame < frameCount; frame++)
+				Assert::IsTrue(reference->CompositeFrameInto(frame, expected[frame].data(), width * 4, all));
+
+			//nothing is parsed until LoadHandler is called, so the rest of the first two frames goes in as a second chunk
+			auto decoder = TestGifs::MakeDecoder(bytes, 1024);
+			decoder->LoadHandler(TestGifs::MakeBuffer(bytes.data() + 1024, firstChunk - 1024), false, static_cast<uint32_t>(bytes.size())).wait();
+			std::vector<uint32_t> scratch(width * height);
+			for (int waited = 0; waited < 2000 && !decoder->CompositeFrameInto(1, scratch.data(), width * 4, all); waited++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			auto clock = std::make_shared<ManualClock>();
+			decoder->Clock(clock);
+
+			HeadlessFrameSink sink;
+			bool requeue;
+			Windows::Foundation::Rect allRect(0, 0, width, height);
+			std::vector<bool> drawn(frameCount, false);
+			bool fed = false;
+			for (int ticks = 0; ticks < 2000 && std::count(drawn.begin(), drawn.end(), true) < static_cast<int>(frameCount); ticks++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				ClockTicks nextDelay = 0;
+				if (decoder->Advance(nextDelay))
+				{
+					decoder->DecodeRectangle(allRect, sink, requeue);
+					size_t frame = 0;
+					while (frame < frameCount && !std::equal(sink.Pixels(), sink.Pixels() + width * height, expected[frame].begin()))
+						frame++;
+					Assert::IsTrue(frame < frameCount, L"the frame on screen isn't any frame CompositeFrameInto makes");
+					drawn[frame] = true;
+					Assert::AreEqual(!fed, decoder->DisplayIndexed(), fed ? L"still indexed after the local color map" : L"the global palette frames weren't indexed");
+					//once the partial file has been shown from both of its frames, the rest arrives
+					if (!fed && drawn[0] && drawn[1])
+					{
+						TestGifs::Feed(*decoder, bytes, firstChunk, 1024);
+						fed = true;
+					}
+				}
+				clock->Advance(nextDelay > 0 ? nextDelay : TicksPerMillisecond);
+			}
+			Assert::IsTrue(fed, L"the first two frames were never both shown");
+			for (size_t frame = 0; frame < frameCount; frame++)
+				Assert::IsTrue(drawn[frame], L"not every frame was shown");
+		}
+
+		TEST_METHOD(LargeCompositeScalesWithWorkers)
+		{
+			//2048x2048 frames split into sixteen bands, composited on schedulers capped at 1 to 16 workers, the frames are
+			//drawn once beforehand to warm up, and every worker count has to draw the same pixels
+			const int width = 2048;
+			const int height = 2048;
+			const int frameCount = 4;
+			auto palette = TestGifs::Palette();
+			std::vector<TestGifs::Frame> frames;
+			for (int i = 0; i < frameCount; i++)
+				frames.push_back(TestGifs::PatternFrame(0, 0, width, height, i, 4));
+			auto bytes = TestGifs::Write(width, height, palette, frames);
+			GifRegion all = { 0, 0, width, height };
+
+			std::vector<uint32_t> expected;
+			double oneWorkerMs = 0;
+			for (int workers = 1; workers <= 16; workers *= 2)
+			{
+				auto decoder = TestGifs::Load(bytes, bytes.size());
+				std::vector<uint32_t> warm(width * height);
+				for (int frame = 0; frame < frameCount; frame++)
+					Assert::IsTrue(decoder->CompositeFrameInto(frame, warm.data(), width * 4, all));
+
+				std::vector<uint32_t> pixels(width * height);
+				concurrency::CurrentScheduler::Create(concurrency::SchedulerPolicy(2, concurrency::MinConcurrency, 1, concurrency::MaxConcurrency, workers));
+				auto start = std::chrono::steady_clock::now();
+				for (int frame = 0; frame < frameCount; frame++)
+					decoder->CompositeFrameInto(frame, pixels.data(), width * 4, all);
+				auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				concurrency::CurrentScheduler::Detach();
+
+				if (workers == 1)
+				{
+					expected = pixels;
+					oneWorkerMs = elapsed;
+				}
+				wchar_t message[128];
+				swprintf_s(message, L"%d workers: %d frames of %dx%d in %.1fms, %.2fx one worker", workers, frameCount, width, height, elapsed, oneWorkerMs / elapsed);
+				Logger::WriteMessage(message);
+				Assert::IsTrue(pixels == expected, message);
+			}
+		}
+	};
+}
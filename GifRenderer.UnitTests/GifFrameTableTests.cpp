@@ -0,0 +1,262 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	typedef std::chrono::steady_clock SteadyClock;
+
+	static double Milliseconds(SteadyClock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	//full size frames shown for 40, 50, 70 and 30ms, looping, with the third frame, the one that may or may not
+	//merge, made by changeThird from a copy of the second
+	template<typename CHANGEFUNC>
+	static std::vector<uint8_t> ThirdFrameAnimation(int width, int height, CHANGEFUNC changeThird)
+	{
+		std::vector<TestGifs::Frame> frames;
+		frames.push_back(TestGifs::PatternFrame(0, 0, width, height, 0, 4));
+		frames.push_back(TestGifs::PatternFrame(0, 0, width, height, 1, 5));
+		auto third = frames.back();
+		third.delayCentiseconds = 7;
+		changeThird(third);
+		frames.push_back(third);
+		frames.push_back(TestGifs::PatternFrame(0, 0, width, height, 3, 3));
+		return TestGifs::Write(width, height, TestGifs::Palette(), frames);
+	}
+
+	//how many entries the frame table ended up with, CompositeFrameInto turns down the first index past the end
+	static size_t EntryCount(GiflibImageDecoder& decoder, int width, int height)
+	{
+		std::vector<uint32_t> pixels(width * height);
+		GifRegion all = { 0, 0, width, height };
+		size_t count = 0;
+		while (decoder.CompositeFrameInto(count, pixels.data(), width * 4, all))
+			count++;
+		return count;
+	}
+
+	//plays the animation on a manual clock and returns the ms at which each of the first count entries went on screen,
+	//a frame that isn't ready yet is looked for again 4ms later, so an entry can turn up that much late
+	static std::vector<ClockTicks> ShownAt(GiflibImageDecoder& decoder, size_t count)
+	{
+		auto clock = std::make_shared<ManualClock>();
+		decoder.Clock(clock);
+		std::vector<ClockTicks> shown;
+		for (int ticks = 0; ticks < 1000 && shown.size() < count; ticks++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			ClockTicks nextDelay = 0;
+			if (decoder.Advance(nextDelay))
+				shown.push_back(clock->Now() / TicksPerMillisecond);
+			if (nextDelay < 0)
+				break;
+			clock->Advance(nextDelay);
+		}
+		return shown;
+	}
+
+	static void AssertShownAt(const std::vector<ClockTicks>& expected, GiflibImageDecoder& decoder)
+	{
+		auto shown = ShownAt(decoder, expected.size());
+		Assert::AreEqual(expected.size(), shown.size(), L"playback stopped early");
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			wchar_t message[128];
+			swprintf_s(message, L"entry %d went on screen at %lldms, expected %lldms", static_cast<int>(i), static_cast<long long>(shown[i]), static_cast<long long>(expected[i]));
+			Assert::IsTrue(shown[i] >= expected[i] && shown[i] <= expected[i] + 4, message);
+		}
+	}
+
+	TEST_CLASS(GifFrameTableTests)
+	{
+	public:
+		TEST_METHOD(AppendListCopiesKeepWhatTheySaw)
+		{
+			//enough to go through several blocks, with a copy taken after every push
+			GifAppendList<int> list;
+			std::vector<GifAppendList<int>> snapshots;
+			for (int i = 0; i < 1000; i++)
+			{
+				list.push_back(i);
+				snapshots.push_back(list);
+			}
+			for (size_t s = 0; s < snapshots.size(); s++)
+			{
+				Assert::AreEqual(s + 1, snapshots[s].size());
+				for (size_t i = 0; i < snapshots[s].size(); i++)
+				{
+					if (snapshots[s][i] != static_cast<int>(i))
+						Assert::Fail(L"a later push_back changed what an earlier copy sees");
+				}
+			}
+		}
+
+		TEST_METHOD(AppendListLastElementChangesStayInTheirCopy)
+		{
+			//the loader folds a merged frame's delay into back() of its copy while the published copy is being drawn
+			GifAppendList<int> published;
+			published.push_back(1);
+			published.push_back(2);
+			auto writer = published;
+			writer.back() += 10;
+			writer.push_back(3);
+			Assert::AreEqual(2, published[1]);
+			Assert::AreEqual(2, published.back());
+			Assert::AreEqual(12, writer[1]);
+			Assert::AreEqual(3, writer.back());
+
+			int sum = 0;
+			for (auto value : writer)
+				sum += value;
+			Assert::AreEqual(16, sum);
+		}
+
+		TEST_METHOD(PublishingCostGrowsLinearly)
+		{
+			//tiny frames a chunk at a time so publishing rather than decoding dominates, copying the whole table per
+			//chunk makes eight times the frames take about sixty four times as long
+			double perFrameMs[2];
+			const int frameCounts[2] = { 2000, 16000 };
+			for (int run = 0; run < 2; run++)
+			{
+				auto bytes = TestGifs::Animation(24, 16, frameCounts[run], 2);
+				auto start = SteadyClock::now();
+				TestGifs::Load(bytes, 1024);
+				perFrameMs[run] = Milliseconds(SteadyClock::now() - start) / frameCounts[run];
+			}
+
+			wchar_t message[128];
+			swprintf_s(message, L"%.2fus a frame for %d frames, %.2fus for %d", perFrameMs[0] * 1000, frameCounts[0], perFrameMs[1] * 1000, frameCounts[1]);
+			Logger::WriteMessage(message);
+			Assert::IsTrue(perFrameMs[1] < perFrameMs[0] * 2.5, message);
+		}
+
+		TEST_METHOD(FramesPublishWhilePlaybackComposites)
+		{
+			//small frames a chunk at a time is the worst case for publishing, a table goes out for nearly every frame
+			const int width = 96;
+			const int height = 64;
+			const int frameCount = 3000;
+			const size_t chunkSize = 1024;
+			auto bytes = TestGifs::Animation(width, height, frameCount, 2);
+
+			auto decoder = TestGifs::MakeDecoder(bytes, chunkSize);
+			std::atomic<bool> loaded(false);
+			SteadyClock::duration loadTime;
+			std::thread loader([&]()
+			{
+				auto start = SteadyClock::now();
+				TestGifs::Feed(*decoder, bytes, chunkSize, chunkSize);
+				loadTime = SteadyClock::now() - start;
+				loaded = true;
+			});
+
+			//plays every frame as soon as it's published, into the same pixels so each call only draws the next frame
+			std::vector<uint32_t> pixels(width * height);
+			GifRegion all = { 0, 0, width, height };
+			size_t shown = 0;
+			double worstCallMs = 0;
+			while (shown < frameCount)
+			{
+				auto start = SteadyClock::now();
+				bool drawn = decoder->CompositeFrameInto(shown, pixels.data(), width * 4, all);
+				auto callMs = Milliseconds(SteadyClock::now() - start);
+				if (drawn)
+				{
+					shown++;
+					worstCallMs = std::max(worstCallMs, callMs);
+				}
+				else if (loaded)
+				{
+					break;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+			loader.join();
+
+			auto stats = decoder->Stats();
+			wchar_t message[192];
+			swprintf_s(message, L"%d frames in %.1fms, slowest playback call %.2fms, lock wait %.2fms", frameCount, Milliseconds(loadTime),
+				worstCallMs, static_cast<double>(stats.lockWait) / TicksPerMillisecond);
+			Logger::WriteMessage(message);
+
+			Assert::AreEqual(static_cast<size_t>(frameCount), shown, L"playback never saw every frame");
+			//drawing a 32x21 frame is microseconds, anything near this is playback waiting on the loader
+			Assert::IsTrue(worstCallMs < 50.0, message);
+
+			//frame by frame as they arrived has to end up where compositing the finished file straight to the end does
+			auto reference = TestGifs::Load(bytes, bytes.size());
+			std::vector<uint32_t> expected(width * height);
+			Assert::IsTrue(reference->CompositeFrameInto(frameCount - 1, expected.data(), width * 4, all));
+			Assert::IsTrue(expected == pixels, L"incremental playback differs from a composite of the whole file");
+		}
+
+		TEST_METHOD(TransparentFrameFoldsIntoPreviousEntry)
+		{
+			//every pixel transparent draws nothing, so the second frame stays up for its own 50ms and the third's 70ms
+			const int width = 64;
+			const int height = 48;
+			auto bytes = ThirdFrameAnimation(width, height, [](TestGifs::Frame& frame)
+			{
+				std::fill(frame.indices.begin(), frame.indices.end(), static_cast<uint8_t>(7));
+				frame.transparentIndex = 7;
+			});
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			Assert::AreEqual(static_cast<size_t>(3), EntryCount(*decoder, width, height));
+			AssertShownAt({ 0, 40, 160, 190 }, *decoder);
+		}
+
+		TEST_METHOD(IdenticalFrameFoldsIntoPreviousEntry)
+		{
+			//the same raster in the same place with the same colors redraws the second frame over itself
+			const int width = 64;
+			const int height = 48;
+			auto bytes = ThirdFrameAnimation(width, height, [](TestGifs::Frame&) {});
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			Assert::AreEqual(static_cast<size_t>(3), EntryCount(*decoder, width, height));
+			AssertShownAt({ 0, 40, 160, 190 }, *decoder);
+
+			//and the entry it went into still draws the second frame
+			auto separateBytes = ThirdFrameAnimation(width, height, [](TestGifs::Frame& frame) { frame.disposal = 2; });
+			auto separate = TestGifs::Load(separateBytes, separateBytes.size());
+			std::vector<uint32_t> merged(width * height);
+			std::vector<uint32_t> expected(width * height);
+			GifRegion all = { 0, 0, width, height };
+			Assert::IsTrue(decoder->CompositeFrameInto(1, merged.data(), width * 4, all));
+			Assert::IsTrue(separate->CompositeFrameInto(1, expected.data(), width * 4, all));
+			Assert::IsTrue(merged == expected, L"the merged entry draws something other than the frame it kept");
+		}
+
+		TEST_METHOD(ChangedPaletteOrDisposalIsNotMerged)
+		{
+			//the same indices through other colors, or cleared to the background afterwards, change what is on screen
+			const int width = 64;
+			const int height = 48;
+			auto recolored = ThirdFrameAnimation(width, height, [](TestGifs::Frame& frame)
+			{
+				frame.localPalette = TestGifs::Palette();
+				std::reverse(frame.localPalette.begin(), frame.localPalette.end());
+			});
+			auto cleared = ThirdFrameAnimation(width, height, [](TestGifs::Frame& frame) { frame.disposal = 2; });
+			const std::vector<uint8_t>* animations[2] = { &recolored, &cleared };
+			for (auto bytes : animations)
+			{
+				auto decoder = TestGifs::Load(*bytes, bytes->size());
+				Assert::AreEqual(static_cast<size_t>(4), EntryCount(*decoder, width, height));
+				AssertShownAt({ 0, 40, 90, 160, 190 }, *decoder);
+			}
+		}
+	};
+}
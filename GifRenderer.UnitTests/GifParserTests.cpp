@@ -0,0 +1,111 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Windows::Storage::Streams;
+
+namespace GifRenderer_UnitTests
+{
+	typedef std::chrono::steady_clock SteadyClock;
+
+	//parses the whole of buffer the way the loader does, true if it stopped on the token rather than reaching the trailer
+	static bool ParseAll(IBuffer^ buffer, concurrency::cancellation_token token, std::atomic<bool>* started = nullptr)
+	{
+		gif_user_data userData(token);
+		userData.init(0, buffer);
+		userData.finishedLoad = true;
+		GifFileType<gif_user_data> gifFile(userData);
+		if (started != nullptr)
+			*started = true;
+		try
+		{
+			gifFile.Slurp(userData);
+			return false;
+		}
+		catch (GifCanceledException&)
+		{
+			return true;
+		}
+	}
+
+	static double Milliseconds(SteadyClock::duration duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	TEST_CLASS(GifParserTests)
+	{
+	public:
+		TEST_METHOD(CancelStopsLargeFrameWithinAFewRows)
+		{
+			//one frame big enough that decoding it takes far longer than a row does
+			const int side = 4096;
+			auto bytes = TestGifs::Write(side, side, TestGifs::Palette(), { TestGifs::PatternFrame(0, 0, side, side, 1, 10) });
+			auto buffer = TestGifs::MakeBuffer(bytes);
+
+			auto uncanceledStart = SteadyClock::now();
+			Assert::IsFalse(ParseAll(buffer, concurrency::cancellation_token::none()));
+			auto uncanceled = SteadyClock::now() - uncanceledStart;
+
+			concurrency::cancellation_token_source cancelSource;
+			std::atomic<bool> started(false);
+			bool canceled = false;
+			SteadyClock::time_point stopped;
+			std::thread parser([&]()
+			{
+				canceled = ParseAll(buffer, cancelSource.get_token(), &started);
+				stopped = SteadyClock::now();
+			});
+			while (!started)
+				std::this_thread::yield();
+			std::this_thread::sleep_for(uncanceled / 4);
+			auto cancelAt = SteadyClock::now();
+			cancelSource.cancel();
+			parser.join();
+
+			auto latency = Milliseconds(stopped - cancelAt);
+			wchar_t message[128];
+			swprintf_s(message, L"full decode %.1fms, cancel to stop %.2fms", Milliseconds(uncanceled), latency);
+			Logger::WriteMessage(message);
+
+			Assert::IsTrue(canceled, L"the parse ran to the end instead of stopping");
+			//a row of 4096 pixels is microseconds of work, anything near this means the token isn't being polled
+			Assert::IsTrue(latency < 20.0, message);
+		}
+
+		TEST_METHOD(ScanEstimatesPackedRastersAtTheStoredDepth)
+		{
+			//3 and 5 bit color maps are stored at 4 and 8 bits, an estimate at the map's own depth comes in short
+			const int colorCounts[3] = { 8, 32, 2 };
+			const int storedDepths[3] = { 4, 8, 1 };
+			auto palette = TestGifs::Palette();
+			std::vector<TestGifs::Frame> frames;
+			uint64_t stored = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				auto frame = TestGifs::PatternFrame(i * 3, i * 2, 37, 23, i, 10);
+				for (auto& index : frame.indices)
+					index &= colorCounts[i] - 1;
+				frame.localPalette.assign(palette.begin(), palette.begin() + colorCounts[i]);
+				frames.push_back(frame);
+				stored += (37 * 23 * storedDepths[i] + 7) / 8;
+			}
+			auto bytes = TestGifs::Write(64, 48, palette, frames);
+
+			gif_source source;
+			source.append(TestGifs::MakeBuffer(bytes));
+			GifStructureScan scan;
+			ScanGifStructure(source, scan);
+
+			Assert::IsTrue(scan.Finished);
+			Assert::AreEqual(3u, scan.ImageCount);
+			Assert::AreEqual(static_cast<uint64_t>(37 * 23 * 3), scan.RasterPixels);
+			Assert::AreEqual(stored, scan.PackedRasterBytes);
+		}
+	};
+}
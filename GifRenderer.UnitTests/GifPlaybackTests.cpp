@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "GiflibImageDecoder.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace GifRenderer_UnitTests
+{
+	//drives Advance the way the AnimationScheduler does, except time only moves when a tick asks for it to, the real
+	//sleep before each tick gives the producer time to have the frame ready so every wakeup counts
+	static int PlayFor(GiflibImageDecoder& decoder, ManualClock& clock, ClockTicks duration)
+	{
+		int wakeups = 0;
+		auto end = clock.Now() + duration;
+		while (clock.Now() < end)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			ClockTicks nextDelay = 0;
+			decoder.Advance(nextDelay);
+			wakeups++;
+			if (nextDelay <= 0)
+				break;
+			clock.Advance(nextDelay);
+		}
+		return wakeups;
+	}
+
+	TEST_CLASS(GifPlaybackTests)
+	{
+	public:
+		TEST_METHOD(FrameRateCapOnlyWakesForFramesItShows)
+		{
+			//20ms frames capped at 10 a second, four in every five are never shown whatever the playback rate
+			auto bytes = TestGifs::Animation(64, 48, 50, 2);
+			const double rates[2] = { 1.0, 2.0 };
+			for (auto rate : rates)
+			{
+				auto decoder = TestGifs::Load(bytes, bytes.size());
+				auto clock = std::make_shared<ManualClock>();
+				decoder->Clock(clock);
+				decoder->PlaybackRate(rate);
+				GifPlaybackPolicy policy;
+				policy.maxFrameRate = 10;
+				decoder->Policy(policy);
+
+				int wakeups = PlayFor(*decoder, *clock, 2 * TicksPerSecond);
+				auto metrics = decoder->PlaybackMetrics();
+				wchar_t message[160];
+				swprintf_s(message, L"at %.0fx, %d wakeups for %llu frames shown, %llu capped", rate, wakeups,
+					static_cast<unsigned long long>(metrics.framesShown), static_cast<unsigned long long>(metrics.framesCapped));
+				Logger::WriteMessage(message);
+
+				//two seconds at 10 a second
+				Assert::IsTrue(metrics.framesShown >= 18 && metrics.framesShown <= 22, message);
+				//polling for the frames in between would be a wakeup every 4ms or every frame delay
+				Assert::IsTrue(wakeups <= static_cast<int>(metrics.framesShown) + 5, message);
+			}
+		}
+
+		TEST_METHOD(SuspendShedsDecodedMemory)
+		{
+			const int width = 256;
+			const int height = 192;
+			auto bytes = TestGifs::Animation(width, height, 30, 4);
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			auto clock = std::make_shared<ManualClock>();
+			decoder->Clock(clock);
+
+			//a few frames in so the ring, the frame on screen and the sink's copy of it are all there
+			HeadlessFrameSink sink;
+			bool requeue;
+			PlayFor(*decoder, *clock, 200 * TicksPerMillisecond);
+			decoder->DecodeRectangle(Windows::Foundation::Rect(0, 0, width, height), sink, requeue);
+			Assert::AreEqual(static_cast<uint32_t>(width), sink.Width());
+			auto playing = decoder->DecodedBytes();
+
+			//shedding is a Background job, and the frame on screen goes on the tick after Suspend the way the scheduler's would
+			decoder->Suspend();
+			ClockTicks nextDelay = 0;
+			decoder->Advance(nextDelay);
+			Assert::AreEqual(static_cast<ClockTicks>(-1), nextDelay);
+			//every canvas goes, what's left is the rasters around where playback stopped and a tile of background
+			auto kept = 3 * static_cast<size_t>(width) * height + GifCanvas::TileBytes;
+			auto suspended = decoder->DecodedBytes();
+			for (int waited = 0; waited < 2000 && (suspended > kept || decoder->Stats().currentBytes != suspended); waited++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				suspended = decoder->DecodedBytes();
+			}
+
+			wchar_t message[128];
+			swprintf_s(message, L"%llu bytes decoded while playing, %llu once suspended", static_cast<unsigned long long>(playing),
+				static_cast<unsigned long long>(suspended));
+			Logger::WriteMessage(message);
+			Assert::IsTrue(suspended <= kept && suspended < playing / 4, message);
+			Assert::AreEqual(suspended, decoder->Stats().currentBytes, L"DecodedMemoryBudget never heard about the shed memory");
+
+			//and everything comes back from the source on the way out again
+			decoder->Resume();
+			PlayFor(*decoder, *clock, 100 * TicksPerMillisecond);
+			auto drawn = decoder->DecodeRectangle(Windows::Foundation::Rect(0, 0, width, height), sink, requeue);
+			Assert::AreEqual(static_cast<float>(width), drawn.Width);
+		}
+
+		TEST_METHOD(FinishedAnimationEndsOnAnExactFrame)
+		{
+			//played once at a quarter size, then zoomed back in after the last frame, nothing composites a finished animation
+			//again so the frame it stops on has to be good for any size
+			const int width = 256;
+			const int height = 192;
+			std::vector<TestGifs::Frame> frames;
+			for (int i = 0; i < 6; i++)
+				frames.push_back(TestGifs::PatternFrame(0, 0, width, height, i, 4));
+			auto bytes = TestGifs::Write(width, height, TestGifs::Palette(), frames, 1);
+			auto decoder = TestGifs::Load(bytes, bytes.size());
+			auto clock = std::make_shared<ManualClock>();
+			decoder->Clock(clock);
+			decoder->RenderSize(Windows::Foundation::Size(width / 4, height / 4));
+
+			HeadlessFrameSink sink;
+			bool requeue = true;
+			PlayFor(*decoder, *clock, 2 * TicksPerSecond);
+			decoder->DecodeRectangle(Windows::Foundation::Rect(0, 0, width / 4, height / 4), sink, requeue);
+			Assert::IsFalse(requeue, L"playback never finished");
+
+			decoder->RenderSize(Windows::Foundation::Size(width, height));
+			auto drawn = decoder->DecodeRectangle(Windows::Foundation::Rect(0, 0, width, height), sink, requeue);
+			Assert::AreEqual(static_cast<uint32_t>(width), sink.Width());
+			Assert::AreEqual(static_cast<uint32_t>(height), sink.Height());
+			Assert::AreEqual(static_cast<float>(width), drawn.Width);
+		}
+	};
+}
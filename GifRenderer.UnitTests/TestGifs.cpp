@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "TestGifs.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace Windows::Security::Cryptography;
+using namespace Windows::Storage::Streams;
+
+namespace TestGifs
+{
+	//packs codes least significant bit first and splits the result into sub-blocks
+	class CodeWriter
+	{
+	private:
+		std::vector<uint8_t> _bytes;
+		uint32_t _bits;
+		int _bitCount;
+	public:
+		CodeWriter() : _bits(0), _bitCount(0) {}
+		void Write(uint32_t code, int width)
+		{
+			_bits |= code << _bitCount;
+			_bitCount += width;
+			while (_bitCount >= 8)
+			{
+				_bytes.push_back(static_cast<uint8_t>(_bits));
+				_bits >>= 8;
+				_bitCount -= 8;
+			}
+		}
+		void FlushTo(std::vector<uint8_t>& out)
+		{
+			if (_bitCount > 0)
+				_bytes.push_back(static_cast<uint8_t>(_bits));
+			for (size_t offset = 0; offset < _bytes.size(); offset += 255)
+			{
+				auto blockSize = _bytes.size() - offset < 255 ? _bytes.size() - offset : 255;
+				out.push_back(static_cast<uint8_t>(blockSize));
+				out.insert(out.end(), _bytes.begin() + offset, _bytes.begin() + offset + blockSize);
+			}
+			out.push_back(0);
+		}
+	};
+
+	static void WriteWord(std::vector<uint8_t>& out, int value)
+	{
+		out.push_back(static_cast<uint8_t>(value & 0xff));
+		out.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+	}
+
+	static void WritePalette(std::vector<uint8_t>& out, const std::vector<uint32_t>& palette)
+	{
+		for (auto color : palette)
+		{
+			out.push_back(static_cast<uint8_t>(color >> 16));
+			out.push_back(static_cast<uint8_t>(color >> 8));
+			out.push_back(static_cast<uint8_t>(color));
+		}
+	}
+
+	//the size field of a color table, palettes are always written at a power of two
+	static int PaletteBits(size_t size)
+	{
+		int bits = 1;
+		while ((static_cast<size_t>(1) << bits) < size)
+			bits++;
+		return bits;
+	}
+
+	static void WriteRaster(std::vector<uint8_t>& out, const std::vector<uint8_t>& indices, int paletteBits)
+	{
+		auto minCodeSize = paletteBits < 2 ? 2 : paletteBits;
+		auto clearCode = 1u << minCodeSize;
+		auto width = minCodeSize + 1;
+		//the decoder widens its codes once the table fills, a clear before then keeps it where it started
+		auto literalsPerClear = (1u << minCodeSize) - 2;
+		out.push_back(static_cast<uint8_t>(minCodeSize));
+		CodeWriter codes;
+		uint32_t sinceClear = literalsPerClear;
+		for (auto index : indices)
+		{
+			if (sinceClear == literalsPerClear)
+			{
+				codes.Write(clearCode, width);
+				sinceClear = 0;
+			}
+			codes.Write(index, width);
+			sinceClear++;
+		}
+		codes.Write(clearCode + 1, width);
+		codes.FlushTo(out);
+	}
+
+	std::vector<uint32_t> Palette()
+	{
+		std::vector<uint32_t> palette(256);
+		for (uint32_t i = 0; i < 256; i++)
+			palette[i] = ((i * 97) & 0xff) << 16 | ((i * 57 + 31) & 0xff) << 8 | ((i * 23 + 101) & 0xff);
+		return palette;
+	}
+
+	Frame PatternFrame(int left, int top, int width, int height, int seed, int delayCentiseconds)
+	{
+		Frame frame = { left, top, width, height, std::vector<uint8_t>(static_cast<size_t>(width) * height), delayCentiseconds, 1, -1, std::vector<uint32_t>() };
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+				frame.indices[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((x * 7 + y * 13 + seed * 29 + (x * y) / 17) & 0xff);
+		}
+		return frame;
+	}
+
+	std::vector<uint8_t> Write(int width, int height, const std::vector<uint32_t>& globalPalette, const std::vector<Frame>& frames, int loopCount, size_t commentBytes)
+	{
+		std::vector<uint8_t> out = { 'G', 'I', 'F', '8', '9', 'a' };
+		WriteWord(out, width);
+		WriteWord(out, height);
+		auto globalBits = PaletteBits(globalPalette.size());
+		out.push_back(static_cast<uint8_t>(globalPalette.empty() ? 0 : 0x80 | 0x70 | (globalBits - 1)));
+		out.push_back(0);
+		out.push_back(0);
+		if (!globalPalette.empty())
+		{
+			auto padded = globalPalette;
+			padded.resize(static_cast<size_t>(1) << globalBits);
+			WritePalette(out, padded);
+		}
+
+		const uint8_t netscape[] = { 0x21, 0xff, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1 };
+		out.insert(out.end(), netscape, netscape + sizeof(netscape));
+		WriteWord(out, loopCount);
+		out.push_back(0);
+
+		for (auto& frame : frames)
+		{
+			if (commentBytes > 0)
+			{
+				out.push_back(0x21);
+				out.push_back(0xfe);
+				for (size_t written = 0; written < commentBytes; written += 255)
+				{
+					auto blockSize = commentBytes - written < 255 ? commentBytes - written : 255;
+					out.push_back(static_cast<uint8_t>(blockSize));
+					for (size_t i = 0; i < blockSize; i++)
+						out.push_back(static_cast<uint8_t>('a' + (written + i) % 26));
+				}
+				out.push_back(0);
+			}
+
+			out.push_back(0x21);
+			out.push_back(0xf9);
+			out.push_back(4);
+			out.push_back(static_cast<uint8_t>((frame.disposal & 0x07) << 2 | (frame.transparentIndex >= 0 ? 1 : 0)));
+			WriteWord(out, frame.delayCentiseconds);
+			out.push_back(static_cast<uint8_t>(frame.transparentIndex >= 0 ? frame.transparentIndex : 0));
+			out.push_back(0);
+
+			out.push_back(0x2c);
+			WriteWord(out, frame.left);
+			WriteWord(out, frame.top);
+			WriteWord(out, frame.width);
+			WriteWord(out, frame.height);
+			auto paletteBits = globalBits;
+			if (!frame.localPalette.empty())
+			{
+				paletteBits = PaletteBits(frame.localPalette.size());
+				out.push_back(static_cast<uint8_t>(0x80 | (paletteBits - 1)));
+				auto padded = frame.localPalette;
+				padded.resize(static_cast<size_t>(1) << paletteBits);
+				WritePalette(out, padded);
+			}
+			else
+			{
+				out.push_back(0);
+			}
+			WriteRaster(out, frame.indices, paletteBits);
+		}
+		out.push_back(0x3b);
+		return out;
+	}
+
+	std::vector<uint8_t> Animation(int width, int height, int frameCount, int delayCentiseconds, size_t commentBytes)
+	{
+		std::vector<Frame> frames;
+		frames.push_back(PatternFrame(0, 0, width, height, 0, delayCentiseconds));
+		auto frameWidth = width / 3 > 0 ? width / 3 : 1;
+		auto frameHeight = height / 3 > 0 ? height / 3 : 1;
+		for (int i = 1; i < frameCount; i++)
+		{
+			auto left = (i * 11) % (width - frameWidth + 1);
+			auto top = (i * 7) % (height - frameHeight + 1);
+			frames.push_back(PatternFrame(left, top, frameWidth, frameHeight, i, delayCentiseconds));
+		}
+		return Write(width, height, Palette(), frames, 0, commentBytes);
+	}
+
+	IBuffer^ MakeBuffer(const uint8_t* bytes, size_t count)
+	{
+		return CryptographicBuffer::CreateFromByteArray(ref new Platform::Array<uint8_t>(const_cast<uint8_t*>(bytes), static_cast<unsigned int>(count)));
+	}
+
+	IBuffer^ MakeBuffer(const std::vector<uint8_t>& bytes)
+	{
+		return MakeBuffer(bytes.data(), bytes.size());
+	}
+
+	std::shared_ptr<GiflibImageDecoder> MakeDecoder(const std::vector<uint8_t>& bytes, size_t firstChunk)
+	{
+		auto count = firstChunk < bytes.size() ? firstChunk : bytes.size();
+		return std::make_shared<GiflibImageDecoder>(MakeBuffer(bytes.data(), count), concurrency::cancellation_token::none());
+	}
+
+	void Feed(GiflibImageDecoder& decoder, const std::vector<uint8_t>& bytes, size_t offset, size_t chunkSize)
+	{
+		//a file that fit in the first chunk still needs telling that nothing more is coming, like ResourceLoader does
+		if (offset >= bytes.size())
+			decoder.LoadHandler(nullptr, true, static_cast<uint32_t>(bytes.size())).wait();
+		for (; offset < bytes.size(); offset += chunkSize)
+		{
+			auto count = bytes.size() - offset < chunkSize ? bytes.size() - offset : chunkSize;
+			decoder.LoadHandler(MakeBuffer(bytes.data() + offset, count), offset + count == bytes.size(), static_cast<uint32_t>(bytes.size())).wait();
+		}
+		//the trailer is the last byte parsed, so this only returns once every frame has been published
+		while (decoder.Stats().bytesParsed < bytes.size())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::shared_ptr<GiflibImageDecoder> Load(const std::vector<uint8_t>& bytes, size_t chunkSize)
+	{
+		auto decoder = MakeDecoder(bytes, chunkSize);
+		Feed(*decoder, bytes, chunkSize, chunkSize);
+		return decoder;
+	}
+}
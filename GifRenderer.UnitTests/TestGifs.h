@@ -0,0 +1,43 @@
+#pragma once
+
+#include "GiflibImageDecoder.h"
+
+#include <stdint.h>
+#include <vector>
+
+//builds gif files in memory so the tests don't depend on assets
+//rasters are written with a clear code often enough that every code stays at the initial width, which keeps
+//the encoder trivial at the cost of files a bit larger than a real encoder would make
+namespace TestGifs
+{
+	struct Frame
+	{
+		int left;
+		int top;
+		int width;
+		int height;
+		std::vector<uint8_t> indices;
+		int delayCentiseconds;
+		int disposal;
+		int transparentIndex; //negative for none
+		std::vector<uint32_t> localPalette; //0xRRGGBB, empty to use the global palette
+	};
+
+	//a 256 color palette that's easy to tell apart, index i is never the same color as index i + 1
+	std::vector<uint32_t> Palette();
+	//pixels that vary in both directions and from one seed to the next, so any misplaced rect shows up
+	Frame PatternFrame(int left, int top, int width, int height, int seed, int delayCentiseconds);
+	//comment extensions of commentBytes each are written ahead of every frame, for metadata heavy files
+	std::vector<uint8_t> Write(int width, int height, const std::vector<uint32_t>& globalPalette, const std::vector<Frame>& frames,
+		int loopCount = 0, size_t commentBytes = 0);
+	//a full canvas first frame followed by frameCount - 1 smaller frames moving across it
+	std::vector<uint8_t> Animation(int width, int height, int frameCount, int delayCentiseconds, size_t commentBytes = 0);
+	Windows::Storage::Streams::IBuffer^ MakeBuffer(const uint8_t* bytes, size_t count);
+	Windows::Storage::Streams::IBuffer^ MakeBuffer(const std::vector<uint8_t>& bytes);
+	//a decoder that has been handed the first firstChunk bytes, the way ImageFactory makes one from the first read
+	std::shared_ptr<GiflibImageDecoder> MakeDecoder(const std::vector<uint8_t>& bytes, size_t firstChunk);
+	//hands the rest of bytes from offset on to decoder chunkSize at a time, then waits for the decode pool to parse it all
+	void Feed(GiflibImageDecoder& decoder, const std::vector<uint8_t>& bytes, size_t offset, size_t chunkSize);
+	//MakeDecoder and Feed in one go
+	std::shared_ptr<GiflibImageDecoder> Load(const std::vector<uint8_t>& bytes, size_t chunkSize);
+}
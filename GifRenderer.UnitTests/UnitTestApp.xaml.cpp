@@ -0,0 +1,24 @@
+#include "pch.h"
+#include "UnitTestApp.xaml.h"
+#include "CppUnitTest.h"
+
+using namespace GifRenderer_UnitTests;
+using namespace Microsoft::VisualStudio::TestPlatform::TestExecutor::WinRTCore;
+using namespace Windows::ApplicationModel::Activation;
+using namespace Windows::UI::Xaml;
+using namespace Windows::UI::Xaml::Controls;
+
+App::App()
+{
+	InitializeComponent();
+}
+
+void App::OnLaunched(LaunchActivatedEventArgs^ e)
+{
+	if (dynamic_cast<Frame^>(Window::Current->Content) == nullptr)
+		Window::Current->Content = ref new Frame();
+
+	UnitTestClient::CreateDefaultUI();
+	Window::Current->Activate();
+	UnitTestClient::Run(e->Arguments);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "UnitTestApp.g.h"
+
+namespace GifRenderer_UnitTests
+{
+	//hands the window to the test framework, which discovers and runs every TEST_CLASS in the package
+	ref class App sealed
+	{
+	protected:
+		virtual void OnLaunched(Windows::ApplicationModel::Activation::LaunchActivatedEventArgs^ e) override;
+
+	internal:
+		App();
+	};
+}
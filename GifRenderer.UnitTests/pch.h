@@ -0,0 +1,7 @@
+﻿#pragma once
+
+#include <collection.h>
+#include <ppltasks.h>
+#include <algorithm>
+
+#include "UnitTestApp.xaml.h"
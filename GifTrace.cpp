@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "GifTrace.h"
+
+#ifdef GIFRENDERER_TRACE
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#ifndef _WIN32
+#include <chrono>
+#endif
+
+#ifdef _MSC_VER
+#define GIF_TRACE_THREAD __declspec(thread)
+#else
+#define GIF_TRACE_THREAD thread_local
+#endif
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char* name;
+		int64_t start;
+		int64_t duration;
+		int64_t value;
+	};
+
+	//written by its own thread only, events[i % RingSize] holds the i'th event and written counts them all
+	//rings are never freed, the decode pool's threads live as long as the process so there are only ever a handful
+	struct TraceRing
+	{
+		uint32_t thread;
+		std::atomic<uint64_t> written;
+		//events before this were there when Clear ran
+		std::atomic<uint64_t> cleared;
+		TraceEvent events[GifTrace::RingSize];
+	};
+
+	struct TraceRegistry
+	{
+		std::mutex mutex;
+		std::vector<TraceRing*> rings;
+		int64_t frequency;
+	};
+}
+
+static std::once_flag s_traceOnce;
+static TraceRegistry* s_traceRegistry = nullptr;
+static GIF_TRACE_THREAD TraceRing* t_traceRing = nullptr;
+
+static TraceRegistry& Registry()
+{
+	std::call_once(s_traceOnce, []()
+	{
+		s_traceRegistry = new TraceRegistry();
+#ifdef _WIN32
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		s_traceRegistry->frequency = frequency.QuadPart;
+#else
+		s_traceRegistry->frequency = 0;
+#endif
+	});
+	return *s_traceRegistry;
+}
+
+static TraceRing* ThreadRing()
+{
+	if (t_traceRing != nullptr)
+		return t_traceRing;
+	auto& registry = Registry();
+	auto ring = new TraceRing();
+	ring->written = 0;
+	ring->cleared = 0;
+	std::lock_guard<std::mutex> registryGuard(registry.mutex);
+	ring->thread = static_cast<uint32_t>(registry.rings.size() + 1);
+	registry.rings.push_back(ring);
+	t_traceRing = ring;
+	return ring;
+}
+
+int64_t GifTrace::Now()
+{
+#ifdef _WIN32
+	//the ring is made along with the registry, so after the first call this is only a thread local read
+	ThreadRing();
+	auto frequency = s_traceRegistry->frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart / frequency) * 1000000 + ((counter.QuadPart % frequency) * 1000000) / frequency;
+#else
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void GifTrace::Record(const char* name, int64_t start, int64_t duration, int64_t value)
+{
+	auto ring = ThreadRing();
+	auto index = ring->written.load(std::memory_order_relaxed);
+	TraceEvent event = { name, start, duration, value };
+	ring->events[index % RingSize] = event;
+	ring->written.store(index + 1, std::memory_order_release);
+}
+
+static void AppendEscaped(std::string& json, const char* text)
+{
+	for (; *text != 0; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			json += '\\';
+		json += *text;
+	}
+}
+
+std::string GifTrace::ChromeTraceJson()
+{
+	std::vector<TraceRing*> rings;
+	{
+		auto& registry = Registry();
+		std::lock_guard<std::mutex> registryGuard(registry.mutex);
+		rings = registry.rings;
+	}
+
+	std::string json = "{\"traceEvents\":[";
+	bool first = true;
+	std::vector<TraceEvent> events;
+	for (auto ring : rings)
+	{
+		auto end = ring->written.load(std::memory_order_acquire);
+		auto begin = end > RingSize ? end - RingSize : 0;
+		if (begin < ring->cleared)
+			begin = ring->cleared;
+		events.clear();
+		for (auto i = begin; i < end; i++)
+			events.push_back(ring->events[i % RingSize]);
+		//anything the owner has lapped while we were copying may be half overwritten
+		auto lapped = ring->written.load(std::memory_order_acquire);
+		auto keepFrom = lapped >= RingSize ? lapped - RingSize + 1 : 0;
+
+		for (auto i = begin; i < end; i++)
+		{
+			if (i < keepFrom)
+				continue;
+			auto& event = events[static_cast<size_t>(i - begin)];
+			if (!first)
+				json += ",";
+			first = false;
+			json += "{\"name\":\"";
+			AppendEscaped(json, event.name);
+			json += "\",\"cat\":\"gif\",\"pid\":1,\"tid\":" + std::to_string(ring->thread) + ",\"ts\":" + std::to_string(event.start);
+			if (event.duration >= 0)
+				json += ",\"ph\":\"X\",\"dur\":" + std::to_string(event.duration);
+			else
+				json += ",\"ph\":\"i\",\"s\":\"t\"";
+			if (event.value >= 0)
+				json += ",\"args\":{\"value\":" + std::to_string(event.value) + "}";
+			json += "}";
+		}
+	}
+	json += "],\"displayTimeUnit\":\"ms\"}";
+	return json;
+}
+
+void GifTrace::Clear()
+{
+	auto& registry = Registry();
+	std::lock_guard<std::mutex> registryGuard(registry.mutex);
+	for (auto ring : registry.rings)
+		ring->cleared = ring->written.load();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+//timing for the stages a gif goes through, from a chunk arriving to its frames being uploaded
+//build with GIFRENDERER_TRACE defined to record, without it every GIF_TRACE_* line compiles to nothing
+//each thread records into a ring of its own with no locking, GifTrace::ChromeTraceJson turns whatever the rings still
+//hold into the trace event format that chrome://tracing and Perfetto open, so one slow gif can be read as a timeline
+#ifdef GIFRENDERER_TRACE
+
+#include <string>
+
+class GifTrace
+{
+public:
+	//events kept per thread, older ones are overwritten
+	static const size_t RingSize = 4096;
+	//microseconds on a clock shared by every thread
+	static int64_t Now();
+	//name has to outlive the trace, in practice it is always a string literal
+	//value is shown as the event's argument, negative leaves it off, duration is negative for an instant
+	static void Record(const char* name, int64_t start, int64_t duration, int64_t value);
+	//safe while other threads carry on recording, an event being overwritten as it is read is skipped
+	static std::string ChromeTraceJson();
+	static void Clear();
+};
+
+class GifTraceScope
+{
+private:
+	const char* _name;
+	int64_t _value;
+	int64_t _start;
+	GifTraceScope(const GifTraceScope&) = delete;
+	GifTraceScope& operator=(const GifTraceScope&) = delete;
+public:
+	GifTraceScope(const char* name, int64_t value) : _name(name), _value(value), _start(GifTrace::Now()) {}
+	~GifTraceScope() { GifTrace::Record(_name, _start, GifTrace::Now() - _start, _value); }
+};
+
+#define GIF_TRACE_JOIN2(a, b) a##b
+#define GIF_TRACE_JOIN(a, b) GIF_TRACE_JOIN2(a, b)
+//times the rest of the enclosing block
+#define GIF_TRACE_SCOPE(name) GifTraceScope GIF_TRACE_JOIN(gifTraceScope, __LINE__)(name, -1)
+#define GIF_TRACE_SCOPE_VALUE(name, value) GifTraceScope GIF_TRACE_JOIN(gifTraceScope, __LINE__)(name, static_cast<int64_t>(value))
+//something that happens at a point in time rather than taking any
+#define GIF_TRACE_INSTANT(name, value) GifTrace::Record(name, GifTrace::Now(), -1, static_cast<int64_t>(value))
+
+#else
+
+#define GIF_TRACE_SCOPE(name)
+#define GIF_TRACE_SCOPE_VALUE(name, value)
+#define GIF_TRACE_INSTANT(name, value)
+
+#endif
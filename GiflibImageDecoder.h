@@ -2,8 +2,14 @@
 
 #include "IImageDecoder.h"
 #include "giflibpp.h"
-#include "BasicTimer.h"
+#include "AnimationClock.h"
+#include "ChunkQueue.h"
+#include "DecodePool.h"
+#include "AsyncDecodeQueue.h"
+#include "GifCanvas.h"
 
+#include <ppl.h>
+#include <deque>
 #include <mutex>
 
 enum DISPOSAL_METHODS
@@ -33,6 +39,230 @@ struct GifFrame
 	int transparentColor;
 	uint32_t delay;
 	DISPOSAL_METHODS disposal;
+	uint64_t fingerprint; //of the raster, rect, palette and transparency, see GiflibImageDecoder::FingerprintFrame
+	uint64_t start;       //ms into the animation this frame goes up
+	bool keyframe;        //leaves the canvas the same whatever was on it before, compositing can start here
+};
+
+//how a GiflibImageDecoder trades smoothness for cpu, delay changes only apply to frames loaded afterwards
+struct GifPlaybackPolicy
+{
+	uint32_t maxFrameRate;       //most frames a second that will be shown, 0 for no cap
+	uint32_t minFrameDelay;      //delays under this many ms are replaced by fallbackFrameDelay, the way browsers treat them
+	uint32_t fallbackFrameDelay;
+	bool skipLateFrames;         //jump to whatever is due instead of showing every frame late
+	GifPlaybackPolicy() : maxFrameRate(0), minFrameDelay(20), fallbackFrameDelay(100), skipLateFrames(true) {}
+};
+
+struct GifPlaybackMetrics
+{
+	uint64_t framesShown;
+	uint64_t framesSkipped;   //never shown because a later frame was already due
+	uint64_t framesCapped;    //ticks where a due frame was held back by maxFrameRate
+	uint64_t producerJumps;   //times compositing skipped ahead instead of working through every frame
+};
+
+//how a GiflibImageDecoder keeps what it decodes, cheapest on cpu first, admission control takes the first one
+//whose estimated peak fits in the DecodedMemoryBudget
+enum class GifStorageStrategy
+{
+	Eager,      //every raster kept decoded
+	Packed,     //rasters kept at their color map depth and unpacked when composited
+	Lazy,       //only the compressed stream kept, rasters decoded again each time they're composited
+	Downscaled, //lazy, and composited on a canvas 1/2, 1/4 or 1/8 the size
+	Refused     //doesn't fit even downscaled, nothing is decoded and Ready() fails
+};
+
+struct GifAdmission
+{
+	GifStorageStrategy strategy;
+	uint32_t canvasScale;     //1, 2, 4 or 8, the finest the canvas is allowed, zooming out can still make it coarser
+	uint64_t estimatedBytes;  //peak decoded memory for the chosen strategy
+	uint64_t budgetBytes;
+	uint32_t projectedFrames; //from the structural scan, extrapolated to the expected file size
+	GifAdmission() : strategy(GifStorageStrategy::Eager), canvasScale(1), estimatedBytes(0), budgetBytes(0), projectedFrames(0) {}
+};
+
+//a decoded raster as the store keeps it, 8 bits per pixel unless it has been packed down to its color map depth
+struct GifRasterSlot
+{
+	std::shared_ptr<const GifByteType> bits;
+	uint8_t bitsPerPixel;
+	size_t bytes;
+	GifRasterSlot() : bitsPerPixel(8), bytes(0) {}
+};
+
+//an append-only list whose copies share everything but the last element, so copying it to publish a new table
+//is O(1) instead of O(frames) and a whole file's worth of chunks costs O(frames) rather than O(frames squared)
+//a copy only reads the store below its own size - 1 and a push_back only writes at or above the writer's size - 1,
+//so nothing a published copy can see is ever written again, the last element is held by value in each copy
+//because the loader folds merged frames into it after it's been published
+//one writer at a time, and only ever appending to the newest copy
+template<typename T>
+class GifAppendList
+{
+private:
+	static const size_t FirstBlockSize = 16;
+	static const int MaxBlocks = 32;
+	//block b holds FirstBlockSize << b elements and is never moved once allocated
+	struct Store
+	{
+		std::unique_ptr<T[]> blocks[MaxBlocks];
+	};
+	std::shared_ptr<Store> _store;
+	size_t _size;
+	T _last;
+
+	static int Block(size_t index, size_t& offset)
+	{
+		int block = 0;
+		offset = index;
+		for (; offset >= (FirstBlockSize << block); block++)
+			offset -= FirstBlockSize << block;
+		return block;
+	}
+public:
+	class const_iterator
+	{
+	private:
+		const GifAppendList* _list;
+		size_t _index;
+	public:
+		const_iterator(const GifAppendList* list, size_t index) : _list(list), _index(index) {}
+		const T& operator*() const { return (*_list)[_index]; }
+		const T* operator->() const { return &(*_list)[_index]; }
+		const_iterator& operator++() { _index++; return *this; }
+		bool operator==(const const_iterator& other) const { return _index == other._index; }
+		bool operator!=(const const_iterator& other) const { return _index != other._index; }
+	};
+
+	GifAppendList() : _store(std::make_shared<Store>()), _size(0), _last() {}
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	const T& operator[](size_t index) const
+	{
+		if (index + 1 == _size)
+			return _last;
+		size_t offset;
+		auto block = Block(index, offset);
+		return _store->blocks[block][offset];
+	}
+	const T& back() const { return _last; }
+	//only this copy sees the change until it's published
+	T& back() { return _last; }
+	void push_back(const T& value)
+	{
+		if (_size > 0)
+		{
+			size_t offset;
+			auto block = Block(_size - 1, offset);
+			if (_store->blocks[block] == nullptr)
+				_store->blocks[block].reset(new T[FirstBlockSize << block]);
+			_store->blocks[block][offset] = std::move(_last);
+		}
+		_last = value;
+		_size++;
+	}
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, _size); }
+};
+
+//published by the loader as a whole and never modified afterwards, the renderer
+//grabs whichever table is current with atomic_load and never waits on the loader
+//copying one to add frames shares everything already published, see GifAppendList
+struct GifFrameTable
+{
+	GifAppendList<GifFrame> frames;
+	GifAppendList<std::shared_ptr<const SavedImage>> images;
+	bool isLoaded;
+	int loopCount;
+	uint64_t totalDelay;
+	//frames that wouldn't have changed anything on screen, folded into the entry before them
+	size_t mergedFrames;
+	GifAppendList<ExtensionBlock> mergedExtensions;
+	//set while every frame so far uses the global color map, canvases at full scale are then kept as indices into it
+	//the first local color map clears it for good and canvases go back to BGRA as they're next rebuilt
+	std::shared_ptr<const GifCanvasPalette> indexedPalette;
+	bool localColorMaps;
+	GifFrameTable() : isLoaded(false), loopCount(LOOP_COUNT_UNSPECIFIED), totalDelay(0), mergedFrames(0), localColorMaps(false) {}
+	//how many times the whole animation is shown, 0 for forever
+	//no NETSCAPE2.0 block means play once, otherwise the count is the number of repeats after the first play
+	uint32_t PlayCount() const
+	{
+		if (loopCount == LOOP_COUNT_UNSPECIFIED)
+			return 1;
+		return loopCount == 0 ? 0 : static_cast<uint32_t>(loopCount) + 1;
+	}
+};
+
+//a rectangle of image pixels, right and bottom are exclusive
+struct GifRegion
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+	bool Empty() const { return right <= left || bottom <= top; }
+	bool Contains(const GifRegion& other) const
+	{
+		return other.Empty() || (left <= other.left && top <= other.top && right >= other.right && bottom >= other.bottom);
+	}
+	GifRegion Union(const GifRegion& other) const
+	{
+		if (Empty())
+			return other;
+		if (other.Empty())
+			return *this;
+		GifRegion region = { left < other.left ? left : other.left, top < other.top ? top : other.top,
+			right > other.right ? right : other.right, bottom > other.bottom ? bottom : other.bottom };
+		return region;
+	}
+	GifRegion Intersect(const GifRegion& other) const
+	{
+		GifRegion region = { left > other.left ? left : other.left, top > other.top ? top : other.top,
+			right < other.right ? right : other.right, bottom < other.bottom ? bottom : other.bottom };
+		return region;
+	}
+};
+
+//a frame composited ahead of time by the producer, waiting for the renderer to pick it up
+struct GifAheadFrame
+{
+	uint64_t sequence; //position in playback counting every loop, frameIndex is this modulo the frame count
+	size_t frameIndex;
+	std::unique_ptr<GifCanvas> pixels;
+	int scale; //canvas scale it was composited at
+	GifRegion region; //only this much of the canvas was composited, the rest is stale
+	GifRegion dirty; //image pixels that can differ from the frame before it in the ring, everything for the first after a flush
+};
+
+//what is left of the file once parsed, read again to decode shed rasters and to materialise extension views
+//chunks are held as they arrived only until the parser and the structure scan are both past them, after that all that
+//remains is what retain() copied out, the compressed rasters and any extensions the caller asked to keep
+//the mutex lets compositing read it while the loader is still appending
+struct gif_source
+{
+	struct retained_range
+	{
+		uint32_t offset;
+		std::vector<uint8_t> bytes;
+	};
+	mutable std::mutex sourceMutex;
+	std::vector<Windows::Storage::Streams::IBuffer^> chunks;
+	std::vector<uint8_t*> chunkBytes;
+	std::vector<uint32_t> chunkStarts;
+	//sorted by offset, never overlapping
+	std::vector<retained_range> retained;
+	uint32_t length;
+	gif_source() : length(0) {}
+	void append(Windows::Storage::Streams::IBuffer^ chunk);
+	//copies [offset, offset + count) out so it outlives the chunks, false if they have already let go of it
+	bool retain(uint32_t offset, uint32_t count);
+	//lets go of every chunk that ends at or before offset
+	void release_before(uint32_t offset);
+	bool read_at(uint32_t offset, GifByteType* buf, uint32_t count) const;
+private:
+	bool read_chunks(uint32_t offset, GifByteType* buf, uint32_t count) const;
 };
 
 struct gif_user_data
@@ -40,19 +270,27 @@ struct gif_user_data
 	unsigned int length;
 	unsigned int position;
 	unsigned int revertPos;
+	unsigned int baseOffset; //stream offset of buffer[0]
 	std::vector<Windows::Storage::Streams::IBuffer^> buffer;
 	bool finishedLoad;
+	concurrency::cancellation_token cancelToken;
 	int read(GifByteType * buf, unsigned int length);
-	void addData(Windows::Storage::Streams::IBuffer^ pbuffer);
-	gif_user_data(concurrency::cancellation_token pcancelToken)
+	int skip(unsigned int length);
+	unsigned int tell() const { return baseOffset + position; }
+	bool addData(Windows::Storage::Streams::IBuffer^ pbuffer);
+	//is_canceled is a read of the token's state flag, cheap enough to poll per row
+	bool canceled() const { return cancelToken.is_canceled(); }
+	gif_user_data(concurrency::cancellation_token pcancelToken) : cancelToken(pcancelToken)
 	{
 		finishedLoad = false;
 		position = 0;
+		baseOffset = 0;
 	}
 
 	void init(unsigned int pposition, Windows::Storage::Streams::IBuffer^ pbuffer)
 	{
 		revertPos = 0;
+		baseOffset = 0;
 		position = pposition;
 		length = pbuffer->Length;
 		buffer.push_back(pbuffer);
@@ -95,89 +333,300 @@ struct gif_user_data
 			buffer.erase(buffer.begin(), buffer.begin() + endBufferIndex);
 		}
 		length -= consumedBufferSize;
+		baseOffset += consumedBufferSize;
 		revertPos = position - consumedBufferSize;
 		position = revertPos;
 		
 	}
 };
 
-class GiflibImageDecoder : public IImageDecoder
+class GiflibImageDecoder : public IImageDecoder, public std::enable_shared_from_this<GiflibImageDecoder>
 {
 private:
+	//most we'll let the download get ahead of parsing
+	static const uint32_t MaxQueuedBytes = 1024 * 1024;
+	ChunkQueue _chunkQueue;
 	std::mutex _loadMutex;
-	std::mutex _frameMutex;
+	//everything parsed out of the file lives here, declared first so it outlives _gifFile and _frameTable
+	GifMonotonicResource _parseArena;
 	std::unique_ptr<GifFileType<gif_user_data>> _gifFile;
-	std::vector<GifFrame> _frames;
-	std::vector<SavedImage> _decodedImages;
-	std::unique_ptr<uint32_t[]> _renderBuffer;
+	//only touch through std::atomic_load/std::atomic_store
+	std::shared_ptr<const GifFrameTable> _frameTable;
+	//canvas the decode-ahead producer composites into, only touched from the producer job
+	std::unique_ptr<GifCanvas> _renderBuffer;
+	//tiles held by _renderBuffer and _asyncCanvas, kept up to date by whoever owns them so they can be read without racing them
+	std::atomic<size_t> _renderBytes;
+	std::atomic<size_t> _asyncBytes;
+	int _aheadFrame;
+	int _renderScale;
+	GifRegion _renderRegion;
+	//what the producer has changed since it last emitted a frame, in generation _renderDirtyGeneration
+	GifRegion _renderDirty;
+	uint32_t _renderDirtyGeneration;
+	double _compositeCostMs;
+	LARGE_INTEGER _counterFrequency;
+	//ring of finished frames between the producer and DecodeRectangle, everything below is guarded by _aheadMutex
+	static const size_t MinAheadDepth = 2;
+	static const size_t MaxAheadDepth = 6;
+	static const size_t MaxAheadBytes = 32 * 1024 * 1024;
+	std::mutex _aheadMutex;
+	std::deque<GifAheadFrame> _aheadFrames;
+	std::vector<std::unique_ptr<GifCanvas>> _freeAheadBuffers;
+	size_t _aheadDepth;
+	uint64_t _aheadNextSequence;
+	uint64_t _lastEmittedStart;
+	bool _hasEmitted;
+	//bumped whenever the renderer jumps, so a frame that was in flight at the time gets thrown away
+	uint32_t _aheadGeneration;
+	bool _producingAhead;
+	//what the producer composites, it grows as soon as DecodeRectangle asks for anything outside it and shrinks
+	//each time a frame is shown to whatever was asked for while the one before it was on screen
+	GifRegion _regionOfInterest;
+	GifRegion _requestedRegion;
+	//DecodeRectangleAsync composites a rect or scale the frame on screen doesn't cover on a canvas of its own, so it
+	//never disturbs the producer, newer requests replace older ones still waiting for the pool
+	std::shared_ptr<AsyncDecodeQueue> _asyncQueue;
+	std::unique_ptr<GifCanvas> _asyncCanvas;
+	size_t _asyncFrame;
+	int _asyncScale;
+	GifRegion _asyncRegion;
+	//held by DecodePixels for the whole composite, so shedding can wait for it rather than pull the canvas out from under it
+	std::mutex _asyncMutex;
+	//the last async result and the buffer the next one is copied into, swapped so similar requests don't reallocate
+	std::mutex _pixelsMutex;
+	DecodedPixels _decodedPixels;
+	DecodedPixels _sparePixels;
+	//CompositeFrameInto draws straight into the caller's memory, the wrapper is kept so the next call with the same
+	//memory, stride and rectangle only has to draw the frames since the last one
+	std::mutex _intoMutex;
+	std::unique_ptr<GifCanvas> _intoCanvas;
+	const uint32_t* _intoPixels;
+	size_t _intoStride;
+	GifRegion _intoRegion;
+	size_t _intoFrame;
+	//decoded rasters by frame table index, moved out of the SavedImages as they're published so they can be shed
+	//while suspended and decoded again from _source by Raster() when compositing next needs them
+	static const size_t SuspendRasterWindow = 3;
+	std::mutex _rasterMutex;
+	std::vector<GifRasterSlot> _rasters;
+	size_t _rasterBytes;
+	//admission control, the finest canvas scale is settled from the header in the constructor and never changes, the raster
+	//strategy only ever moves towards cheaper storage as the structural scan sees more of the file
+	//producer canvas, display, async canvas, DM_PREVIOUS scratch and the smallest ring
+	static const size_t AdmissionCanvasCount = MinAheadDepth + 4;
+	static const uint32_t MaxCanvasScale = 8;
+	mutable std::mutex _admissionMutex;
+	GifAdmission _admission;
+	GifStructureScan _scan;
+	std::atomic<GifStorageStrategy> _rasterStrategy;
+	int _minCanvasScale;
+	//scale new composites are made at, RenderSize moves it and throws away the ring, every canvas remembers the scale
+	//it was made at so one composited before the change is rebuilt rather than read at the wrong size
+	std::atomic<int> _canvasScale;
+	//set once the last loop has been shown, after which only _displayBuffer is kept
+	bool _playbackFinished;
+	std::atomic<bool> _animationReleased;
+	//frame currently on screen, swapped in by Advance and uploaded by DecodeRectangle under _displayMutex
+	std::mutex _displayMutex;
+	std::unique_ptr<GifCanvas> _displayBuffer;
+	//what the untouched parts of _displayBuffer are uploaded from
+	std::unique_ptr<uint32_t[]> _backgroundTile;
+	int _displayedFrame;
+	int64_t _displayedSequence;
+	ClockTicks _displayedAt;
+	int _displayScale;
+	GifRegion _displayRegion;
+	//bumped each time a frame is swapped in, with what it changed kept for the last few so a sink that is a frame or
+	//two behind is only sent the difference
+	static const size_t DisplayDirtyHistory = 8;
+	uint64_t _displayVersion;
+	GifRegion _displayDirty[DisplayDirtyHistory];
+	//set by RenderSize and when the region of interest grows, tells Advance to replace the frame on screen even if
+	//playback hasn't moved
+	std::atomic<bool> _canvasInvalidated;
+	mutable std::mutex _policyMutex;
+	GifPlaybackPolicy _policy;
+	std::atomic<uint64_t> _framesShown;
+	std::atomic<uint64_t> _framesSkipped;
+	std::atomic<uint64_t> _framesCapped;
+	std::atomic<uint64_t> _producerJumps;
 	gif_user_data _loaderData;
+	gif_source _source;
+	std::atomic<bool> _retainExtensions;
 	Windows::Foundation::Size _renderSize;
-	bool _isLoaded;
-	int	_currentFrame;
-	int	_lastFrame;
+	//playback state below is only touched from Advance, which the scheduler never runs twice at once
+	std::atomic<int> _currentFrame;
+	uint64_t _currentSequence;
+	uint64_t _msUntilNextFrame;
 	bool _startedRendering;
+	//suspended decoders still parse, but only once everything on screen has been served
+	//and nothing is composited until Resume, see ShedMemory for what is thrown away in the meantime
+	std::atomic<bool> _suspended;
 	concurrency::cancellation_token _cancelToken;
-	BasicTimer^ _timer;
-	void MapRasterBits(uint8_t* rasterBits, std::unique_ptr<uint32_t[]>& targetFrame, ColorMapObject& colorMap, int top, int left, int bottom, int right, int width, int32_t transparencyColor);
-	bool Update(float total, float delta);
-	uint32_t GetFrameDelay(size_t index) const;
-	size_t FrameCount() const;
+	//playback time is _playbackClock.Now() - _playbackStart, rate and pause live in the scaled clock
+	ScaledClock _playbackClock;
+	ClockTicks _playbackStart;
+	//top, left, bottom and right are image pixels already clipped to the image, at scale 1 the raster maps straight
+	//onto the canvas, coarser canvases average each scale x scale block as the palette is looked up
+	void MapRasterBits(const uint8_t* rasterBits, int rasterWidth, int rasterLeft, int rasterTop, GifCanvas& target, const ColorMapObject& colorMap,
+		int top, int left, int bottom, int right, int imageWidth, int imageHeight, int scale, int32_t transparencyColor);
+	uint32_t CanvasWidth(int scale) const { return (_gifFile->SWidth + scale - 1) / scale; }
+	uint32_t CanvasHeight(int scale) const { return (_gifFile->SHeight + scale - 1) / scale; }
+	GifRegion FullRegion() const;
+	GifRegion ImageRegion(Windows::Foundation::Rect rect, Windows::Foundation::Size renderSize) const;
+	//surface pixels per image pixel along each axis for renderSize, 1 until RenderSize has been told anything
+	Windows::Foundation::Size SurfaceScale(Windows::Foundation::Size renderSize) const;
+	int CanvasScaleFor(Windows::Foundation::Size renderSize) const;
+	bool DisplayCovers(const GifRegion& region);
+	Windows::Foundation::Rect DecodePixels(Windows::Foundation::Rect requestedRect, Windows::Foundation::Size renderSize, size_t frameIndex);
+	void RequestRegion(const GifRegion& region);
+	bool Update(const GifFrameTable& frameTable, ClockTicks elapsed);
+	void SubmitDecodeWorker();
+	void ResubmitDecodeWorker();
+	void RunDecodeWorker();
+	void ProcessChunk(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize);
+	void TrimSource(size_t imagesBefore, size_t mergedBefore, bool isLoaded);
+	std::shared_ptr<const GifFrameTable> FrameTable() const;
+	//each band gets at least this many pixels, so a region needs twice it, about 724x724, before it is split at all
+	static const int MinBandPixels = 256 * 1024;
+	//splits rows [top, bottom) of a width wide region into bands and runs bandFunc(bandTop, bandBottom) on each in parallel
+	template<typename BANDFUNC>
+	static void ForEachBand(int top, int bottom, int width, BANDFUNC bandFunc)
+	{
+		int rows = bottom - top;
+		int bandCount = width > 0 && rows > 0 ? static_cast<int>((static_cast<int64_t>(rows) * width) / MinBandPixels) : 0;
+		if (bandCount > rows)
+			bandCount = rows;
+		if (bandCount < 2)
+		{
+			if (rows > 0)
+				bandFunc(top, bottom);
+			return;
+		}
+		concurrency::parallel_for(0, bandCount, [&](int band)
+		{
+			bandFunc(top + (rows * band) / bandCount, top + (rows * (band + 1)) / bandCount);
+		});
+	}
+	void ScheduleDecodeAhead();
+	void DecodeAhead();
+	void UpdateAheadDepth(double compositeMs, uint32_t frameDelay);
+	bool TakeAheadFrame(uint64_t sequence, bool skipLateFrames);
+	int64_t QueuedAheadSequence();
+	void RecycleAheadBuffer(std::unique_ptr<GifCanvas> pixels, int scale);
+	uint64_t SequenceStart(const GifFrameTable& frameTable, uint64_t sequence) const;
+	bool ReleaseAnimation();
+	void ShedMemory(size_t keepRasters);
+	void DropDisplayedFrame();
+	void ReportDecodedBytes();
+	std::shared_ptr<const GifByteType> Raster(const GifFrameTable& frameTable, size_t frameIndex);
+	GifRasterSlot StoreRaster(std::unique_ptr<GifByteType[]> raster, size_t pixels, int bitsPerPixel, GifStorageStrategy strategy);
+	void AdmitInitial();
+	void Admit(uint32_t expectedSize);
+	static std::shared_ptr<const GifCanvasPalette> IndexedPalette(const ColorMapObject& colorMap, int backgroundColor);
+	static uint64_t FingerprintFrame(const SavedImage& image, const ColorMapObject& colorMap, int32_t transparentColor);
+	static bool IsNoOpFrame(const SavedImage& image, const ColorMapObject& colorMap, const GifFrame& frame,
+		const SavedImage& previousImage, const GifByteType* previousRaster, const ColorMapObject& previousColorMap, const GifFrame& previousFrame);
 
 public:
 	static std::shared_ptr<IImageDecoder> MakeImageDecoder(Windows::Storage::Streams::IBuffer^ initialBuffer, concurrency::cancellation_token canceledToken);
 	GiflibImageDecoder(Windows::Storage::Streams::IBuffer^ initialBuffer, concurrency::cancellation_token canceledToken);
-	virtual ~GiflibImageDecoder() {};
-	virtual void LoadHandler(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize);
+	virtual ~GiflibImageDecoder();
+	virtual concurrency::task<void> LoadHandler(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize);
 	virtual Windows::Foundation::Size MaxSize();
 	virtual Windows::Foundation::Size DefaultSize();
 	virtual void RenderSize(Windows::Foundation::Size size);
 	virtual concurrency::task<Windows::Foundation::Rect> DecodeRectangleAsync(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext);
 	virtual bool CanDecode(Windows::Foundation::Rect rect);
-	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& copyDestination, bool& requeue);
+	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, IFrameSink& sink, bool& requeue);
+	virtual bool Advance(ClockTicks& nextDelay);
 	virtual void Suspend();
 	virtual void Resume();
+	//bytes of decoded rasters and composited canvases currently held, the compressed source isn't counted
+	size_t DecodedBytes();
+	virtual size_t EvictDecodedMemory();
+	GifAdmission Admission() const;
+	//whether the frame on screen was composited as palette indices, which stops for good once a local color map turns up
+	bool DisplayIndexed();
+	//views of every extension that isn't decoded during parsing, file level ones last
+	std::vector<ExtensionBlock> Extensions();
+	//throws once the view's bytes are gone, which is as soon as the parser has passed them unless RetainExtensionBytes
+	//was on when they were parsed
+	std::vector<GifByteType> ExtensionBytes(const ExtensionBlock& extension);
+	//off by default so comments and XMP cost nothing, turn it on before loading to keep their payloads for ExtensionBytes
+	void RetainExtensionBytes(bool retain);
+	//defaults to the shared RealClock, hand it a ManualClock to step playback yourself
+	void Clock(std::shared_ptr<IAnimationClock> clock);
+	//1.0 is normal speed, playback continues from the current position when the rate changes
+	void PlaybackRate(double rate);
+	double PlaybackRate() const;
+	void Pause();
+	void Play();
+	bool IsPaused() const;
+	void Policy(const GifPlaybackPolicy& policy);
+	GifPlaybackPolicy Policy() const;
+	GifPlaybackMetrics PlaybackMetrics() const;
+	//composites frame table entry frameIndex at full size into memory the caller owns, no Windows types involved so it
+	//works headless, pixels gets the same BGRA DecodeRectangle uploads for the image rectangle rect, with stride bytes
+	//between rows and pixels[0] being (rect.left, rect.top)
+	//passing the same pixels, stride and rect again with a later frame only draws the frames in between straight into
+	//them, so don't touch the pixels between calls, anything else is composited from the nearest keyframe
+	//returns false without touching pixels if there is no such frame yet or rect isn't inside the image
+	bool CompositeFrameInto(size_t frameIndex, uint32_t* pixels, size_t stride, const GifRegion& rect);
 private:
+	//the only place a table is published, always from the decode worker, so each new table is built from the last one
+	//published and a plain store is enough, GifAppendList relies on nothing else appending to the newest copy
 	template<typename GIFTYPE>
-	void LoadGifFrames(GIFTYPE& gifFile, std::vector<GifFrame>& frames)
+	void LoadGifFrames(GIFTYPE& gifFile, bool isLoaded)
 	{
-		std::lock_guard<std::mutex> readGuard(_frameMutex);
-		std::copy(make_move_iterator(gifFile->SavedImages.begin()), make_move_iterator(gifFile->SavedImages.end()), std::back_inserter(_decodedImages));
-		gifFile->SavedImages.clear();
+		auto policy = Policy();
+		auto currentTable = FrameTable();
+		if (gifFile->SavedImages.empty() && currentTable->isLoaded == isLoaded)
+			return;
+
+		//shares the frames already published, only what this chunk adds is copied, see GifAppendList
+		auto frameTable = std::make_shared<GifFrameTable>(*currentTable);
+		auto& frames = frameTable->frames;
+		frameTable->isLoaded = isLoaded;
+		frameTable->loopCount = gifFile->LoopCount;
 		uint32_t width = gifFile->SWidth;
 		uint32_t height = gifFile->SHeight;
+		if (frameTable->indexedPalette == nullptr && !frameTable->localColorMaps && frames.empty())
+			frameTable->indexedPalette = IndexedPalette(gifFile->SColorMap, gifFile->SBackGroundColor);
 
-		for (auto i = frames.size(); i < _decodedImages.size(); i++)
+		for (auto& savedImage : gifFile->SavedImages)
 		{
 			uint32_t delay = 100;
 			DISPOSAL_METHODS disposal = DISPOSAL_METHODS::DM_NONE;
 			int32_t transparentColor = -1;
 
-			auto extensionBlocks = _decodedImages[i].ExtensionBlocks;
-			for (size_t ext = 0; ext < _decodedImages[i].ExtensionBlocks.size(); ext++)
+			if (savedImage.HasGraphicsControl)
 			{
-				if (extensionBlocks[ext].Function == 0xF9)
-				{
-					GraphicsControlBlock gcb(extensionBlocks[ext]);
-
-					delay = gcb.DelayTime * 10;
+				const auto& gcb = savedImage.GraphicsControl;
 
-					if (delay < 20)
-					{
-						delay = 100;
-					}
+				delay = gcb.DelayTime * 10;
 
-					disposal = (DISPOSAL_METHODS)gcb.DisposalMode;
-					transparentColor = gcb.TransparentColor;
+				if (delay < policy.minFrameDelay)
+				{
+					delay = policy.fallbackFrameDelay;
 				}
+
+				disposal = (DISPOSAL_METHODS)gcb.DisposalMode;
+				transparentColor = gcb.TransparentColor;
 			}
-			auto& imageDesc = _decodedImages[i].ImageDesc;
+			auto& imageDesc = savedImage.ImageDesc;
 			int right = imageDesc.Left + imageDesc.Width;
 			int bottom = imageDesc.Top + imageDesc.Height;
 			int top = imageDesc.Top;
 			int left = imageDesc.Left;
+			auto& colorMap = (imageDesc.ColorMap.Colors.size() != 0 ? imageDesc.ColorMap : gifFile->SColorMap);
+			if (imageDesc.ColorMap.Colors.size() != 0)
+			{
+				frameTable->localColorMaps = true;
+				frameTable->indexedPalette = nullptr;
+			}
 
-			frames.push_back(GifFrame());
-			auto& frame = frames.back();
+			GifFrame frame;
 			frame.transparentColor = transparentColor;
 			frame.height = height;
 			frame.width = width;
@@ -187,17 +636,52 @@ private:
 			frame.right = right;
 			frame.left = left;
 			frame.disposal = disposal;
+			frame.fingerprint = FingerprintFrame(savedImage, colorMap, transparentColor);
+			frame.start = frameTable->totalDelay;
+			frame.keyframe = disposal == DISPOSAL_METHODS::DM_BACKGROUND ||
+				(transparentColor == -1 && left <= 0 && top <= 0 && right >= (int)width && bottom >= (int)height);
+			frameTable->totalDelay += delay;
+
+			//screen recorders love emitting frames that change nothing, showing the previous entry for longer looks the same
+			//and saves a composite, an invalidate and an upload
+			if (!frames.empty())
+			{
+				auto& previousImage = *frameTable->images.back();
+				auto& previousColorMap = (previousImage.ImageDesc.ColorMap.Colors.size() != 0 ? previousImage.ImageDesc.ColorMap : gifFile->SColorMap);
+				std::shared_ptr<const GifByteType> previousRaster;
+				{
+					//packed or lazily kept rasters aren't worth unpacking just for this, they simply don't merge
+					std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+					auto& previousSlot = _rasters[frameTable->images.size() - 1];
+					if (previousSlot.bitsPerPixel == 8)
+						previousRaster = previousSlot.bits;
+				}
+				if (IsNoOpFrame(savedImage, colorMap, frame, previousImage, previousRaster.get(), previousColorMap, frames.back()))
+				{
+					frames.back().delay += delay;
+					frameTable->mergedFrames++;
+					for (auto& extension : savedImage.ExtensionBlocks)
+						frameTable->mergedExtensions.push_back(extension);
+					continue;
+				}
+			}
+
+			frames.push_back(frame);
+			{
+				auto slot = StoreRaster(std::move(savedImage.RasterBits), static_cast<size_t>(imageDesc.Width) * imageDesc.Height, colorMap.BitsPerPixel, _rasterStrategy);
+				std::lock_guard<std::mutex> rasterGuard(_rasterMutex);
+				_rasterBytes += slot.bytes;
+				_rasters.push_back(slot);
+			}
+			frameTable->images.push_back(std::make_shared<SavedImage>(std::move(savedImage)));
 		}
-		if (frames.size() != _decodedImages.size())
-			throw ref new Platform::InvalidArgumentException("image count didnt match frame size");
+		gifFile->SavedImages.clear();
+		std::atomic_store(&_frameTable, std::shared_ptr<const GifFrameTable>(frameTable));
 	}
 
 	template<typename GIFTYPE>
-	void LoadGifFrame(GIFTYPE& gifFile, const std::vector<GifFrame>& frames, std::unique_ptr<uint32_t[]>& buffer, size_t currentFrame, size_t targetFrame)
+	static uint32_t CanvasBackground(GIFTYPE& gifFile)
 	{
-		uint32_t width = gifFile->SWidth;
-		uint32_t height = gifFile->SHeight;
-
 		bgraColor bgColor = { 0, 0, 0, 0 };
 		if (gifFile->SColorMap.Colors.size() != 0 && gifFile->SBackGroundColor > 0)
 		{
@@ -207,62 +691,96 @@ private:
 			bgColor.blue = color.Blue;
 			bgColor.alpha = 255;
 		}
+		uint32_t background;
+		memcpy(&background, &bgColor, 4);
+		return background;
+	}
 
-		std::unique_ptr<uint32_t[]> lastFrame = nullptr;
+	//only the part of the canvas under region is composited, anything outside it is left as it was, the region is
+	//widened to whole canvas pixels so a downscaled block never mixes composited and stale image pixels
+	//returns the image pixels that may have changed
+	template<typename GIFTYPE>
+	GifRegion LoadGifFrame(GIFTYPE& gifFile, const GifFrameTable& frameTable, std::unique_ptr<GifCanvas>& buffer, size_t currentFrame, size_t targetFrame, int scale, const GifRegion& region)
+	{
+		GIF_TRACE_SCOPE_VALUE("LoadGifFrame", targetFrame);
+		auto& frames = frameTable.frames;
+		uint32_t width = CanvasWidth(scale);
+		uint32_t height = CanvasHeight(scale);
+		int clipLeft = max(0, region.left / scale);
+		int clipTop = max(0, region.top / scale);
+		int clipRight = max(clipLeft, min((int)width, (region.right + scale - 1) / scale));
+		int clipBottom = max(clipTop, min((int)height, (region.bottom + scale - 1) / scale));
+
+		auto background = CanvasBackground(gifFile);
+		GifRegion clipRegion = { clipLeft * scale, clipTop * scale, min((int)gifFile->SWidth, clipRight * scale), min((int)gifFile->SHeight, clipBottom * scale) };
+		GifRegion changed = GifRegion();
 
+		//indices only work at full scale, a box filtered pixel is rarely a palette color
+		//a canvas in the wrong format (a local color map turned up, or the scale changed) is started again, memory
+		//wrapped for CompositeFrameInto is always BGRA and stays as it is
+		auto palette = scale == 1 ? frameTable.indexedPalette : nullptr;
+		if (buffer != nullptr && !buffer->External() && buffer->Indexed() != (palette != nullptr))
+			buffer = nullptr;
+
+		//tiles are allocated as frames draw into them, clearing to the background frees any cleared whole
+		std::unique_ptr<GifCanvas> lastFrame = nullptr;
 		if (buffer == nullptr || targetFrame == 0 || currentFrame > targetFrame)
 		{
 			if (buffer == nullptr)
 			{
-				buffer = std::unique_ptr<uint32_t[]>(new uint32_t[width * height]);
+				buffer = palette != nullptr ? std::unique_ptr<GifCanvas>(new GifCanvas(width, height, palette)) : std::unique_ptr<GifCanvas>(new GifCanvas(width, height, background));
 				currentFrame = 0;
 			}
 
 			if (currentFrame > targetFrame)
 				currentFrame = 0;
 
-			for (decltype(height) y = 0; y < height; y++)
+			buffer->Clear(clipLeft, clipTop, clipRight, clipBottom);
+			changed = clipRegion;
+		}
+
+		//nothing drawn before the last keyframe can show through it
+		for (auto k = std::min<size_t>(targetFrame, frames.size()); k > currentFrame && !frames.empty(); k--)
+		{
+			if (k < frames.size() && frames[k].keyframe)
 			{
-				for (decltype(width) x = 0; x < width; x++)
-				{
-					auto offset = y * width + x;
-					memcpy(buffer.get() + offset, &bgColor, 4);
-				}
+				currentFrame = k;
+				break;
 			}
 		}
 
-		for (auto i = currentFrame; i < _frames.size() && i <= targetFrame; i++)
+		for (auto i = currentFrame; i < frames.size() && i <= targetFrame; i++)
 		{
 			auto& frame = frames[i];
-			auto& decodeFrame = _decodedImages[i];
+			auto& decodeFrame = *frameTable.images[i];
+			auto raster = Raster(frameTable, i);
 			auto disposal = frame.disposal;
-			auto colorMap = (decodeFrame.ImageDesc.ColorMap.Colors.size() != 0 ? decodeFrame.ImageDesc.ColorMap : (gifFile->SColorMap.Colors.size() != 0 ? gifFile->SColorMap : ColorMapObject{}));
+			auto& colorMap = (decodeFrame.ImageDesc.ColorMap.Colors.size() != 0 ? decodeFrame.ImageDesc.ColorMap : gifFile->SColorMap);
 
 			if (disposal == DISPOSAL_METHODS::DM_PREVIOUS)
 			{
 				if (lastFrame == nullptr)
-					lastFrame = std::unique_ptr<uint32_t[]>(new uint32_t[width * height]);
+					lastFrame = buffer->CreateCompatible();
 
-				memcpy(lastFrame.get(), buffer.get(), width * height * sizeof(uint32_t));
+				lastFrame->CopyFrom(*buffer, clipLeft, clipTop, clipRight, clipBottom);
 			}
 
 			switch (disposal)
 			{
 			case DISPOSAL_METHODS::DM_BACKGROUND:
-				for (decltype(height) y = 0; y < height; y++)
-				{
-					for (decltype(width) x = 0; x < width; x++)
-					{
-						int offset = y * width + x;
-						memcpy(buffer.get() + offset, &bgColor, 4);
-					}
-				}
+				buffer->Clear(clipLeft, clipTop, clipRight, clipBottom);
+				changed = clipRegion;
 				break;
 			case DISPOSAL_METHODS::DM_PREVIOUS:
-				memcpy(buffer.get(), lastFrame.get(), width * height * sizeof(uint32_t));
+				buffer->CopyFrom(*lastFrame, clipLeft, clipTop, clipRight, clipBottom);
 				break;
 			}
-			MapRasterBits(decodeFrame.RasterBits.get(), buffer, colorMap, max(0, frame.top), max(frame.left, 0), min((int)height, frame.bottom), min((int)width, frame.right), (int)width, frame.transparentColor);
+			MapRasterBits(raster.get(), decodeFrame.ImageDesc.Width, frame.left, frame.top, *buffer, colorMap,
+				max(clipTop * scale, frame.top), max(frame.left, clipLeft * scale), min(min((int)gifFile->SHeight, clipBottom * scale), frame.bottom), min(min((int)gifFile->SWidth, clipRight * scale), frame.right),
+				(int)gifFile->SWidth, (int)gifFile->SHeight, scale, frame.transparentColor);
+			GifRegion frameRegion = { frame.left, frame.top, frame.right, frame.bottom };
+			changed = changed.Union(frameRegion.Intersect(clipRegion));
 		}
+		return changed;
 	}
 };
\ No newline at end of file
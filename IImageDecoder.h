@@ -2,12 +2,18 @@
 
 #include <ppltasks.h>
 #include <d2d1_1.h>
+#include "AnimationClock.h"
+#include "DecodedMemoryBudget.h"
+#include "FrameSink.h"
+#include "DecoderStats.h"
 
-class IImageDecoder
+class IImageDecoder : public IDecodedMemoryOwner
 {
 protected:
 	uint32_t _maxRenderDimension;
 	concurrency::task_completion_event<void> _readySource;
+	//decoders record into this as they go, Stats() hands out snapshots
+	DecoderStatsCounters _stats;
 	IImageDecoder() 
 	{ 
 #if WINDOWS_PHONE_APP
@@ -19,7 +25,8 @@ protected:
 #endif
 	}
 public:
-	virtual void LoadHandler(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize) { /*default to doing nothing */ };
+	//the returned task completes once the decoder has room for the buffer, the loader waits on it before reading more
+	virtual concurrency::task<void> LoadHandler(Windows::Storage::Streams::IBuffer^ buffer, bool finished, uint32_t expectedSize) { /*default to doing nothing */ return concurrency::task_from_result(); };
 	virtual concurrency::task<void> Ready() { return concurrency::task<void>(_readySource); }
 	virtual Windows::Foundation::Size MaxSize() = 0;
 	virtual Windows::Foundation::Size DefaultSize() = 0;
@@ -27,8 +34,20 @@ public:
 	//handler is the rendered rect to invalidate
 	virtual concurrency::task<Windows::Foundation::Rect> DecodeRectangleAsync(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext) = 0;
 	virtual bool CanDecode(Windows::Foundation::Rect rect) = 0;
-	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& copyDestination, bool& requeue) = 0;
+	//brings sink up to date with requestedRect, only sending what changed since the sink was last fed by this decoder
+	//both rects are in surface pixels, the image at the last RenderSize
+	//returns the rect the sink's target covers, empty if there is nothing to show
+	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, IFrameSink& sink, bool& requeue) = 0;
+	//animated decoders move playback forward here, called from the decode pool by the AnimationScheduler
+	//returns true if what DecodeRectangle would draw has changed, nextDelay is negative once there is nothing left to animate
+	virtual bool Advance(ClockTicks& nextDelay) { nextDelay = -1; return false; }
 	virtual void Suspend() = 0;
 	virtual void Resume() = 0;
+	//decoders that report to DecodedMemoryBudget override this, the default holds nothing worth evicting
+	virtual size_t EvictDecodedMemory() { return 0; }
+	//live counters and latency percentiles for this decoder, safe to call from any thread
+	virtual DecoderStats Stats() const { return _stats.Snapshot(); }
+	//the same for every decoder in the process added together
+	static DecoderStats ProcessStats() { return DecoderStatsCounters::Process().Snapshot(); }
 	virtual ~IImageDecoder() {}
 };
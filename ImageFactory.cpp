@@ -53,8 +53,9 @@ task<tuple<shared_ptr<IImageRenderer>, ImageSource^>> ImageFactory::MakeRenderer
 					}
 				}, [=](IBuffer^ buffer, bool finished, uint32_t expectedSize)
 				{
+					auto admitted = task_from_result();
 					if(imageFactory->_decoder != nullptr)
-						imageFactory->_decoder->LoadHandler(buffer, finished, expectedSize);
+						admitted = imageFactory->_decoder->LoadHandler(buffer, finished, expectedSize);
 
 					if(buffer != nullptr)
 						imageFactory->_loadedBytes += buffer->Length;
@@ -66,6 +67,7 @@ task<tuple<shared_ptr<IImageRenderer>, ImageSource^>> ImageFactory::MakeRenderer
 					{
 						OutputDebugString(L"Invalid expected size");
 					}
+					return admitted;
 				}, cancelToken),
 			[=](IRandomAccessStream^ resultStream)
 			{
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "ResourceLoader.h"
 #include "task_helper.h"
+#include "GifTrace.h"
 
 #include <functional>
 #include <tuple>
@@ -35,7 +36,7 @@ bool starts_with(std::wstring const &fullString, std::wstring const &start)
 }
 
 task<IRandomAccessStream^> ResourceLoader::GetResource(String^ resourceLocator, std::function<std::tuple<bool, bool>(Windows::Storage::Streams::IBuffer^, uint32_t)> initialRead,
-  function<void(IBuffer^, bool, uint32_t)> dataReadHook, cancellation_token canceledToken)
+  function<task<void>(IBuffer^, bool, uint32_t)> dataReadHook, cancellation_token canceledToken)
 {
   std::wstring resourceStr(resourceLocator->Data(), resourceLocator->Length());
   auto loader = new ResourceLoader(canceledToken);
@@ -136,14 +137,21 @@ task<IRandomAccessStream^> ResourceLoader::BufferRandomAccessStream(IRandomAcces
   {
     if (bufferResult->Length >= 64 * 1024)
     {
-      _dataReadHook(bufferResult, false, _expectedByteCount);
-      return BufferRandomAccessStream(stream);
+      //don't read further ahead than the decoder is willing to buffer
+      return continue_void_task(_dataReadHook(bufferResult, false, _expectedByteCount),
+        [=]()
+      {
+        return BufferRandomAccessStream(stream);
+      }, errorHandler, _cancelToken);
     }
     else
     {
-      _dataReadHook(bufferResult, true, _expectedByteCount);
-      stream->Seek(0);
-      return task_from_result(stream);
+      return continue_void_task(_dataReadHook(bufferResult, true, _expectedByteCount),
+        [=]()
+      {
+        stream->Seek(0);
+        return task_from_result(stream);
+      }, errorHandler, _cancelToken);
     }
   }, errorHandler, _cancelToken);
 }
@@ -270,7 +278,19 @@ void ResourceLoader::GetBytesFromBuffer(Windows::Storage::Streams::IBuffer^ buff
 
 task<void> ResourceLoader::WriteBufferToResultStream(IBuffer^ buffer, bool finished)
 {
-  _dataReadHook(_dontBufferReadHook ? nullptr : buffer, finished, _expectedByteCount);
+  GIF_TRACE_INSTANT("ChunkArrived", buffer->Length);
+  //the hook only queues the buffer for decoding, the disk/memory write runs alongside it and the
+  //next read waits for both so a slow decoder pushes back on the socket instead of piling up chunks
+  auto admitted = _dataReadHook(_dontBufferReadHook ? nullptr : buffer, finished, _expectedByteCount);
+  return continue_void_task(WriteBufferToCache(buffer),
+    [=]()
+  {
+    return admitted;
+  }, make_error_handler<void, Exception^>(), _cancelToken);
+}
+
+task<void> ResourceLoader::WriteBufferToCache(IBuffer^ buffer)
+{
   if (_cacheResult)
   {
     //if we've not opened an output file start writing the stream out to disk with a filename based on the MD5 of the resourceLocator
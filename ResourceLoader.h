@@ -10,7 +10,7 @@ private:
 	ResourceLoader(concurrency::cancellation_token token) : _cancelToken(token) { }
 	Platform::String^ _resourceLocator;
 	concurrency::cancellation_token _cancelToken;
-	std::function<void(Windows::Storage::Streams::IBuffer^, bool, uint32_t)> _dataReadHook;
+	std::function<concurrency::task<void>(Windows::Storage::Streams::IBuffer^, bool, uint32_t)> _dataReadHook;
 	std::function<std::tuple<bool, bool>(Windows::Storage::Streams::IBuffer^, uint32_t)> _initialReadHook;
 	uint32_t _expectedByteCount;
 	bool _cacheResult;
@@ -24,6 +24,7 @@ private:
 	concurrency::task<Windows::Storage::Streams::IRandomAccessStream^> GetHttpUri();
 	concurrency::task<void> ReadSomeHttp(Windows::Storage::Streams::IInputStream^ inputStream);
 	concurrency::task<void> WriteBufferToResultStream(Windows::Storage::Streams::IBuffer^ buffer, bool finished);
+	concurrency::task<void> WriteBufferToCache(Windows::Storage::Streams::IBuffer^ buffer);
 	concurrency::task<Windows::Storage::Streams::IRandomAccessStream^> BufferRandomAccessStream(Windows::Storage::Streams::IRandomAccessStream^ stream);
 	Platform::String^ ComputeMD5(Platform::String^ str);
 	concurrency::task<void> FailureCacheCleanup();
@@ -44,5 +45,5 @@ public:
 	static concurrency::task<void> CleanOldTemps();
 	static concurrency::task<Windows::Storage::Streams::IRandomAccessStream^> GetResource(Platform::String^ resourceLocator, 
 		std::function<std::tuple<bool, bool>(Windows::Storage::Streams::IBuffer^, uint32_t)> initialRead,
-		std::function<void(Windows::Storage::Streams::IBuffer^, bool, uint32_t)> dataReadHook, concurrency::cancellation_token canceledToken);
+		std::function<concurrency::task<void>(Windows::Storage::Streams::IBuffer^, bool, uint32_t)> dataReadHook, concurrency::cancellation_token canceledToken);
 };
\ No newline at end of file
@@ -13,7 +13,7 @@ static void ThrowIfFailed(HRESULT hr)
 	}
 }
 
-WICImageDecoder::WICImageDecoder(Windows::Storage::Streams::IRandomAccessStream^ imageStream, concurrency::cancellation_token cancelToken) : _cancelToken(cancelToken)
+WICImageDecoder::WICImageDecoder(Windows::Storage::Streams::IRandomAccessStream^ imageStream, concurrency::cancellation_token cancelToken) : _cancelToken(cancelToken), _asyncQueue(std::make_shared<AsyncDecodeQueue>(cancelToken)), _pixelsVersion(0)
 {
 	try
 	{
@@ -68,35 +68,133 @@ void WICImageDecoder::RenderSize(Windows::Foundation::Size size)
 	_currentRenderSize = size;
 }
 
+//the render size is captured now, so the result is at the scale that was current when it was asked for
 concurrency::task<Windows::Foundation::Rect> WICImageDecoder::DecodeRectangleAsync(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext)
 {
-	throw ref new Platform::NotImplementedException();
+	auto decoder = shared_from_this();
+	auto renderSize = _currentRenderSize;
+	return _asyncQueue->Schedule([decoder, requestedRect, renderSize]()
+	{
+		auto decodedRect = decoder->DecodePixels(requestedRect, renderSize);
+		decoder->ReportDecodedBytes();
+		return decodedRect;
+	});
 }
 
 bool WICImageDecoder::CanDecode(Windows::Foundation::Rect rect)
 {
-	return true;
+	std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+	return _decodedPixels.Covers(rect, _currentRenderSize);
+}
+
+//runs on the decode pool, only one at a time per decoder
+Windows::Foundation::Rect WICImageDecoder::DecodePixels(Windows::Foundation::Rect requestedRect, Windows::Foundation::Size renderSize)
+{
+	auto decodeStart = _stats.Now();
+	if (_asyncFrame == nullptr)
+	{
+		Microsoft::WRL::ComPtr<IStream> comStream;
+		auto stream = _imageStream->CloneStream();
+		stream->Seek(0);
+		ThrowIfFailed(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER,
+			IID_IWICImagingFactory, (LPVOID*)&_asyncFactory));
+		ThrowIfFailed(CreateStreamOverRandomAccessStream(stream, __uuidof(IStream), &comStream));
+		ThrowIfFailed(_asyncFactory->CreateDecoderFromStream(comStream.Get(), nullptr, WICDecodeMetadataCacheOnLoad, &_asyncDecoder));
+		ThrowIfFailed(_asyncDecoder->GetFrame(0, &_asyncFrame));
+	}
+
+	DecodedPixels target;
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		std::swap(target, _sparePixels);
+	}
+
+	auto stageSource = CreateDecodeSource(_asyncFactory.Get(), _asyncFrame.Get(), requestedRect, renderSize);
+	Microsoft::WRL::ComPtr<IWICFormatConverter> converter;
+	ThrowIfFailed(_asyncFactory->CreateFormatConverter(&converter));
+	ThrowIfFailed(converter->Initialize(stageSource.Get(), GUID_WICPixelFormat32bppPBGRA,
+		WICBitmapDitherTypeNone, nullptr, 0.0f,
+		WICBitmapPaletteTypeCustom));
+
+	UINT width, height;
+	ThrowIfFailed(converter->GetSize(&width, &height));
+	//resize keeps the capacity from the last decode so same sized requests don't allocate
+	target.pixels.resize(static_cast<size_t>(width) * height);
+	ThrowIfFailed(converter->CopyPixels(nullptr, width * 4, static_cast<UINT>(target.pixels.size() * 4), reinterpret_cast<BYTE*>(target.pixels.data())));
+	target.width = width;
+	target.height = height;
+	target.rect = requestedRect;
+	target.renderSize = renderSize;
+	target.valid = true;
+
+	_stats.FrameDecoded(_stats.Now() - decodeStart);
+	std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+	std::swap(target, _decodedPixels);
+	_pixelsVersion++;
+	_sparePixels = std::move(target);
+	_sparePixels.valid = false;
+	return requestedRect;
 }
 
-Windows::Foundation::Rect WICImageDecoder::DecodeRectangle(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& copyDestination, bool& requeue)
+Windows::Foundation::Rect WICImageDecoder::DecodeRectangle(Windows::Foundation::Rect requestedRect, IFrameSink& sink, bool& requeue)
+{
+  {
+    std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+    if (_decodedPixels.Covers(requestedRect, _currentRenderSize))
+    {
+      //a still image only changes when the background decode swaps in new pixels, until then the sink already has them
+      sink.Prepare(_decodedPixels.width, _decodedPixels.height, false);
+      auto& held = sink.Contents();
+      if (held.owner != this || held.version != _pixelsVersion)
+      {
+        sink.Upload(_decodedPixels.pixels.data(), _decodedPixels.width, 0, 0, _decodedPixels.width, _decodedPixels.height);
+        FrameSinkContents contents = { this, _pixelsVersion, 0, 0, static_cast<int>(_decodedPixels.width), static_cast<int>(_decodedPixels.height), 1 };
+        sink.Contents(contents);
+      }
+      _stats.FirstFrame();
+      return _decodedPixels.rect;
+    }
+  }
+
+  //nothing decoded in the background covers this, do it here
+  Microsoft::WRL::ComPtr<IWICFormatConverter> converter;
+  auto stageSource = CreateDecodeSource(_imagingFactory.Get(), _baseBitmapFrame.Get(), requestedRect, _currentRenderSize);
+  ThrowIfFailed(_imagingFactory->CreateFormatConverter(&converter));
+  ThrowIfFailed(converter->Initialize(stageSource.Get(), GUID_WICPixelFormat32bppPBGRA,
+    WICBitmapDitherTypeNone, nullptr, 0.0f,
+    WICBitmapPaletteTypeCustom));
+
+  UINT width, height;
+  ThrowIfFailed(converter->GetSize(&width, &height));
+  std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+  ThrowIfFailed(converter->CopyPixels(nullptr, width * 4, static_cast<UINT>(pixels.size() * 4), reinterpret_cast<BYTE*>(pixels.data())));
+  sink.Prepare(width, height, false);
+  sink.Upload(pixels.data(), width, 0, 0, width, height);
+  //decoded on the spot rather than kept, so there is no version for the next draw to match
+  sink.Forget();
+  _stats.FirstFrame();
+	return requestedRect;
+}
+
+//called with the UI thread's factory and frame or the pool's, never a mix, see _asyncFrame
+Microsoft::WRL::ComPtr<IWICBitmapSource> WICImageDecoder::CreateDecodeSource(IWICImagingFactory* factory, IWICBitmapFrameDecode* frame, Windows::Foundation::Rect requestedRect, Windows::Foundation::Size renderSize)
 {
   Microsoft::WRL::ComPtr<IWICBitmapClipper> clipper;
   Microsoft::WRL::ComPtr<IWICBitmapScaler> scaler;
-  Microsoft::WRL::ComPtr<IWICFormatConverter> converter;
   Microsoft::WRL::ComPtr<IWICBitmapSource> stageSource;
 
-  ThrowIfFailed(_baseBitmapFrame.As(&stageSource));
+  ThrowIfFailed(frame->QueryInterface(IID_PPV_ARGS(&stageSource)));
 
   UINT imageWidth, imageHeight;
-  ThrowIfFailed(_baseBitmapFrame->GetSize(&imageWidth, &imageHeight));
+  ThrowIfFailed(frame->GetSize(&imageWidth, &imageHeight));
 
   if (requestedRect.Left != 0 || requestedRect.Right != 0 ||
-    requestedRect.Right != _currentRenderSize.Width || requestedRect.Bottom != _currentRenderSize.Height)
+    requestedRect.Right != renderSize.Width || requestedRect.Bottom != renderSize.Height)
   {
-    ThrowIfFailed(_imagingFactory->CreateBitmapClipper(&clipper));
+    ThrowIfFailed(factory->CreateBitmapClipper(&clipper));
 
-    auto nPercentW = ((float)imageWidth / _currentRenderSize.Width);
-    auto nPercentH = ((float)imageHeight / _currentRenderSize.Height);
+    auto nPercentW = ((float)imageWidth / renderSize.Width);
+    auto nPercentH = ((float)imageHeight / renderSize.Height);
     auto overallImageScale = nPercentH < nPercentW ? nPercentH : nPercentW;
 
     WICRect clipRect = { (int)(overallImageScale * requestedRect.Left), (int)(overallImageScale * requestedRect.Top),
@@ -105,21 +203,40 @@ Windows::Foundation::Rect WICImageDecoder::DecodeRectangle(Windows::Foundation::
     ThrowIfFailed(clipper.As(&stageSource));
   }
 
-  if (_currentRenderSize.Width != static_cast<float>(imageWidth) ||
-    _currentRenderSize.Height != static_cast<float>(imageHeight))
+  if (renderSize.Width != static_cast<float>(imageWidth) ||
+    renderSize.Height != static_cast<float>(imageHeight))
   {
-    ThrowIfFailed(_imagingFactory->CreateBitmapScaler(&scaler));
+    ThrowIfFailed(factory->CreateBitmapScaler(&scaler));
     ThrowIfFailed(scaler->Initialize(stageSource.Get(), requestedRect.Width, requestedRect.Height, WICBitmapInterpolationMode::WICBitmapInterpolationModeFant));
     ThrowIfFailed(scaler.As(&stageSource));
   }
+  return stageSource;
+}
 
-  ThrowIfFailed(_imagingFactory->CreateFormatConverter(&converter));
-  ThrowIfFailed(converter->Initialize(stageSource.Get(), GUID_WICPixelFormat32bppPBGRA,
-    WICBitmapDitherTypeNone, nullptr, 0.0f,
-    WICBitmapPaletteTypeCustom));
+//the next draw that isn't covered goes back through DecodeRectangleAsync
+size_t WICImageDecoder::EvictDecodedMemory()
+{
+	std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+	_decodedPixels = DecodedPixels();
+	_sparePixels = DecodedPixels();
+	_pixelsVersion++;
+	return 0;
+}
 
-  ThrowIfFailed(d2dContext->CreateBitmapFromWicBitmap(converter.Get(), copyDestination.ReleaseAndGetAddressOf()));
-	return requestedRect;
+void WICImageDecoder::ReportDecodedBytes()
+{
+	size_t bytes;
+	{
+		std::lock_guard<std::mutex> pixelsGuard(_pixelsMutex);
+		bytes = (_decodedPixels.pixels.capacity() + _sparePixels.pixels.capacity()) * sizeof(uint32_t);
+	}
+	_stats.DecodedBytes(bytes);
+	DecodedMemoryBudget::Instance().Report(shared_from_this(), bytes);
+}
+
+WICImageDecoder::~WICImageDecoder()
+{
+	DecodedMemoryBudget::Instance().Remove(this);
 }
 
 void WICImageDecoder::Suspend()
@@ -1,14 +1,16 @@
 #pragma once
 
 #include "IImageDecoder.h"
+#include "AsyncDecodeQueue.h"
 #include <memory>
+#include <mutex>
 #include <wrl.h>
 #include <wrl\client.h>
 #include <wincodec.h>
 
 class ResourceLoader;
 
-class WICImageDecoder : public IImageDecoder
+class WICImageDecoder : public IImageDecoder, public std::enable_shared_from_this<WICImageDecoder>
 {
 private:
 	Windows::Storage::Streams::IRandomAccessStream^ _imageStream;
@@ -21,6 +23,22 @@ private:
     Microsoft::WRL::ComPtr<IWICBitmapDecoder> _bitmapDecoder;
     Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> _baseBitmapFrame;
     Microsoft::WRL::ComPtr<IWICImagingFactory> _imagingFactory;
+
+	std::shared_ptr<AsyncDecodeQueue> _asyncQueue;
+	//the decoder above belongs to the UI thread, pool decodes read a clone of the stream through their own, created
+	//by the first one, _asyncQueue runs them one at a time so nothing else touches these
+	Microsoft::WRL::ComPtr<IWICImagingFactory> _asyncFactory;
+	Microsoft::WRL::ComPtr<IWICBitmapDecoder> _asyncDecoder;
+	Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> _asyncFrame;
+	//_decodedPixels is what DecodeRectangle uploads from, the background decode fills _sparePixels and swaps them
+	std::mutex _pixelsMutex;
+	DecodedPixels _decodedPixels;
+	DecodedPixels _sparePixels;
+	//bumped every time _decodedPixels is replaced, a sink already holding this version needs nothing sent
+	uint64_t _pixelsVersion;
+	Microsoft::WRL::ComPtr<IWICBitmapSource> CreateDecodeSource(IWICImagingFactory* factory, IWICBitmapFrameDecode* frame, Windows::Foundation::Rect requestedRect, Windows::Foundation::Size renderSize);
+	Windows::Foundation::Rect DecodePixels(Windows::Foundation::Rect requestedRect, Windows::Foundation::Size renderSize);
+	void ReportDecodedBytes();
 public:
 	WICImageDecoder(Windows::Storage::Streams::IRandomAccessStream^ imageStream, concurrency::cancellation_token cancelToken);
 	static std::shared_ptr<IImageDecoder> MakeImageDecoder(Windows::Storage::Streams::IRandomAccessStream^ imageStream, concurrency::cancellation_token cancelToken);
@@ -29,8 +47,9 @@ public:
 	virtual void RenderSize(Windows::Foundation::Size size);
 	virtual concurrency::task<Windows::Foundation::Rect> DecodeRectangleAsync(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext);
 	virtual bool CanDecode(Windows::Foundation::Rect rect);
-	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, Microsoft::WRL::ComPtr<ID2D1DeviceContext> d2dContext, Microsoft::WRL::ComPtr<ID2D1Bitmap1>& copyDestination, bool& requeue);
+	virtual Windows::Foundation::Rect DecodeRectangle(Windows::Foundation::Rect requestedRect, IFrameSink& sink, bool& requeue);
 	virtual void Suspend();
 	virtual void Resume();
-	virtual ~WICImageDecoder() {};
+	virtual size_t EvictDecodedMemory();
+	virtual ~WICImageDecoder();
 };
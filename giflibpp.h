@@ -14,12 +14,30 @@
 #include <vector>
 #include <memory>
 
+#include "GifTrace.h"
+
 #define GIF_STAMP "GIFVER"          /* First chars in file - GIF stamp.  */
 #define GIF_STAMP_LEN sizeof(GIF_STAMP) - 1
 #define GIF_VERSION_POS 3           /* Version first character in stamp. */
 #define GIF87_STAMP "GIF87a"        /* First chars in file - GIF stamp.  */
 #define GIF89_STAMP "GIF89a"        /* First chars in file - GIF stamp.  */
 
+/* Thrown from inside parsing or LZW decode once USERDATA::canceled() reports
+* true, it is polled per record, per row and per sub-block so it needs to be
+* a cheap flag read. */
+class GifCanceledException : public std::runtime_error
+{
+public:
+  GifCanceledException() : std::runtime_error("gif decode canceled") {}
+};
+
+template<typename USERDATA>
+void ThrowIfCanceled(USERDATA& userData)
+{
+  if (userData.canceled())
+    throw GifCanceledException();
+}
+
 typedef unsigned char GifPixelType;
 typedef unsigned char *GifRowType;
 typedef unsigned char GifByteType;
@@ -52,43 +70,241 @@ enum GifRecordType
   TERMINATE_RECORD_TYPE   /* Begin with ';' */
 };
 
+/******************************************************************************
+Memory resources
+Mirrors the std::pmr::memory_resource interface (our toolsets don't ship
+<memory_resource> yet) so that everything the parser builds for one file can
+be placed in a single arena instead of hitting the heap per sub-block.
+******************************************************************************/
+class GifMemoryResource
+{
+public:
+  virtual ~GifMemoryResource() {}
+  void* allocate(size_t bytes) { return do_allocate(bytes); }
+  void deallocate(void* p, size_t bytes) { do_deallocate(p, bytes); }
+  bool is_equal(const GifMemoryResource& other) const { return this == &other || do_is_equal(other); }
+protected:
+  virtual void* do_allocate(size_t bytes) = 0;
+  virtual void do_deallocate(void* p, size_t bytes) = 0;
+  virtual bool do_is_equal(const GifMemoryResource& other) const { return false; }
+};
+
+class GifNewDeleteResource : public GifMemoryResource
+{
+protected:
+  virtual void* do_allocate(size_t bytes) { return ::operator new(bytes); }
+  virtual void do_deallocate(void* p, size_t bytes) { ::operator delete(p); }
+};
+
+/* static member of a template so the header can define it without a .cpp */
+template<typename T = void>
+struct GifDefaultResourceHolder
+{
+  static GifNewDeleteResource Instance;
+};
+template<typename T> GifNewDeleteResource GifDefaultResourceHolder<T>::Instance;
+
+inline GifMemoryResource* GifDefaultResource()
+{
+  return &GifDefaultResourceHolder<>::Instance;
+}
+
+/* Bump allocator, deallocate is a no-op and everything goes away at once in
+* release() or the destructor. Chunks double in size up to MaxChunkSize so a
+* long animation ends up in a handful of upstream allocations. */
+class GifMonotonicResource : public GifMemoryResource
+{
+private:
+  struct Chunk
+  {
+    Chunk* Next;
+    size_t Size;
+  };
+  static const size_t Alignment = 16;
+  static const size_t MaxChunkSize = 256 * 1024;
+  GifMemoryResource* _upstream;
+  Chunk* _head;
+  unsigned char* _cursor;
+  size_t _remaining;
+  size_t _nextChunkSize;
+  size_t _reserved;
+
+  static size_t AlignUp(size_t n) { return (n + Alignment - 1) & ~(Alignment - 1); }
+
+  GifMonotonicResource(const GifMonotonicResource&);
+  GifMonotonicResource& operator=(const GifMonotonicResource&);
+public:
+  explicit GifMonotonicResource(size_t initialSize = 4096, GifMemoryResource* upstream = GifDefaultResource()) :
+    _upstream(upstream), _head(nullptr), _cursor(nullptr), _remaining(0), _nextChunkSize(initialSize), _reserved(0)
+  {
+  }
+
+  ~GifMonotonicResource()
+  {
+    release();
+  }
+
+  void release()
+  {
+    while (_head != nullptr)
+    {
+      auto next = _head->Next;
+      _reserved -= _head->Size;
+      _upstream->deallocate(_head, _head->Size);
+      _head = next;
+    }
+    _cursor = nullptr;
+    _remaining = 0;
+  }
+
+  /* bytes currently held from upstream */
+  size_t reserved() const { return _reserved; }
+
+  /* where the arena had got to, rewind() hands back everything allocated after it */
+  struct Marker
+  {
+    Chunk* Head;
+    unsigned char* Cursor;
+    size_t Remaining;
+    size_t NextChunkSize;
+  };
+
+  Marker mark() const
+  {
+    Marker marker = { _head, _cursor, _remaining, _nextChunkSize };
+    return marker;
+  }
+
+  /* nothing allocated since marker can still be in use, chunks added after it go back upstream */
+  void rewind(const Marker& marker)
+  {
+    while (_head != marker.Head)
+    {
+      auto next = _head->Next;
+      _reserved -= _head->Size;
+      _upstream->deallocate(_head, _head->Size);
+      _head = next;
+    }
+    _cursor = marker.Cursor;
+    _remaining = marker.Remaining;
+    _nextChunkSize = marker.NextChunkSize;
+  }
+
+protected:
+  virtual void* do_allocate(size_t bytes)
+  {
+    bytes = AlignUp(bytes == 0 ? 1 : bytes);
+    if (bytes > _remaining)
+    {
+      auto header = AlignUp(sizeof(Chunk));
+      auto chunkSize = _nextChunkSize > bytes + header ? _nextChunkSize : bytes + header;
+      auto chunk = static_cast<Chunk*>(_upstream->allocate(chunkSize));
+      chunk->Next = _head;
+      chunk->Size = chunkSize;
+      _head = chunk;
+      _reserved += chunkSize;
+      _cursor = reinterpret_cast<unsigned char*>(chunk) + header;
+      _remaining = chunkSize - header;
+      if (_nextChunkSize < MaxChunkSize)
+        _nextChunkSize *= 2;
+    }
+    auto result = _cursor;
+    _cursor += bytes;
+    _remaining -= bytes;
+    return result;
+  }
+
+  virtual void do_deallocate(void* p, size_t bytes)
+  {
+  }
+};
+
+/* polymorphic_allocator equivalent for GifMemoryResource */
+template<typename T>
+class GifAllocator
+{
+private:
+  GifMemoryResource* _resource;
+public:
+  typedef T value_type;
+  template<typename U> struct rebind { typedef GifAllocator<U> other; };
+
+  GifAllocator() : _resource(GifDefaultResource()) {}
+  GifAllocator(GifMemoryResource* resource) : _resource(resource) {}
+  template<typename U> GifAllocator(const GifAllocator<U>& other) : _resource(other.resource()) {}
+
+  T* allocate(size_t n)
+  {
+    if (n > SIZE_MAX / sizeof(T))
+      throw std::bad_alloc();
+    return static_cast<T*>(_resource->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n)
+  {
+    _resource->deallocate(p, n * sizeof(T));
+  }
+
+  GifMemoryResource* resource() const { return _resource; }
+};
+
+template<typename T, typename U>
+bool operator==(const GifAllocator<T>& lhs, const GifAllocator<U>& rhs)
+{
+  return lhs.resource()->is_equal(*rhs.resource());
+}
+
+template<typename T, typename U>
+bool operator!=(const GifAllocator<T>& lhs, const GifAllocator<U>& rhs)
+{
+  return !(lhs == rhs);
+}
+
 /******************************************************************************
 GIF89 structures
 ******************************************************************************/
 struct ExtensionBlock
 {
-  std::vector<GifByteType> Bytes; /* on malloc(3) heap */
-  int Function;       /* The block function code */
 #define CONTINUE_EXT_FUNC_CODE    0x00    /* continuation subblock */
 #define COMMENT_EXT_FUNC_CODE     0xfe    /* comment */
 #define GRAPHICS_EXT_FUNC_CODE    0xf9    /* graphics control (GIF89) */
 #define PLAINTEXT_EXT_FUNC_CODE   0x01    /* plaintext */
 #define APPLICATION_EXT_FUNC_CODE 0xff    /* application block */
+
+  /* A view of an extension the parser didn't need, the payload stays in the
+  * source and is only copied out by MaterializeExtension */
+  int Function;       /* The block function code */
+  uint32_t Offset;    /* Stream offset of the first sub-block size byte */
+  uint32_t Length;    /* Bytes spanned by the sub-block chain, terminator included */
 };
 
+typedef std::vector<ExtensionBlock, GifAllocator<ExtensionBlock>> ExtensionBlockList;
+
 #define NO_TRANSPARENT_COLOR	-1
 struct GraphicsControlBlock
 {
-  GraphicsControlBlock(const ExtensionBlock& extension)
+#define DISPOSAL_UNSPECIFIED      0       /* No disposal specified. */
+#define DISPOSE_DO_NOT            1       /* Leave image in place */
+#define DISPOSE_BACKGROUND        2       /* Set area too background color */
+#define DISPOSE_PREVIOUS          3       /* Restore to previous content */
+
+  GraphicsControlBlock() : DisposalMode(DISPOSAL_UNSPECIFIED), UserInputFlag(false), DelayTime(0), TransparentColor(NO_TRANSPARENT_COLOR) {}
+  GraphicsControlBlock(const GifByteType* bytes, size_t length)
   {
-    if (extension.Bytes.size() != 4)
+    if (length != 4)
     {
       throw std::runtime_error("invalid extension size");
     }
 
-    DisposalMode = (extension.Bytes[0] >> 2) & 0x07;
-    UserInputFlag = (extension.Bytes[0] & 0x02) != 0;
-    DelayTime = UNSIGNED_LITTLE_ENDIAN(extension.Bytes[1], extension.Bytes[2]);
-    if (extension.Bytes[0] & 0x01)
-      TransparentColor = (int)extension.Bytes[3];
+    DisposalMode = (bytes[0] >> 2) & 0x07;
+    UserInputFlag = (bytes[0] & 0x02) != 0;
+    DelayTime = UNSIGNED_LITTLE_ENDIAN(bytes[1], bytes[2]);
+    if (bytes[0] & 0x01)
+      TransparentColor = (int)bytes[3];
     else
       TransparentColor = NO_TRANSPARENT_COLOR;
   }
   int DisposalMode;
-#define DISPOSAL_UNSPECIFIED      0       /* No disposal specified. */
-#define DISPOSE_DO_NOT            1       /* Leave image in place */
-#define DISPOSE_BACKGROUND        2       /* Set area too background color */
-#define DISPOSE_PREVIOUS          3       /* Restore to previous content */
   bool UserInputFlag;      /* User confirmation required before disposal */
   int DelayTime;           /* pre-display delay in 0.01sec units */
   int TransparentColor;    /* Palette index for transparency, -1 if none */
@@ -109,9 +325,14 @@ private:
     return (i);
   }
 public:
+  typedef std::vector<GifColorType, GifAllocator<GifColorType>> ColorList;
   int BitsPerPixel;
   bool SortFlag;
-  std::vector<GifColorType> Colors;
+  ColorList Colors;
+
+  explicit ColorMapObject(GifMemoryResource* resource = GifDefaultResource()) : BitsPerPixel(0), SortFlag(false), Colors(GifAllocator<GifColorType>(resource)) {}
+  ColorMapObject(const ColorMapObject& other) : BitsPerPixel(other.BitsPerPixel), SortFlag(other.SortFlag), Colors(other.Colors) {}
+  ColorMapObject(ColorMapObject&& mover) : BitsPerPixel(mover.BitsPerPixel), SortFlag(mover.SortFlag), Colors(std::move(mover.Colors)) {}
 
   void init(unsigned int colorCount)
   {
@@ -128,6 +349,9 @@ public:
 
 struct GifImageDesc
 {
+  explicit GifImageDesc(GifMemoryResource* resource = GifDefaultResource()) : Left(0), Top(0), Width(0), Height(0), Interlace(false), ColorMap(resource) {}
+  GifImageDesc(GifImageDesc&& mover) :
+    Left(mover.Left), Top(mover.Top), Width(mover.Width), Height(mover.Height), Interlace(mover.Interlace), ColorMap(std::move(mover.ColorMap)) {}
   GifWord Left, Top, Width, Height;   /* Current image dimensions. */
   bool Interlace;                     /* Sequential/Interlaced lines. */
   ColorMapObject ColorMap;           /* The local color map */
@@ -138,17 +362,25 @@ struct GifImageDesc
 class SavedImage
 {
 public:
-  SavedImage() {}
+  explicit SavedImage(GifMemoryResource* resource = GifDefaultResource()) : ImageDesc(resource), RasterOffset(0), RasterLength(0), HasGraphicsControl(false), ExtensionBlocks(GifAllocator<ExtensionBlock>(resource)) {}
   SavedImage(const SavedImage&) = delete;
-  SavedImage(SavedImage&& mover)
+  SavedImage(SavedImage&& mover) :
+    ImageDesc(std::move(mover.ImageDesc)),
+    RasterBits(std::move(mover.RasterBits)),
+    RasterOffset(mover.RasterOffset),
+    RasterLength(mover.RasterLength),
+    HasGraphicsControl(mover.HasGraphicsControl),
+    GraphicsControl(mover.GraphicsControl),
+    ExtensionBlocks(std::move(mover.ExtensionBlocks))
   {
-    ImageDesc = std::move(mover.ImageDesc);
-    RasterBits = std::move(mover.RasterBits);
-    ExtensionBlocks = std::move(mover.ExtensionBlocks);
   }
   GifImageDesc ImageDesc;
   std::unique_ptr<GifByteType[]> RasterBits;
-  std::vector<ExtensionBlock> ExtensionBlocks;            /* Extensions before image */
+  uint32_t RasterOffset;                         /* Stream offset of the LZW code size byte, see ReloadRasterBits */
+  uint32_t RasterLength;                         /* Up to and including the terminating sub-block */
+  bool HasGraphicsControl;                       /* Decoded from the 0xF9 block preceding the image */
+  GraphicsControlBlock GraphicsControl;
+  ExtensionBlockList ExtensionBlocks;            /* Other extensions before image, as views */
 };
 
 #define EXTENSION_INTRODUCER      0x21
@@ -249,6 +481,7 @@ public:
   {
     if (buf[0] == 0)
     {
+      ThrowIfCanceled(userData);
       /* Needs to read the next buffer - this one is empty: */
       if (userData.read(buf, 1) != 1)
       {
@@ -481,6 +714,8 @@ public:
     if (!lineLen)
       throw std::runtime_error("invalid line length");
 
+    ThrowIfCanceled(userData);
+
     if ((PixelCount -= lineLen) > 0xffff0000UL)
     {
       throw std::runtime_error("data too big");
@@ -516,6 +751,42 @@ GifWord GetWord(UCALLBACK& callback)
   return (GifWord)UNSIGNED_LITTLE_ENDIAN(c[0], c[1]);
 }
 
+/******************************************************************************
+Decompresses one image's raster, USERDATA has to be positioned on the LZW code
+size byte that follows the image descriptor and local color map.
+******************************************************************************/
+template<typename USERDATA>
+void DecodeRaster(USERDATA& userData, const GifImageDesc& imageDesc, GifByteType* raster)
+{
+  GIF_TRACE_SCOPE_VALUE("LzwDecode", imageDesc.Width * imageDesc.Height);
+  GifDecompressor<USERDATA> decompressor(userData, imageDesc.Width * imageDesc.Height);
+  if (imageDesc.Interlace)
+  {
+    /*
+    * The way an interlaced image should be read -
+    * offsets and jumps...
+    */
+    int InterlacedOffset[] = { 0, 4, 2, 1 };
+    int InterlacedJumps[] = { 8, 8, 4, 2 };
+    /* Need to perform 4 passes on the image */
+    for (int i = 0; i < 4; i++)
+      for (int j = InterlacedOffset[i];
+        j < imageDesc.Height;
+        j += InterlacedJumps[i])
+    {
+      decompressor.GetLine(userData, raster + j*imageDesc.Width, imageDesc.Width);
+    }
+  }
+  else
+  {
+    /* a row at a time so cancellation is noticed inside large frames */
+    for (int j = 0; j < imageDesc.Height; j++)
+    {
+      decompressor.GetLine(userData, raster + j*imageDesc.Width, imageDesc.Width);
+    }
+  }
+}
+
 template<typename UCALLBACK>
 class GifFileType
 {
@@ -523,13 +794,21 @@ class GifFileType
     {
     private:
         UCALLBACK& _userData;
+        GifMonotonicResource* _arena;
+        GifMonotonicResource::Marker _arenaMark;
     public:
-        revertHelper(UCALLBACK& userData) : _userData(userData) {}
+        revertHelper(UCALLBACK& userData, GifMonotonicResource* arena) : _userData(userData), _arena(arena)
+        {
+            if (_arena != nullptr)
+                _arenaMark = _arena->mark();
+        }
         revertHelper& operator=(const revertHelper &tmp) { _userData = tmp._userData; }
         ~revertHelper()
         {
-            //revert the stream to the last known good read
+            //revert the stream to the last known good read, whatever was parsed out of the abandoned part goes with it
             _userData.revert();
+            if (_arena != nullptr)
+                _arena->rewind(_arenaMark);
         }
         void checkpoint(int negativePosition = 0)
         {
@@ -537,9 +816,14 @@ class GifFileType
                 _userData.retro_checkpoint(negativePosition);
             else
                 _userData.checkpoint();
+            if (_arena != nullptr)
+                _arenaMark = _arena->mark();
         }
     };
 
+private:
+  GifMemoryResource* _resource;             /* Backing store for everything parsed out of this file */
+  GifMonotonicResource* _arena;             /* _resource when it can be rolled back, otherwise nullptr */
 public:
   GifWord SWidth, SHeight;                  /* Size of virtual canvas */
   GifWord SColorResolution;                 /* How many colors can we generate? */
@@ -547,11 +831,26 @@ public:
   GifByteType AspectByte;	                  /* Used to compute pixel aspect ratio */
   ColorMapObject SColorMap;                 /* Global colormap, NULL if nonexistent. */
   std::vector<SavedImage> SavedImages;         /* Image sequence (high-level API) */
-  std::vector<ExtensionBlock> ExtensionBlocks; /* Extensions past last image */
+  ExtensionBlockList ExtensionBlocks;       /* Extensions past last image, as views */
+  int LoopCount;                            /* NETSCAPE2.0 loop count, 0 is forever */
+#define LOOP_COUNT_UNSPECIFIED    -1      /* No looping extension present */
   bool Gif89;
-  GifFileType(UCALLBACK& userData)
+  bool DecodeRasters;                       /* When false images are parsed but RasterBits is left empty */
+  GifFileType(UCALLBACK& userData, GifMemoryResource* resource = GifDefaultResource()) : GifFileType(userData, resource, nullptr)
+  {
+  }
+
+  /* a record that runs out of data is parsed again once more arrives, with an arena whatever the failed attempt
+  * allocated is handed back too, so a file arriving in small chunks doesn't grow it on every retry */
+  GifFileType(UCALLBACK& userData, GifMonotonicResource* arena) : GifFileType(userData, arena, arena)
+  {
+  }
+
+private:
+  GifFileType(UCALLBACK& userData, GifMemoryResource* resource, GifMonotonicResource* arena) :
+    _resource(resource), _arena(arena), SColorMap(resource), ExtensionBlocks(GifAllocator<ExtensionBlock>(resource)), LoopCount(LOOP_COUNT_UNSPECIFIED), DecodeRasters(true)
   {
-    revertHelper helper(userData);
+    revertHelper helper(userData, _arena);
     std::array<char, GIF_STAMP_LEN + 1> buf;
     /* Let's see if this is a GIF file: */
     if (userData.read((unsigned char *)&buf[0], GIF_STAMP_LEN) != GIF_STAMP_LEN)
@@ -602,42 +901,38 @@ public:
     helper.checkpoint();
   }
 
+public:
   void Slurp(UCALLBACK& userData)
   {
-	revertHelper helper(userData);
-    std::vector<ExtensionBlock> localExtensionBlocks;
+    GIF_TRACE_SCOPE("Slurp");
+	revertHelper helper(userData, _arena);
+    ExtensionBlockList localExtensionBlocks((GifAllocator<ExtensionBlock>(_resource)));
+    GraphicsControlBlock graphicsControl;
+    bool hasGraphicsControl = false;
     for (;;)
     {
+      ThrowIfCanceled(userData);
       switch (GetRecordType(userData))
       {
         case IMAGE_DESC_RECORD_TYPE:
         {
-          ExtensionBlocks = localExtensionBlocks;
-          SavedImages.emplace_back(LoadImage(userData));
+          SavedImages.emplace_back(LoadImage(userData, localExtensionBlocks));
+          SavedImages.back().HasGraphicsControl = hasGraphicsControl;
+          SavedImages.back().GraphicsControl = graphicsControl;
           localExtensionBlocks.clear();
+          hasGraphicsControl = false;
           helper.checkpoint();
           break;
         }
 
         case EXTENSION_RECORD_TYPE:
         {
-          auto extensionBlock = GetExtension(userData);
-          /* Create an extension block with our data */
-          if (extensionBlock.Bytes.size() > 0)
-          {
-            localExtensionBlocks.push_back(extensionBlock);
-          }
-          while (extensionBlock.Bytes.size() > 0)
-          {
-            extensionBlock = GetExtensionNext(userData);
-            localExtensionBlocks.push_back(extensionBlock);
-          }
-          
+          GetExtension(userData, localExtensionBlocks, graphicsControl, hasGraphicsControl);
           break;
         }
 
         case TERMINATE_RECORD_TYPE:
-          ExtensionBlocks = localExtensionBlocks;
+          ExtensionBlocks.swap(localExtensionBlocks);
           helper.checkpoint();
           return;
           break;
@@ -648,11 +943,10 @@ public:
     }
   }
 private:
-  SavedImage LoadImage(UCALLBACK& userData)
+  SavedImage LoadImage(UCALLBACK& userData, ExtensionBlockList& extensionBlocks)
   {
-    SavedImage image;
-    image.ImageDesc = GetImageDesc(userData);
-    GifDecompressor < typename UCALLBACK > decompressor(userData, image.ImageDesc.Width * image.ImageDesc.Height);
+    SavedImage image(_resource);
+    GetImageDesc(userData, image.ImageDesc);
     if (image.ImageDesc.Width <= 0 || image.ImageDesc.Height <= 0 ||
       image.ImageDesc.Width >(INT_MAX / image.ImageDesc.Height) || 
       image.ImageDesc.Width > SWidth || image.ImageDesc.Height > SHeight)
@@ -665,35 +959,26 @@ private:
     {
       throw std::runtime_error("invalid image descriptor");
     }
-    image.RasterBits = std::make_unique<GifByteType[]>(imageSize);
-    if (image.ImageDesc.Interlace)
+    image.RasterOffset = userData.tell();
+    if (DecodeRasters)
     {
-      /*
-      * The way an interlaced image should be read -
-      * offsets and jumps...
-      */
-      int InterlacedOffset[] = { 0, 4, 2, 1 };
-      int InterlacedJumps[] = { 8, 8, 4, 2 };
-      /* Need to perform 4 passes on the image */
-      for (int i = 0; i < 4; i++)
-        for (int j = InterlacedOffset[i];
-          j < image.ImageDesc.Height;
-          j += InterlacedJumps[i])
-      {
-        decompressor.GetLine(userData, image.RasterBits.get() + j*image.ImageDesc.Width, image.ImageDesc.Width);
-      }
+      image.RasterBits = std::make_unique<GifByteType[]>(imageSize);
+      DecodeRaster(userData, image.ImageDesc, image.RasterBits.get());
     }
     else
     {
-      decompressor.GetLine(userData, image.RasterBits.get(), imageSize);
+      /* leave the LZW data in the stream, ReloadRasterBits can decode it from RasterOffset later */
+      GifByteType codeSize;
+      if (userData.read(&codeSize, 1) != 1)
+      {
+        throw std::runtime_error("failed to initialize decompressor");
+      }
+      SkipSubBlocks(userData, GetSubBlockSize(userData));
     }
+    image.RasterLength = userData.tell() - image.RasterOffset;
 
-    //this is pretty ugly but then again so is the format
-    if (ExtensionBlocks.size() > 0)
-    {
-      image.ExtensionBlocks = ExtensionBlocks;
-      ExtensionBlocks.clear();
-    }
+    //both lists come from _resource so this is a pointer swap rather than a copy
+    image.ExtensionBlocks.swap(extensionBlocks);
     return image;
   }
 
@@ -718,42 +1003,94 @@ private:
     }
   }
 
-  ExtensionBlock GetExtension(UCALLBACK& userData)
+  /******************************************************************************
+  Graphics control and NETSCAPE2.0/ANIMEXTS1.0 looping are decoded in place,
+  everything else (comments, XMP, plain text...) is skipped over and only its
+  position is remembered.
+  ******************************************************************************/
+  void GetExtension(UCALLBACK& userData, ExtensionBlockList& extensions, GraphicsControlBlock& graphicsControl, bool& hasGraphicsControl)
   {
-    GifByteType buf;
-    if (userData.read(&buf, 1) != 1)
+    GifByteType function;
+    if (userData.read(&function, 1) != 1)
     {
       throw std::runtime_error("failed to read extension block");
     }
-    auto extension = GetExtensionNext(userData);
-    extension.Function = buf;
-    return extension;
+    auto offset = userData.tell();
+    auto blockSize = GetSubBlockSize(userData);
+    GifByteType buf[11];
+    if (function == GRAPHICS_EXT_FUNC_CODE && blockSize == 4)
+    {
+      ReadSubBlock(userData, buf, blockSize);
+      graphicsControl = GraphicsControlBlock(buf, blockSize);
+      hasGraphicsControl = true;
+      SkipSubBlocks(userData, GetSubBlockSize(userData));
+      return;
+    }
+    else if (function == APPLICATION_EXT_FUNC_CODE && blockSize == 11)
+    {
+      ReadSubBlock(userData, buf, blockSize);
+      if (memcmp(buf, "NETSCAPE2.0", 11) == 0 || memcmp(buf, "ANIMEXTS1.0", 11) == 0)
+      {
+        blockSize = GetSubBlockSize(userData);
+        if (blockSize == 3)
+        {
+          ReadSubBlock(userData, buf, blockSize);
+          if ((buf[0] & 0x07) == 1)
+            LoopCount = UNSIGNED_LITTLE_ENDIAN(buf[1], buf[2]);
+          blockSize = GetSubBlockSize(userData);
+        }
+        SkipSubBlocks(userData, blockSize);
+        return;
+      }
+      blockSize = GetSubBlockSize(userData);
+    }
+
+    SkipSubBlocks(userData, blockSize);
+    if (userData.tell() - offset > 1)
+    {
+      ExtensionBlock extension = { function, offset, userData.tell() - offset };
+      extensions.push_back(extension);
+    }
   }
 
-  ExtensionBlock GetExtensionNext(UCALLBACK& userData)
+  GifByteType GetSubBlockSize(UCALLBACK& userData)
   {
-    ExtensionBlock extension;
     GifByteType buf;
     if (userData.read(&buf, 1) != 1)
     {
       throw std::runtime_error("failed to read extension block");
     }
-    extension.Bytes.resize(buf);
-    if (buf > 0)
+    return buf;
+  }
+
+  void ReadSubBlock(UCALLBACK& userData, GifByteType* buf, GifByteType blockSize)
+  {
+    if (userData.read(buf, blockSize) != blockSize)
     {
-      if (userData.read(&extension.Bytes[0], buf) != buf)
+      throw std::runtime_error("failed to read extension block");
+    }
+  }
+
+  /* blockSize is the size byte already consumed, runs through the terminator */
+  void SkipSubBlocks(UCALLBACK& userData, GifByteType blockSize)
+  {
+    while (blockSize > 0)
+    {
+      if (userData.skip(blockSize) != blockSize)
       {
         throw std::runtime_error("failed to read extension block");
       }
+      blockSize = GetSubBlockSize(userData);
     }
-
-    return extension;
   }
 
-  GifImageDesc GetImageDesc(UCALLBACK& userData)
+  void GetImageDesc(UCALLBACK& userData, GifImageDesc& imageDesc)
   {
     //left, top, width, height
-    auto imageDesc = GifImageDesc{ GetWord(userData), GetWord(userData), GetWord(userData), GetWord(userData) };
+    imageDesc.Left = GetWord(userData);
+    imageDesc.Top = GetWord(userData);
+    imageDesc.Width = GetWord(userData);
+    imageDesc.Height = GetWord(userData);
     GifByteType buf[3];
     if (userData.read(buf, 1) != 1)
     {
@@ -781,11 +1118,181 @@ private:
         imageDesc.ColorMap.Colors[i].Blue = buf[2];
       }
     }
+  }
+};
+
+/******************************************************************************
+Copies the data sub-blocks of an extension view out of SOURCE, which has to
+offer bool read_at(uint32_t offset, GifByteType* buf, uint32_t length) over
+the same stream the view was recorded from. For application extensions the
+first 11 bytes are the identifier.
+******************************************************************************/
+template<typename SOURCE>
+void MaterializeExtension(SOURCE& source, const ExtensionBlock& extension, std::vector<GifByteType>& bytes)
+{
+  bytes.clear();
+  auto position = extension.Offset;
+  auto end = extension.Offset + extension.Length;
+  while (position < end)
+  {
+    GifByteType blockSize;
+    if (!source.read_at(position++, &blockSize, 1))
+    {
+      throw std::runtime_error("extension no longer available");
+    }
+    if (blockSize == 0)
+      break;
+    auto existing = bytes.size();
+    bytes.resize(existing + blockSize);
+    if (!source.read_at(position, &bytes[existing], blockSize))
+    {
+      throw std::runtime_error("extension no longer available");
+    }
+    position += blockSize;
+  }
+}
 
-    return imageDesc;
+/******************************************************************************
+Decodes an image's raster again straight out of SOURCE (same contract as
+MaterializeExtension), so the caller can throw RasterBits away and get them
+back later from nothing more than the compressed stream and the SavedImage.
+******************************************************************************/
+template<typename SOURCE>
+class GifSourceReader
+{
+private:
+  const SOURCE& _source;
+  uint32_t _position;
+public:
+  GifSourceReader(const SOURCE& source, uint32_t position) : _source(source), _position(position) {}
+  int read(GifByteType* buf, unsigned int length)
+  {
+    if (!_source.read_at(_position, buf, length))
+      return 0;
+    _position += length;
+    return length;
   }
+  bool canceled() const { return false; }
 };
 
+template<typename SOURCE>
+std::unique_ptr<GifByteType[]> ReloadRasterBits(const SOURCE& source, const SavedImage& image)
+{
+  auto raster = std::make_unique<GifByteType[]>(image.ImageDesc.Width * image.ImageDesc.Height);
+  GifSourceReader<SOURCE> reader(source, image.RasterOffset);
+  DecodeRaster(reader, image.ImageDesc, raster.get());
+  return raster;
+}
+
+/******************************************************************************
+Walks the record structure of whatever part of SOURCE has arrived without
+decoding or allocating anything, so the caller can see how big a file is
+going to be before parsing it for real. Call again as more of the stream
+arrives, it carries on from the last complete record.
+******************************************************************************/
+struct GifStructureScan
+{
+  uint32_t Position;          /* Everything before this has been accounted for */
+  GifWord SWidth, SHeight;
+  int GlobalBitsPerPixel;     /* 0 without a global color map */
+  uint32_t ImageCount;
+  uint64_t RasterPixels;      /* Width * height summed over every image */
+  uint64_t PackedRasterBytes; /* Bytes the same take packed, see GifPackedDepth */
+  uint64_t LargestRaster;
+  bool Finished;              /* Trailer reached, or the stream stopped making sense */
+  GifStructureScan() : Position(0), SWidth(0), SHeight(0), GlobalBitsPerPixel(0), ImageCount(0), RasterPixels(0), PackedRasterBytes(0), LargestRaster(0), Finished(false) {}
+};
+
+/* rounds a color map depth up to one that divides a byte, so packed pixels
+   never straddle two, the raster store and the scan estimate both use it */
+inline int GifPackedDepth(int bitsPerPixel)
+{
+  if (bitsPerPixel <= 1)
+    return 1;
+  if (bitsPerPixel <= 2)
+    return 2;
+  if (bitsPerPixel <= 4)
+    return 4;
+  return 8;
+}
+
+template<typename SOURCE>
+void ScanGifStructure(const SOURCE& source, GifStructureScan& scan)
+{
+  GifByteType buf[13];
+  /* runs through a sub-block chain, false if it isn't all there yet */
+  auto skipSubBlocks = [&](uint32_t& position) -> bool
+  {
+    for (;;)
+    {
+      GifByteType blockSize;
+      if (!source.read_at(position++, &blockSize, 1))
+        return false;
+      if (blockSize == 0)
+        return true;
+      position += blockSize;
+    }
+  };
+
+  if (scan.Position == 0)
+  {
+    if (!source.read_at(0, buf, 13))
+      return;
+    scan.SWidth = UNSIGNED_LITTLE_ENDIAN(buf[6], buf[7]);
+    scan.SHeight = UNSIGNED_LITTLE_ENDIAN(buf[8], buf[9]);
+    scan.Position = 13;
+    if (buf[10] & 0x80)
+    {
+      scan.GlobalBitsPerPixel = (buf[10] & 0x07) + 1;
+      scan.Position += 3 * (1 << scan.GlobalBitsPerPixel);
+    }
+  }
+
+  while (!scan.Finished)
+  {
+    auto position = scan.Position;
+    if (!source.read_at(position++, buf, 1))
+      return;
+    switch (buf[0])
+    {
+      case EXTENSION_INTRODUCER:
+        if (!source.read_at(position++, buf, 1) || !skipSubBlocks(position))
+          return;
+        break;
+      case DESCRIPTOR_INTRODUCER:
+      {
+        if (!source.read_at(position, buf, 9))
+          return;
+        position += 9;
+        uint64_t pixels = static_cast<uint64_t>(UNSIGNED_LITTLE_ENDIAN(buf[4], buf[5])) * UNSIGNED_LITTLE_ENDIAN(buf[6], buf[7]);
+        auto bitsPerPixel = scan.GlobalBitsPerPixel;
+        if (buf[8] & 0x80)
+        {
+          bitsPerPixel = (buf[8] & 0x07) + 1;
+          position += 3 * (1 << bitsPerPixel);
+        }
+        if (bitsPerPixel == 0)
+          bitsPerPixel = 8;
+        /* the LZW code size byte, then the data */
+        position++;
+        if (!skipSubBlocks(position))
+          return;
+        scan.ImageCount++;
+        scan.RasterPixels += pixels;
+        scan.PackedRasterBytes += (pixels * GifPackedDepth(bitsPerPixel) + 7) / 8;
+        if (pixels > scan.LargestRaster)
+          scan.LargestRaster = pixels;
+        break;
+      }
+      default:
+        /* the trailer, or something Slurp is going to reject anyway */
+        scan.Finished = true;
+        break;
+    }
+    scan.Position = position;
+  }
+}
+
 #define D_GIF_SUCCEEDED          0
 #define D_GIF_ERR_OPEN_FAILED    101    /* And DGif possible errors. */
 #define D_GIF_ERR_READ_FAILED    102